@@ -0,0 +1,130 @@
+//
+//  adaptive_despacer.c
+//  SpacePruner
+//
+
+#include "adaptive_despacer.h"
+
+#include "despacer.h"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+
+/*
+ neon_despace wins when whitespace is rare, because most 64-byte chunks are
+ clean and can be stored as they are, and neontbl_despace wins when it's
+ common, because it never branches on the data. This switches between the
+ two strategies as the input changes.
+
+ The whitespace density is an exponential moving average of the number of
+ whitespace bytes per chunk, in units of 1/256, with a weight of 1/8 for the
+ newest chunk. The masks that find whitespace give it for free. Switching
+ happens at two different thresholds so that input near the crossover
+ doesn't flip the mode on every chunk. The defaults are estimates of where
+ the two kernels cross over, not yet measured.
+ */
+static const unsigned densityScale = 256;
+static const unsigned denseThreshold = ADAPTIVE_DENSE_THRESHOLD;    // by default 1 byte per chunk: ~1.5% whitespace
+static const unsigned sparseThreshold = ADAPTIVE_SPARSE_THRESHOLD;  // by default 1/4 byte per chunk: ~0.4% whitespace
+
+static inline unsigned update_density(unsigned density, unsigned whiteCount) {
+  return density - (density >> 3) + whiteCount * (densityScale / 8);
+}
+
+size_t neon_adaptive_despace(char *bytes, size_t howmany) {
+  size_t i = despace_clean_prefix_length(bytes, howmany), pos = i;
+  const size_t chunk_size = 16 * 4;
+  unsigned density = 0;
+
+  while (i + chunk_size <= howmany) {
+    // Sparse mode: skip the table lookups for clean chunks.
+    for (; i + chunk_size <= howmany; i += chunk_size) {
+      uint8x16_t vecbytes0 = vld1q_u8((uint8_t *)bytes + i);
+      uint8x16_t vecbytes1 = vld1q_u8((uint8_t *)bytes + i + 16);
+      uint8x16_t vecbytes2 = vld1q_u8((uint8_t *)bytes + i + 32);
+      uint8x16_t vecbytes3 = vld1q_u8((uint8_t *)bytes + i + 48);
+      uint8x16_t w0 = is_nonwhite(vecbytes0);
+      uint8x16_t w1 = is_nonwhite(vecbytes1);
+      uint8x16_t w2 = is_nonwhite(vecbytes2);
+      uint8x16_t w3 = is_nonwhite(vecbytes3);
+      uint8x16_t allnonwhite = vandq_u8(vandq_u8(w0, w1), vandq_u8(w2, w3));
+      if (vminvq_u8(allnonwhite) == 0xFF) {
+        vst1q_u8((uint8_t *)bytes + pos, vecbytes0);
+        vst1q_u8((uint8_t *)bytes + pos + 16, vecbytes1);
+        vst1q_u8((uint8_t *)bytes + pos + 32, vecbytes2);
+        vst1q_u8((uint8_t *)bytes + pos + 48, vecbytes3);
+        pos += chunk_size;
+        density = update_density(density, 0);
+        continue;
+      }
+
+      uint8_t numberofkeptchars0 = bytepopcount(w0);
+      uint8_t numberofkeptchars1 = bytepopcount(w1);
+      uint8_t numberofkeptchars2 = bytepopcount(w2);
+      uint8_t numberofkeptchars3 = bytepopcount(w3);
+      uint8x16_t reshuf0 = vqtbl1q_u8(vecbytes0, vld1q_u8(shufmask + 16 * neonmovemask_addv(w0)));
+      uint8x16_t reshuf1 = vqtbl1q_u8(vecbytes1, vld1q_u8(shufmask + 16 * neonmovemask_addv(w1)));
+      uint8x16_t reshuf2 = vqtbl1q_u8(vecbytes2, vld1q_u8(shufmask + 16 * neonmovemask_addv(w2)));
+      uint8x16_t reshuf3 = vqtbl1q_u8(vecbytes3, vld1q_u8(shufmask + 16 * neonmovemask_addv(w3)));
+      vst1q_u8((uint8_t *)bytes + pos, reshuf0);
+      pos += numberofkeptchars0;
+      vst1q_u8((uint8_t *)bytes + pos, reshuf1);
+      pos += numberofkeptchars1;
+      vst1q_u8((uint8_t *)bytes + pos, reshuf2);
+      pos += numberofkeptchars2;
+      vst1q_u8((uint8_t *)bytes + pos, reshuf3);
+      pos += numberofkeptchars3;
+
+      const unsigned kept = numberofkeptchars0 + numberofkeptchars1 + numberofkeptchars2 + numberofkeptchars3;
+      density = update_density(density, (unsigned)chunk_size - kept);
+      if (density > denseThreshold) {
+        i += chunk_size;
+        break;
+      }
+    }
+
+    // Dense mode: compact every chunk without branching, as neontbl_despace does.
+    for (; i + chunk_size <= howmany; i += chunk_size) {
+      uint8x16_t vecbytes0 = vld1q_u8((uint8_t *)bytes + i);
+      uint8x16_t vecbytes1 = vld1q_u8((uint8_t *)bytes + i + 16);
+      uint8x16_t vecbytes2 = vld1q_u8((uint8_t *)bytes + i + 32);
+      uint8x16_t vecbytes3 = vld1q_u8((uint8_t *)bytes + i + 48);
+      uint8x16_t w0 = is_nonwhite(vecbytes0);
+      uint8_t numberofkeptchars0 = bytepopcount(w0);
+      uint8x16_t reshuf0 = vqtbl1q_u8(vecbytes0, vld1q_u8(shufmask + 16 * neonmovemask_addv(w0)));
+      uint8x16_t w1 = is_nonwhite(vecbytes1);
+      uint8_t numberofkeptchars1 = bytepopcount(w1);
+      uint8x16_t reshuf1 = vqtbl1q_u8(vecbytes1, vld1q_u8(shufmask + 16 * neonmovemask_addv(w1)));
+      uint8x16_t w2 = is_nonwhite(vecbytes2);
+      uint8_t numberofkeptchars2 = bytepopcount(w2);
+      uint8x16_t reshuf2 = vqtbl1q_u8(vecbytes2, vld1q_u8(shufmask + 16 * neonmovemask_addv(w2)));
+      uint8x16_t w3 = is_nonwhite(vecbytes3);
+      uint8_t numberofkeptchars3 = bytepopcount(w3);
+      uint8x16_t reshuf3 = vqtbl1q_u8(vecbytes3, vld1q_u8(shufmask + 16 * neonmovemask_addv(w3)));
+
+      vst1q_u8((uint8_t *)bytes + pos, reshuf0);
+      pos += numberofkeptchars0;
+      vst1q_u8((uint8_t *)bytes + pos, reshuf1);
+      pos += numberofkeptchars1;
+      vst1q_u8((uint8_t *)bytes + pos, reshuf2);
+      pos += numberofkeptchars2;
+      vst1q_u8((uint8_t *)bytes + pos, reshuf3);
+      pos += numberofkeptchars3;
+
+      const unsigned kept = numberofkeptchars0 + numberofkeptchars1 + numberofkeptchars2 + numberofkeptchars3;
+      density = update_density(density, (unsigned)chunk_size - kept);
+      if (density < sparseThreshold) {
+        i += chunk_size;
+        break;
+      }
+    }
+  }
+  while (i < howmany) {
+    const unsigned char c = bytes[i++];
+    bytes[pos] = c;
+    pos += (c > 32) ? 1 : 0;
+  }
+  return pos;
+}
+
+#endif // defined(__aarch64__)
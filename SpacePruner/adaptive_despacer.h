@@ -0,0 +1,27 @@
+//
+//  adaptive_despacer.h
+//  SpacePruner
+//
+
+#ifndef adaptive_despacer_h
+#define adaptive_despacer_h
+
+#include <ConditionalMacros.h>
+#include <stddef.h>
+
+#if defined(__aarch64__)
+// Where neon_adaptive_despace switches to the branchless strategy and back,
+// as a moving average of whitespace bytes per 64-byte chunk, times 256.
+// despacebenchmark reports where the two strategies cross over, to set these
+// from.
+#ifndef ADAPTIVE_DENSE_THRESHOLD
+#define ADAPTIVE_DENSE_THRESHOLD 256
+#endif
+#ifndef ADAPTIVE_SPARSE_THRESHOLD
+#define ADAPTIVE_SPARSE_THRESHOLD 64
+#endif
+
+size_t neon_adaptive_despace(char *bytes, size_t howmany);
+#endif
+
+#endif /* adaptive_despacer_h */
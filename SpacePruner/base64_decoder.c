@@ -0,0 +1,223 @@
+//
+//  base64_decoder.c
+//  SpacePruner
+//
+
+#include "base64_decoder.h"
+
+#include <stdbool.h>
+
+#include "despace_vector.h"
+
+enum { BASE64_WHITE = 64, BASE64_PAD = 65, BASE64_INVALID = 255 };
+
+static uint8_t base64_value(unsigned char c) {
+  if (c <= ' ') {
+    return BASE64_WHITE;
+  }
+  if (c >= 'A' && c <= 'Z') {
+    return (uint8_t)(c - 'A');
+  }
+  if (c >= 'a' && c <= 'z') {
+    return (uint8_t)(c - 'a' + 26);
+  }
+  if (c >= '0' && c <= '9') {
+    return (uint8_t)(c - '0' + 52);
+  }
+  switch (c) {
+    case '+': return 62;
+    case '/': return 63;
+    case '=': return BASE64_PAD;
+    default: return BASE64_INVALID;
+  }
+}
+
+struct Base64State {
+  uint8_t *dest;
+  size_t pos;
+  uint32_t bits;
+  unsigned count;    // sextets in bits
+  unsigned padding;  // '=' seen
+};
+
+// Returns the index in chars of the first one that doesn't fit, or howmany.
+static size_t base64_feed(struct Base64State *state, const char *chars, size_t howmany) {
+  for (size_t i = 0; i != howmany; ++i) {
+    const uint8_t value = base64_value((unsigned char)chars[i]);
+    if (value < 64) {
+      if (state->padding > 0) {
+        return i;
+      }
+      state->bits = (state->bits << 6) | value;
+      if (++state->count == 4) {
+        state->dest[state->pos] = (uint8_t)(state->bits >> 16);
+        state->dest[state->pos + 1] = (uint8_t)(state->bits >> 8);
+        state->dest[state->pos + 2] = (uint8_t)state->bits;
+        state->pos += 3;
+        state->bits = 0;
+        state->count = 0;
+      }
+    } else if (value == BASE64_PAD) {
+      if (state->count < 2 || state->count + state->padding == 4) {
+        return i;
+      }
+      ++state->padding;
+    } else if (value != BASE64_WHITE) {
+      return i;
+    }
+  }
+  return howmany;
+}
+
+// Writes out a last, partial quantum.
+static bool base64_finish(struct Base64State *state) {
+  if (state->count == 1 || (state->padding > 0 && state->count + state->padding != 4)) {
+    return false;
+  }
+  if (state->count == 2) {
+    state->dest[state->pos++] = (uint8_t)(state->bits >> 4);
+  } else if (state->count == 3) {
+    state->dest[state->pos++] = (uint8_t)(state->bits >> 10);
+    state->dest[state->pos++] = (uint8_t)(state->bits >> 2);
+  }
+  return true;
+}
+
+size_t base64_decode_despacing_scalar(uint8_t *dest, const char *source, size_t howmany, size_t *errorOffset) {
+  struct Base64State state = { dest, 0, 0, 0, 0 };
+  const size_t stop = base64_feed(&state, source, howmany);
+  if (stop != howmany) {
+    *errorOffset = stop;
+    return SIZE_MAX;
+  }
+  if (!base64_finish(&state)) {
+    *errorOffset = howmany;
+    return SIZE_MAX;
+  }
+  return state.pos;
+}
+
+#if DESPACE_VECTOR
+
+#if defined(__aarch64__)
+
+static inline uint8x16_t in_range(uint8x16_t v, uint8_t low, uint8_t high) {
+  return vandq_u8(vcgeq_u8(v, vdupq_n_u8(low)), vcleq_u8(v, vdupq_n_u8(high)));
+}
+
+// Decodes 16 characters into 12 bytes, storing 16. Returns false if any
+// of them isn't a base64 digit.
+static inline bool decode16(const uint8_t *chars, uint8_t *out) {
+  const uint8x16_t v = vld1q_u8(chars);
+  const uint8x16_t upper = in_range(v, 'A', 'Z');
+  const uint8x16_t lower = in_range(v, 'a', 'z');
+  const uint8x16_t digit = in_range(v, '0', '9');
+  const uint8x16_t plus = vceqq_u8(v, vdupq_n_u8('+'));
+  const uint8x16_t slash = vceqq_u8(v, vdupq_n_u8('/'));
+  const uint8x16_t valid = vorrq_u8(vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, plus)), slash);
+  if (vminvq_u8(valid) == 0) {
+    return false;
+  }
+  // What to add to each kind of character, modulo 256.
+  uint8x16_t offset = vandq_u8(upper, vdupq_n_u8((uint8_t)-65));
+  offset = vorrq_u8(offset, vandq_u8(lower, vdupq_n_u8((uint8_t)-71)));
+  offset = vorrq_u8(offset, vandq_u8(digit, vdupq_n_u8(4)));
+  offset = vorrq_u8(offset, vandq_u8(plus, vdupq_n_u8(62 - '+')));
+  offset = vorrq_u8(offset, vandq_u8(slash, vdupq_n_u8(63 - '/')));
+  const uint8x16_t sextets = vaddq_u8(v, offset);
+
+  // ab = a << 6 | b in every 16 bits, then abcd = ab << 12 | cd in every 32.
+  const uint16x8_t pairs = vreinterpretq_u16_u8(sextets);
+  const uint16x8_t merged = vorrq_u16(vshlq_n_u16(vandq_u16(pairs, vdupq_n_u16(0xFF)), 6), vshrq_n_u16(pairs, 8));
+  const uint32x4_t quads = vreinterpretq_u32_u16(merged);
+  const uint32x4_t packed = vorrq_u32(vshlq_n_u32(vandq_u32(quads, vdupq_n_u32(0xFFFF)), 12), vshrq_n_u32(quads, 16));
+  static const uint8_t order[16] = { 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, 255, 255, 255, 255 };
+  vst1q_u8(out, vqtbl1q_u8(vreinterpretq_u8_u32(packed), vld1q_u8(order)));
+  return true;
+}
+
+#else  // SSSE3
+
+static inline __m128i in_range(__m128i v, char low, char high) {
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((char)(low - 1))),
+                       _mm_cmplt_epi8(v, _mm_set1_epi8((char)(high + 1))));
+}
+
+static inline bool decode16(const uint8_t *chars, uint8_t *out) {
+  // Bytes from 128 up are negative, so they're in none of the ranges.
+  const __m128i v = _mm_loadu_si128((const __m128i *)chars);
+  const __m128i upper = in_range(v, 'A', 'Z');
+  const __m128i lower = in_range(v, 'a', 'z');
+  const __m128i digit = in_range(v, '0', '9');
+  const __m128i plus = _mm_cmpeq_epi8(v, _mm_set1_epi8('+'));
+  const __m128i slash = _mm_cmpeq_epi8(v, _mm_set1_epi8('/'));
+  const __m128i valid = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, plus)), slash);
+  if (_mm_movemask_epi8(valid) != 0xFFFF) {
+    return false;
+  }
+  __m128i offset = _mm_and_si128(upper, _mm_set1_epi8(-65));
+  offset = _mm_or_si128(offset, _mm_and_si128(lower, _mm_set1_epi8(-71)));
+  offset = _mm_or_si128(offset, _mm_and_si128(digit, _mm_set1_epi8(4)));
+  offset = _mm_or_si128(offset, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+  offset = _mm_or_si128(offset, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+  const __m128i sextets = _mm_add_epi8(v, offset);
+
+  // a * 64 + b in every 16 bits, then ab * 4096 + cd in every 32.
+  const __m128i merged = _mm_maddubs_epi16(sextets, _mm_set1_epi32(0x01400140));
+  const __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+  const __m128i order = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  _mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(packed, order));
+  return true;
+}
+
+#endif
+
+size_t base64_decode_despacing(uint8_t *dest, const char *source, size_t howmany, size_t *errorOffset) {
+  // Padding and the last quantum are left to the scalar code, so the vector
+  // loop stops at the last 16-byte block before them.
+  size_t end = howmany;
+  while (end > 0 && ((unsigned char)source[end - 1] <= ' ' || source[end - 1] == '=')) {
+    --end;
+  }
+  const size_t vectorEnd = end - end % 16;
+
+  // Blocks are compacted a batch at a time before any of their characters
+  // are decoded, so the loads don't wait on the unaligned stores just made.
+  // Fewer than 16 characters carry over from one batch to the next.
+  enum { batchLength = 256 };
+  uint8_t stage[batchLength + 32];
+  size_t staged = 0;
+  size_t pos = 0;
+  size_t i = 0;
+  while (i != vectorEnd) {
+    const size_t batchEnd = vectorEnd - i > batchLength ? i + batchLength : vectorEnd;
+    for (; i != batchEnd; i += 16) {
+      size_t kept;
+      store_vector(stage + staged, compact_vector(load_vector((const uint8_t *)source + i), &kept));
+      staged += kept;
+    }
+    size_t done = 0;
+    for (; done + 16 <= staged; done += 16, pos += 12) {
+      if (!decode16(stage + done, dest + pos)) {
+        return base64_decode_despacing_scalar(dest, source, howmany, errorOffset);
+      }
+    }
+    staged -= done;
+    store_vector(stage, load_vector(stage + done));
+  }
+
+  struct Base64State state = { dest, pos, 0, 0, 0 };
+  if (base64_feed(&state, (const char *)stage, staged) != staged
+      || base64_feed(&state, source + i, howmany - i) != howmany - i || !base64_finish(&state)) {
+    return base64_decode_despacing_scalar(dest, source, howmany, errorOffset);
+  }
+  return state.pos;
+}
+
+#else
+
+size_t base64_decode_despacing(uint8_t *dest, const char *source, size_t howmany, size_t *errorOffset) {
+  return base64_decode_despacing_scalar(dest, source, howmany, errorOffset);
+}
+
+#endif // DESPACE_VECTOR
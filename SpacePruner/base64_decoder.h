@@ -0,0 +1,40 @@
+//
+//  base64_decoder.h
+//  SpacePruner
+//
+
+#ifndef base64_decoder_h
+#define base64_decoder_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Room dest needs for decoding howmany characters; the vector kernel may
+// store a few bytes past the end of the result.
+static inline size_t base64_decoded_bound(size_t howmany) {
+  return howmany / 4 * 3 + 8;
+}
+
+/*
+ Decodes standard base64 (RFC 4648, '+' and '/') from source into dest,
+ skipping whitespace (every byte up to 32) wherever it is, as in MIME and
+ PEM bodies. Padding is optional, but once it starts only whitespace and
+ the rest of the padding may follow.
+
+ Returns the number of bytes decoded, or SIZE_MAX if the input isn't valid,
+ in which case errorOffset is the offset in source of the first character
+ that doesn't fit, or howmany if the input ends in the middle of a byte.
+ */
+size_t base64_decode_despacing_scalar(uint8_t *dest, const char *source, size_t howmany, size_t *errorOffset);
+
+/*
+ The same in one pass with vectors: each 16 bytes of input are compacted
+ like despacing does, the characters left are staged, and every 16 staged
+ characters are translated, checked and packed into 12 bytes. Padding and
+ the last few characters are decoded one at a time. Invalid input is found
+ a vector at a time and then decoded again one character at a time to say
+ where.
+ */
+size_t base64_decode_despacing(uint8_t *dest, const char *source, size_t howmany, size_t *errorOffset);
+
+#endif /* base64_decoder_h */
@@ -0,0 +1,472 @@
+//
+//  benchmark_baseline.c
+//  SpacePruner
+//
+
+#include "benchmark_baseline.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
+static void copy_string(char *destination, size_t capacity, const char *source) {
+  snprintf(destination, capacity, "%s", source);
+}
+
+static void describe_cpu(char *cpu, size_t capacity) {
+  copy_string(cpu, capacity, "unknown");
+#if defined(__APPLE__)
+  // The brand string exists on Macs; iOS devices only report their model.
+  static const char *const names[] = { "machdep.cpu.brand_string", "hw.machine", "hw.model" };
+  for (size_t i = 0; i != sizeof(names) / sizeof(names[0]); ++i) {
+    size_t length = capacity;
+    if (sysctlbyname(names[i], cpu, &length, NULL, 0) == 0 && length > 1) {
+      return;
+    }
+  }
+  copy_string(cpu, capacity, "unknown");
+#elif defined(__linux__)
+  FILE *file = fopen("/proc/cpuinfo", "r");
+  if (!file) {
+    return;
+  }
+  char line[256];
+  char implementer[32] = "", part[32] = "";
+  while (fgets(line, sizeof(line), file)) {
+    const char *colon = strchr(line, ':');
+    if (!colon) {
+      continue;
+    }
+    const char *value = colon + 1 + strspn(colon + 1, " \t");
+    const size_t valueLength = strcspn(value, "\n");
+    if (strncmp(line, "model name", 10) == 0) {
+      snprintf(cpu, capacity, "%.*s", (int)valueLength, value);
+      break;
+    } else if (strncmp(line, "CPU implementer", 15) == 0 && !implementer[0]) {
+      snprintf(implementer, sizeof(implementer), "%.*s", (int)valueLength, value);
+    } else if (strncmp(line, "CPU part", 8) == 0 && !part[0]) {
+      snprintf(part, sizeof(part), "%.*s", (int)valueLength, value);
+    }
+  }
+  fclose(file);
+  // ARM kernels don't print a model name, only the identification registers.
+  if (strcmp(cpu, "unknown") == 0 && implementer[0]) {
+    snprintf(cpu, capacity, "implementer %s part %s", implementer, part);
+  }
+#endif
+}
+
+void describe_benchmark_environment(struct BenchmarkEnvironment *environment) {
+  describe_cpu(environment->cpu, sizeof(environment->cpu));
+
+#if defined(__clang__)
+  copy_string(environment->compiler, sizeof(environment->compiler), "clang " __clang_version__);
+#elif defined(__GNUC__)
+  copy_string(environment->compiler, sizeof(environment->compiler), "gcc " __VERSION__);
+#else
+  copy_string(environment->compiler, sizeof(environment->compiler), "unknown");
+#endif
+
+  // The command line isn't visible to the program, so pass it in with
+  // -DDESPACE_BUILD_FLAGS='"..."' to record it; the settings that change
+  // which kernels exist are always added.
+  snprintf(environment->flags, sizeof(environment->flags), "%s%s%s%s%s%s%s",
+#ifdef DESPACE_BUILD_FLAGS
+           DESPACE_BUILD_FLAGS " ",
+#else
+           "",
+#endif
+#ifdef __OPTIMIZE__
+           "optimized",
+#else
+           "unoptimized",
+#endif
+#if defined(__aarch64__)
+           " aarch64",
+#elif defined(__arm__)
+           " arm",
+#elif defined(__x86_64__)
+           " x86_64",
+#else
+           "",
+#endif
+#if __ARM_NEON
+           " neon",
+#else
+           "",
+#endif
+#if defined(__SSSE3__)
+           " ssse3",
+#else
+           "",
+#endif
+#if defined(__AVX2__)
+           " avx2",
+#else
+           "",
+#endif
+#if defined(__AVX512VBMI2__) && defined(__AVX512BW__)
+           " avx512vbmi2"
+#else
+           ""
+#endif
+           );
+}
+
+static void write_json_string(FILE *file, const char *string) {
+  fputc('"', file);
+  for (const unsigned char *p = (const unsigned char *)string; *p; ++p) {
+    if (*p == '"' || *p == '\\') {
+      fprintf(file, "\\%c", *p);
+    } else if (*p < 32) {
+      fprintf(file, "\\u%04x", *p);
+    } else {
+      fputc(*p, file);
+    }
+  }
+  fputc('"', file);
+}
+
+bool save_benchmark_results(const char *path, const struct BenchmarkEnvironment *environment,
+                            const struct BenchmarkResult *results, size_t count) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    return false;
+  }
+  fprintf(file, "{\n  \"cpu\": ");
+  write_json_string(file, environment->cpu);
+  fprintf(file, ",\n  \"compiler\": ");
+  write_json_string(file, environment->compiler);
+  fprintf(file, ",\n  \"flags\": ");
+  write_json_string(file, environment->flags);
+  fprintf(file, ",\n  \"results\": [");
+  for (size_t i = 0; i != count; ++i) {
+    const struct BenchmarkResult *result = &results[i];
+    const struct BenchmarkStats *stats = &result->stats;
+    fprintf(file, "%s\n    {\"kernel\": ", i == 0 ? "" : ",");
+    write_json_string(file, result->kernel);
+    fprintf(file, ", \"size\": %zu, \"density\": %.17g, \"samples\": %zu,"
+            " \"min_ns\": %llu, \"p10_ns\": %llu, \"median_ns\": %llu, \"p90_ns\": %llu, \"max_ns\": %llu,"
+            " \"median_low_ns\": %llu, \"median_high_ns\": %llu, \"mean_ns\": %.17g, \"stddev_ns\": %.17g}",
+            result->size, result->density, stats->sampleCount,
+            (unsigned long long)stats->min, (unsigned long long)stats->p10,
+            (unsigned long long)stats->median, (unsigned long long)stats->p90,
+            (unsigned long long)stats->max, (unsigned long long)stats->medianLow,
+            (unsigned long long)stats->medianHigh, stats->mean, stats->stddev);
+  }
+  fprintf(file, "\n  ]\n}\n");
+  return fclose(file) == 0;
+}
+
+/*
+ Just enough of a JSON parser to read back what save_benchmark_results
+ writes: objects, arrays, strings and numbers. Unknown keys are skipped.
+ */
+struct JsonCursor {
+  const char *p;
+  const char *end;
+};
+
+static void skip_space(struct JsonCursor *cursor) {
+  while (cursor->p < cursor->end && isspace((unsigned char)*cursor->p)) {
+    ++cursor->p;
+  }
+}
+
+static bool consume(struct JsonCursor *cursor, char c) {
+  skip_space(cursor);
+  if (cursor->p < cursor->end && *cursor->p == c) {
+    ++cursor->p;
+    return true;
+  }
+  return false;
+}
+
+static bool parse_string(struct JsonCursor *cursor, char *destination, size_t capacity) {
+  if (!consume(cursor, '"')) {
+    return false;
+  }
+  size_t length = 0;
+  while (cursor->p < cursor->end && *cursor->p != '"') {
+    char c = *cursor->p++;
+    if (c == '\\') {
+      if (cursor->p >= cursor->end) {
+        return false;
+      }
+      c = *cursor->p++;
+      if (c == 'u') {
+        if (cursor->end - cursor->p < 4) {
+          return false;
+        }
+        char hex[5] = { cursor->p[0], cursor->p[1], cursor->p[2], cursor->p[3], 0 };
+        c = (char)strtol(hex, NULL, 16);
+        cursor->p += 4;
+      } else if (c == 'n') {
+        c = '\n';
+      } else if (c == 't') {
+        c = '\t';
+      }
+    }
+    if (length + 1 < capacity) {
+      destination[length++] = c;
+    }
+  }
+  if (capacity > 0) {
+    destination[length] = '\0';
+  }
+  return consume(cursor, '"');
+}
+
+static bool parse_number(struct JsonCursor *cursor, double *value) {
+  skip_space(cursor);
+  char *numberEnd;
+  *value = strtod(cursor->p, &numberEnd);
+  if (numberEnd == cursor->p || numberEnd > cursor->end) {
+    return false;
+  }
+  cursor->p = numberEnd;
+  return true;
+}
+
+static bool skip_value(struct JsonCursor *cursor) {
+  skip_space(cursor);
+  if (cursor->p >= cursor->end) {
+    return false;
+  }
+  if (*cursor->p == '"') {
+    char ignored[1];
+    return parse_string(cursor, ignored, sizeof(ignored));
+  }
+  if (*cursor->p == '{' || *cursor->p == '[') {
+    const char close = *cursor->p == '{' ? '}' : ']';
+    ++cursor->p;
+    if (consume(cursor, close)) {
+      return true;
+    }
+    do {
+      if (close == '}') {
+        char ignored[1];
+        if (!parse_string(cursor, ignored, sizeof(ignored)) || !consume(cursor, ':')) {
+          return false;
+        }
+      }
+      if (!skip_value(cursor)) {
+        return false;
+      }
+    } while (consume(cursor, ','));
+    return consume(cursor, close);
+  }
+  if (strncmp(cursor->p, "true", 4) == 0 || strncmp(cursor->p, "null", 4) == 0) {
+    cursor->p += 4;
+    return true;
+  }
+  if (strncmp(cursor->p, "false", 5) == 0) {
+    cursor->p += 5;
+    return true;
+  }
+  double ignored;
+  return parse_number(cursor, &ignored);
+}
+
+static bool parse_result(struct JsonCursor *cursor, struct BenchmarkResult *result) {
+  memset(result, 0, sizeof(*result));
+  if (!consume(cursor, '{')) {
+    return false;
+  }
+  if (consume(cursor, '}')) {
+    return true;
+  }
+  do {
+    char key[32];
+    if (!parse_string(cursor, key, sizeof(key)) || !consume(cursor, ':')) {
+      return false;
+    }
+    if (strcmp(key, "kernel") == 0) {
+      if (!parse_string(cursor, result->kernel, sizeof(result->kernel))) {
+        return false;
+      }
+      continue;
+    }
+
+    struct {
+      const char *key;
+      uint64_t *field;
+    } const integerFields[] = {
+      { "min_ns", &result->stats.min },
+      { "p10_ns", &result->stats.p10 },
+      { "median_ns", &result->stats.median },
+      { "p90_ns", &result->stats.p90 },
+      { "max_ns", &result->stats.max },
+      { "median_low_ns", &result->stats.medianLow },
+      { "median_high_ns", &result->stats.medianHigh },
+    };
+    bool known = false;
+    double value = 0;
+    for (size_t i = 0; i != sizeof(integerFields) / sizeof(integerFields[0]); ++i) {
+      if (strcmp(key, integerFields[i].key) == 0) {
+        if (!parse_number(cursor, &value)) {
+          return false;
+        }
+        *integerFields[i].field = (uint64_t)value;
+        known = true;
+      }
+    }
+    if (known) {
+      continue;
+    }
+    if (strcmp(key, "size") == 0 || strcmp(key, "samples") == 0
+        || strcmp(key, "density") == 0 || strcmp(key, "mean_ns") == 0 || strcmp(key, "stddev_ns") == 0) {
+      if (!parse_number(cursor, &value)) {
+        return false;
+      }
+      if (strcmp(key, "size") == 0) {
+        result->size = (size_t)value;
+      } else if (strcmp(key, "samples") == 0) {
+        result->stats.sampleCount = (size_t)value;
+      } else if (strcmp(key, "density") == 0) {
+        result->density = value;
+      } else if (strcmp(key, "mean_ns") == 0) {
+        result->stats.mean = value;
+      } else {
+        result->stats.stddev = value;
+      }
+    } else if (!skip_value(cursor)) {
+      return false;
+    }
+  } while (consume(cursor, ','));
+  return consume(cursor, '}');
+}
+
+struct BenchmarkResult *load_benchmark_results(const char *path, struct BenchmarkEnvironment *environment,
+                                               size_t *count) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return NULL;
+  }
+  size_t length = 0, capacity = 1 << 16;
+  char *text = malloc(capacity);
+  size_t n;
+  while (text && (n = fread(text + length, 1, capacity - length, file)) > 0) {
+    length += n;
+    if (length == capacity) {
+      capacity *= 2;
+      char *bigger = realloc(text, capacity);
+      if (!bigger) {
+        free(text);
+      }
+      text = bigger;
+    }
+  }
+  fclose(file);
+  if (!text) {
+    return NULL;
+  }
+  // The loop above always leaves room for a terminator, which strtod needs.
+  text[length] = '\0';
+
+  memset(environment, 0, sizeof(*environment));
+  struct BenchmarkResult *results = NULL;
+  size_t resultCount = 0, resultCapacity = 0;
+  struct JsonCursor cursor = { text, text + length };
+  bool ok = consume(&cursor, '{');
+  if (ok && !consume(&cursor, '}')) {
+    do {
+      char key[32];
+      ok = parse_string(&cursor, key, sizeof(key)) && consume(&cursor, ':');
+      if (!ok) {
+        break;
+      }
+      if (strcmp(key, "cpu") == 0) {
+        ok = parse_string(&cursor, environment->cpu, sizeof(environment->cpu));
+      } else if (strcmp(key, "compiler") == 0) {
+        ok = parse_string(&cursor, environment->compiler, sizeof(environment->compiler));
+      } else if (strcmp(key, "flags") == 0) {
+        ok = parse_string(&cursor, environment->flags, sizeof(environment->flags));
+      } else if (strcmp(key, "results") == 0) {
+        ok = consume(&cursor, '[');
+        if (ok && !consume(&cursor, ']')) {
+          do {
+            if (resultCount == resultCapacity) {
+              resultCapacity = resultCapacity ? 2 * resultCapacity : 64;
+              struct BenchmarkResult *bigger = realloc(results, resultCapacity * sizeof(*results));
+              if (!bigger) {
+                ok = false;
+                break;
+              }
+              results = bigger;
+            }
+            ok = parse_result(&cursor, &results[resultCount]);
+            if (ok) {
+              ++resultCount;
+            }
+          } while (ok && consume(&cursor, ','));
+          ok = ok && consume(&cursor, ']');
+        }
+      } else {
+        ok = skip_value(&cursor);
+      }
+    } while (ok && consume(&cursor, ','));
+    ok = ok && consume(&cursor, '}');
+  }
+  free(text);
+
+  if (!ok) {
+    free(results);
+    return NULL;
+  }
+  if (!results) {
+    results = malloc(sizeof(*results));
+  }
+  *count = resultCount;
+  return results;
+}
+
+static const struct BenchmarkResult *find_result(const struct BenchmarkResult *results, size_t count,
+                                                 const struct BenchmarkResult *key) {
+  for (size_t i = 0; i != count; ++i) {
+    if (results[i].size == key->size && fabs(results[i].density - key->density) < 1e-9
+        && strcmp(results[i].kernel, key->kernel) == 0) {
+      return &results[i];
+    }
+  }
+  return NULL;
+}
+
+size_t compare_benchmark_results(FILE *stream,
+                                 const struct BenchmarkResult *baseline, size_t baselineCount,
+                                 const struct BenchmarkResult *current, size_t currentCount,
+                                 double threshold) {
+  size_t regressions = 0;
+  fprintf(stream, "\n%-38s %9s %8s %11s %11s %8s\n", "kernel", "size", "density", "baseline", "current", "change");
+  for (size_t i = 0; i != currentCount; ++i) {
+    const struct BenchmarkResult *now = &current[i];
+    const struct BenchmarkResult *then = find_result(baseline, baselineCount, now);
+    if (!then || then->stats.median == 0 || now->stats.median == 0) {
+      continue;
+    }
+    // Throughput in bytes per ns, i.e. GB/s.
+    const double baselineThroughput = (double)then->size / (double)then->stats.median;
+    const double currentThroughput = (double)now->size / (double)now->stats.median;
+    const double change = currentThroughput / baselineThroughput - 1;
+    const bool significant = now->stats.medianLow > then->stats.medianHigh;
+    const bool regressed = change < -threshold && significant;
+    if (regressed) {
+      ++regressions;
+    }
+    char density[16];
+    if (now->density < 0) {
+      snprintf(density, sizeof(density), "mixed");
+    } else {
+      snprintf(density, sizeof(density), "%.1f%%", 100 * now->density);
+    }
+    fprintf(stream, "%-38s %9zu %8s %6.2f GB/s %6.2f GB/s %+7.1f%%%s\n",
+            now->kernel, now->size, density, baselineThroughput, currentThroughput, 100 * change,
+            regressed ? "  REGRESSION" : (change < -threshold ? "  (not significant)" : ""));
+  }
+  return regressions;
+}
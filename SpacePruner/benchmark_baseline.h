@@ -0,0 +1,52 @@
+//
+//  benchmark_baseline.h
+//  SpacePruner
+//
+
+#ifndef benchmark_baseline_h
+#define benchmark_baseline_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "benchmark_timing.h"
+
+// One kernel timed on one input size and whitespace density. The statistics
+// are in nanoseconds per call.
+struct BenchmarkResult {
+  char kernel[64];
+  size_t size;
+  double density;
+  struct BenchmarkStats stats;
+};
+
+// What the results depend on besides the code.
+struct BenchmarkEnvironment {
+  char cpu[128];
+  char compiler[128];
+  char flags[256];
+};
+
+void describe_benchmark_environment(struct BenchmarkEnvironment *environment);
+
+bool save_benchmark_results(const char *path, const struct BenchmarkEnvironment *environment,
+                            const struct BenchmarkResult *results, size_t count);
+
+// Returns a malloc'ed array, or NULL if the file can't be read or parsed.
+struct BenchmarkResult *load_benchmark_results(const char *path, struct BenchmarkEnvironment *environment,
+                                               size_t *count);
+
+/*
+ Prints the throughput change of every result that is also in the baseline.
+ A result is a regression if its median throughput dropped by more than
+ `threshold` (a fraction) and its median's confidence interval lies entirely
+ above the baseline's, i.e. the slowdown is statistically significant.
+ Returns the number of regressions.
+ */
+size_t compare_benchmark_results(FILE *stream,
+                                 const struct BenchmarkResult *baseline, size_t baselineCount,
+                                 const struct BenchmarkResult *current, size_t currentCount,
+                                 double threshold);
+
+#endif /* benchmark_baseline_h */
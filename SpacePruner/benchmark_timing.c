@@ -0,0 +1,151 @@
+//
+//  benchmark_timing.c
+//  SpacePruner
+//
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include "benchmark_timing.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint64_t time_in_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+int pin_current_thread_to_cpu(int cpu) {
+#if defined(__linux__)
+  if (cpu < 0) {
+    cpu = sched_getcpu();
+    if (cpu < 0) {
+      return -1;
+    }
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    return -1;
+  }
+  return cpu;
+#else
+  // Darwin only offers affinity tags, which are hints, and not on iOS.
+  (void)cpu;
+  return -1;
+#endif
+}
+
+uint64_t calibration_time_in_ns(void) {
+  uint64_t best = (uint64_t)-1;
+  for (int run = 0; run != 3; ++run) {
+    const uint64_t start = time_in_ns();
+    uint64_t x = 1;
+    for (int i = 0; i != 1 << 18; ++i) {
+      x = x * 6364136223846793005u + 1442695040888963407u;
+      __asm volatile("" : "+r"(x));
+    }
+    const uint64_t elapsed = time_in_ns() - start;
+    if (elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+uint64_t wait_for_stable_frequency(uint64_t maxWaitNs) {
+  const uint64_t deadline = time_in_ns() + maxWaitNs;
+  uint64_t previous = calibration_time_in_ns();
+  while (time_in_ns() < deadline) {
+    const uint64_t current = calibration_time_in_ns();
+    const uint64_t difference = current > previous ? current - previous : previous - current;
+    previous = current;
+    if (difference * 100 <= current) {
+      break;
+    }
+  }
+  return previous;
+}
+
+const char *frequency_governor(void) {
+#if defined(__linux__)
+  static char governor[64];
+  FILE *file = fopen("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor", "r");
+  if (!file) {
+    return NULL;
+  }
+  const char *result = fgets(governor, sizeof(governor), file);
+  fclose(file);
+  if (!result) {
+    return NULL;
+  }
+  governor[strcspn(governor, "\n")] = '\0';
+  return governor;
+#else
+  return NULL;
+#endif
+}
+
+static int compare_uint64(const void *a, const void *b) {
+  const uint64_t x = *(const uint64_t *)a;
+  const uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t count, double p) {
+  return sorted[(size_t)(p * (double)(count - 1) + 0.5)];
+}
+
+void compute_benchmark_stats(uint64_t *samples, size_t count, struct BenchmarkStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->sampleCount = count;
+  if (count == 0) {
+    return;
+  }
+  qsort(samples, count, sizeof(samples[0]), &compare_uint64);
+
+  double sum = 0;
+  for (size_t i = 0; i != count; ++i) {
+    sum += (double)samples[i];
+  }
+  const double mean = sum / (double)count;
+  double squares = 0;
+  for (size_t i = 0; i != count; ++i) {
+    const double d = (double)samples[i] - mean;
+    squares += d * d;
+  }
+
+  stats->min = samples[0];
+  stats->p10 = percentile(samples, count, 0.10);
+  stats->median = percentile(samples, count, 0.50);
+  stats->p90 = percentile(samples, count, 0.90);
+  stats->max = samples[count - 1];
+  stats->mean = mean;
+  stats->stddev = count > 1 ? sqrt(squares / (double)(count - 1)) : 0;
+
+  /*
+   The number of samples below the true median is Binomial(n, 1/2), so the
+   order statistics at ranks n/2 ∓ 1.96·√n/2 bracket it with 95% confidence,
+   whatever the shape of the distribution.
+   */
+  const double halfWidth = 0.98 * sqrt((double)count);
+  const double low = floor((double)count / 2 - halfWidth);
+  const double high = ceil((double)count / 2 + halfWidth);
+  stats->medianLow = samples[low < 0 ? 0 : (size_t)low];
+  stats->medianHigh = samples[high > (double)(count - 1) ? count - 1 : (size_t)high];
+}
+
+double benchmark_stats_spread(const struct BenchmarkStats *stats) {
+  if (stats->median == 0) {
+    return 0;
+  }
+  return (double)(stats->p90 - stats->p10) / (double)stats->median;
+}
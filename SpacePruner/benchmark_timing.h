@@ -0,0 +1,52 @@
+//
+//  benchmark_timing.h
+//  SpacePruner
+//
+
+#ifndef benchmark_timing_h
+#define benchmark_timing_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct BenchmarkStats {
+  size_t sampleCount;
+  uint64_t min;
+  uint64_t p10;
+  uint64_t median;
+  uint64_t p90;
+  uint64_t max;
+  double mean;
+  double stddev;
+  // Distribution-free 95% confidence interval for the median.
+  uint64_t medianLow;
+  uint64_t medianHigh;
+};
+
+uint64_t time_in_ns(void);
+
+// Pins the calling thread to the given CPU, or to the one it is currently
+// running on if cpu is negative. Returns the CPU pinned to, or -1 if the
+// platform doesn't support affinity (e.g. iOS).
+int pin_current_thread_to_cpu(int cpu);
+
+// Time for a fixed, latency-bound integer workload. Comparing it before and
+// after a measurement reveals clock frequency changes in between.
+uint64_t calibration_time_in_ns(void);
+
+// Repeats the calibration workload until two consecutive runs agree to
+// within 1%, so that the CPU has left any idle frequency state before the
+// first sample. Returns the last calibration time.
+uint64_t wait_for_stable_frequency(uint64_t maxWaitNs);
+
+// Describes the frequency governor, if the platform exposes it, or returns NULL.
+const char *frequency_governor(void);
+
+// Sorts the samples in place.
+void compute_benchmark_stats(uint64_t *samples, size_t count, struct BenchmarkStats *stats);
+
+// (p90 - p10) / median
+double benchmark_stats_spread(const struct BenchmarkStats *stats);
+
+#endif /* benchmark_timing_h */
@@ -0,0 +1,35 @@
+//
+//  best_despacer.c
+//  SpacePruner
+//
+
+#include "best_despacer.h"
+
+#include "despacer.h"
+#include "interleaved_despacer.h"
+#include "staged_despacer.h"
+
+// neon_adaptive_despace stays out until it has been timed against
+// neontbl_despace on arm64 hardware, e.g. with despacebenchmark
+// --densities 0,0.25,0.5,1,1.5,2,3,5,20,mixed, which reports where
+// neon_despace and neontbl_despace cross over to set its thresholds from.
+#if defined(__aarch64__)
+#define BEST_DESPACE neontbl_despace
+#elif __ARM_NEON
+#define BEST_DESPACE neon_interleaved_despace
+#elif defined(__SSSE3__)
+#define BEST_DESPACE staged_despace
+#else
+#define BEST_DESPACE despace
+#endif
+
+#define STRINGIFY(name) #name
+#define NAME_OF(name) STRINGIFY(name)
+
+size_t despace_best(char *bytes, size_t howmany) {
+  return BEST_DESPACE(bytes, howmany);
+}
+
+const char *despace_best_name(void) {
+  return NAME_OF(BEST_DESPACE);
+}
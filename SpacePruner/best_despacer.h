@@ -0,0 +1,17 @@
+//
+//  best_despacer.h
+//  SpacePruner
+//
+
+#ifndef best_despacer_h
+#define best_despacer_h
+
+#include <stddef.h>
+
+// The fastest in-place kernel this build has, for tools that just want the
+// job done.
+size_t despace_best(char *bytes, size_t howmany);
+
+const char *despace_best_name(void);
+
+#endif /* best_despacer_h */
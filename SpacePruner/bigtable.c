@@ -0,0 +1,7 @@
+//
+//  bigtable.c
+//  SpacePruner
+//
+
+#define BIGTABLE_DEFINE_SHUFMASK
+#include "bigtable.h"
@@ -1,6 +1,9 @@
 #ifndef BIGTABLE_H
 #define BIGTABLE_H
-uint8_t shufmask[ 16 * 65536] = {
+#include <stdint.h>
+// Defined once, in bigtable.c, so that every file may include despacer.h.
+#ifdef BIGTABLE_DEFINE_SHUFMASK
+const uint8_t __attribute__((aligned(64))) shufmask[ 16 * 65536] = {
 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
 2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,
@@ -65537,4 +65540,7 @@ uint8_t shufmask[ 16 * 65536] = {
 0,1,3,4,5,6,7,8,9,10,11,12,13,14,15,15,
 1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,15,
 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15};
+#else
+extern const uint8_t shufmask[ 16 * 65536];
+#endif
 #endif
@@ -0,0 +1,231 @@
+//
+//  byte_expander.c
+//  SpacePruner
+//
+
+#include "byte_expander.h"
+
+#include <string.h>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+#if defined(__AVX2__) || (defined(__AVX512VBMI2__) && defined(__AVX512BW__))
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(__SSSE3__)
+/*
+ The expanding counterpart of mask_shuffle: row m gives, for each position j
+ whose bit is set in m, the index of the source byte that goes there, which
+ is the number of bits of m below j. Unset positions get 128, which is out of
+ range for tbl and makes pshufb write zero. Generated with
+
+   expand_shuffle[8 * m + j] = (m >> j & 1) ? popcount(m & ((1 << j) - 1)) : 128
+
+ Only 8 bits are looked up at a time, so the table is 2 KiB rather than
+ the megabyte a 16-bit table like shufmask would take; the upper half of a
+ vector adds the count of the lower half to its indices.
+ */
+static const uint8_t __attribute__((aligned(16))) expand_shuffle[256 * 8] = {
+  128,128,128,128,128,128,128,128, 0,128,128,128,128,128,128,128, 128,0,128,128,128,128,128,128, 0,1,128,128,128,128,128,128,
+  128,128,0,128,128,128,128,128, 0,128,1,128,128,128,128,128, 128,0,1,128,128,128,128,128, 0,1,2,128,128,128,128,128,
+  128,128,128,0,128,128,128,128, 0,128,128,1,128,128,128,128, 128,0,128,1,128,128,128,128, 0,1,128,2,128,128,128,128,
+  128,128,0,1,128,128,128,128, 0,128,1,2,128,128,128,128, 128,0,1,2,128,128,128,128, 0,1,2,3,128,128,128,128,
+  128,128,128,128,0,128,128,128, 0,128,128,128,1,128,128,128, 128,0,128,128,1,128,128,128, 0,1,128,128,2,128,128,128,
+  128,128,0,128,1,128,128,128, 0,128,1,128,2,128,128,128, 128,0,1,128,2,128,128,128, 0,1,2,128,3,128,128,128,
+  128,128,128,0,1,128,128,128, 0,128,128,1,2,128,128,128, 128,0,128,1,2,128,128,128, 0,1,128,2,3,128,128,128,
+  128,128,0,1,2,128,128,128, 0,128,1,2,3,128,128,128, 128,0,1,2,3,128,128,128, 0,1,2,3,4,128,128,128,
+  128,128,128,128,128,0,128,128, 0,128,128,128,128,1,128,128, 128,0,128,128,128,1,128,128, 0,1,128,128,128,2,128,128,
+  128,128,0,128,128,1,128,128, 0,128,1,128,128,2,128,128, 128,0,1,128,128,2,128,128, 0,1,2,128,128,3,128,128,
+  128,128,128,0,128,1,128,128, 0,128,128,1,128,2,128,128, 128,0,128,1,128,2,128,128, 0,1,128,2,128,3,128,128,
+  128,128,0,1,128,2,128,128, 0,128,1,2,128,3,128,128, 128,0,1,2,128,3,128,128, 0,1,2,3,128,4,128,128,
+  128,128,128,128,0,1,128,128, 0,128,128,128,1,2,128,128, 128,0,128,128,1,2,128,128, 0,1,128,128,2,3,128,128,
+  128,128,0,128,1,2,128,128, 0,128,1,128,2,3,128,128, 128,0,1,128,2,3,128,128, 0,1,2,128,3,4,128,128,
+  128,128,128,0,1,2,128,128, 0,128,128,1,2,3,128,128, 128,0,128,1,2,3,128,128, 0,1,128,2,3,4,128,128,
+  128,128,0,1,2,3,128,128, 0,128,1,2,3,4,128,128, 128,0,1,2,3,4,128,128, 0,1,2,3,4,5,128,128,
+  128,128,128,128,128,128,0,128, 0,128,128,128,128,128,1,128, 128,0,128,128,128,128,1,128, 0,1,128,128,128,128,2,128,
+  128,128,0,128,128,128,1,128, 0,128,1,128,128,128,2,128, 128,0,1,128,128,128,2,128, 0,1,2,128,128,128,3,128,
+  128,128,128,0,128,128,1,128, 0,128,128,1,128,128,2,128, 128,0,128,1,128,128,2,128, 0,1,128,2,128,128,3,128,
+  128,128,0,1,128,128,2,128, 0,128,1,2,128,128,3,128, 128,0,1,2,128,128,3,128, 0,1,2,3,128,128,4,128,
+  128,128,128,128,0,128,1,128, 0,128,128,128,1,128,2,128, 128,0,128,128,1,128,2,128, 0,1,128,128,2,128,3,128,
+  128,128,0,128,1,128,2,128, 0,128,1,128,2,128,3,128, 128,0,1,128,2,128,3,128, 0,1,2,128,3,128,4,128,
+  128,128,128,0,1,128,2,128, 0,128,128,1,2,128,3,128, 128,0,128,1,2,128,3,128, 0,1,128,2,3,128,4,128,
+  128,128,0,1,2,128,3,128, 0,128,1,2,3,128,4,128, 128,0,1,2,3,128,4,128, 0,1,2,3,4,128,5,128,
+  128,128,128,128,128,0,1,128, 0,128,128,128,128,1,2,128, 128,0,128,128,128,1,2,128, 0,1,128,128,128,2,3,128,
+  128,128,0,128,128,1,2,128, 0,128,1,128,128,2,3,128, 128,0,1,128,128,2,3,128, 0,1,2,128,128,3,4,128,
+  128,128,128,0,128,1,2,128, 0,128,128,1,128,2,3,128, 128,0,128,1,128,2,3,128, 0,1,128,2,128,3,4,128,
+  128,128,0,1,128,2,3,128, 0,128,1,2,128,3,4,128, 128,0,1,2,128,3,4,128, 0,1,2,3,128,4,5,128,
+  128,128,128,128,0,1,2,128, 0,128,128,128,1,2,3,128, 128,0,128,128,1,2,3,128, 0,1,128,128,2,3,4,128,
+  128,128,0,128,1,2,3,128, 0,128,1,128,2,3,4,128, 128,0,1,128,2,3,4,128, 0,1,2,128,3,4,5,128,
+  128,128,128,0,1,2,3,128, 0,128,128,1,2,3,4,128, 128,0,128,1,2,3,4,128, 0,1,128,2,3,4,5,128,
+  128,128,0,1,2,3,4,128, 0,128,1,2,3,4,5,128, 128,0,1,2,3,4,5,128, 0,1,2,3,4,5,6,128,
+  128,128,128,128,128,128,128,0, 0,128,128,128,128,128,128,1, 128,0,128,128,128,128,128,1, 0,1,128,128,128,128,128,2,
+  128,128,0,128,128,128,128,1, 0,128,1,128,128,128,128,2, 128,0,1,128,128,128,128,2, 0,1,2,128,128,128,128,3,
+  128,128,128,0,128,128,128,1, 0,128,128,1,128,128,128,2, 128,0,128,1,128,128,128,2, 0,1,128,2,128,128,128,3,
+  128,128,0,1,128,128,128,2, 0,128,1,2,128,128,128,3, 128,0,1,2,128,128,128,3, 0,1,2,3,128,128,128,4,
+  128,128,128,128,0,128,128,1, 0,128,128,128,1,128,128,2, 128,0,128,128,1,128,128,2, 0,1,128,128,2,128,128,3,
+  128,128,0,128,1,128,128,2, 0,128,1,128,2,128,128,3, 128,0,1,128,2,128,128,3, 0,1,2,128,3,128,128,4,
+  128,128,128,0,1,128,128,2, 0,128,128,1,2,128,128,3, 128,0,128,1,2,128,128,3, 0,1,128,2,3,128,128,4,
+  128,128,0,1,2,128,128,3, 0,128,1,2,3,128,128,4, 128,0,1,2,3,128,128,4, 0,1,2,3,4,128,128,5,
+  128,128,128,128,128,0,128,1, 0,128,128,128,128,1,128,2, 128,0,128,128,128,1,128,2, 0,1,128,128,128,2,128,3,
+  128,128,0,128,128,1,128,2, 0,128,1,128,128,2,128,3, 128,0,1,128,128,2,128,3, 0,1,2,128,128,3,128,4,
+  128,128,128,0,128,1,128,2, 0,128,128,1,128,2,128,3, 128,0,128,1,128,2,128,3, 0,1,128,2,128,3,128,4,
+  128,128,0,1,128,2,128,3, 0,128,1,2,128,3,128,4, 128,0,1,2,128,3,128,4, 0,1,2,3,128,4,128,5,
+  128,128,128,128,0,1,128,2, 0,128,128,128,1,2,128,3, 128,0,128,128,1,2,128,3, 0,1,128,128,2,3,128,4,
+  128,128,0,128,1,2,128,3, 0,128,1,128,2,3,128,4, 128,0,1,128,2,3,128,4, 0,1,2,128,3,4,128,5,
+  128,128,128,0,1,2,128,3, 0,128,128,1,2,3,128,4, 128,0,128,1,2,3,128,4, 0,1,128,2,3,4,128,5,
+  128,128,0,1,2,3,128,4, 0,128,1,2,3,4,128,5, 128,0,1,2,3,4,128,5, 0,1,2,3,4,5,128,6,
+  128,128,128,128,128,128,0,1, 0,128,128,128,128,128,1,2, 128,0,128,128,128,128,1,2, 0,1,128,128,128,128,2,3,
+  128,128,0,128,128,128,1,2, 0,128,1,128,128,128,2,3, 128,0,1,128,128,128,2,3, 0,1,2,128,128,128,3,4,
+  128,128,128,0,128,128,1,2, 0,128,128,1,128,128,2,3, 128,0,128,1,128,128,2,3, 0,1,128,2,128,128,3,4,
+  128,128,0,1,128,128,2,3, 0,128,1,2,128,128,3,4, 128,0,1,2,128,128,3,4, 0,1,2,3,128,128,4,5,
+  128,128,128,128,0,128,1,2, 0,128,128,128,1,128,2,3, 128,0,128,128,1,128,2,3, 0,1,128,128,2,128,3,4,
+  128,128,0,128,1,128,2,3, 0,128,1,128,2,128,3,4, 128,0,1,128,2,128,3,4, 0,1,2,128,3,128,4,5,
+  128,128,128,0,1,128,2,3, 0,128,128,1,2,128,3,4, 128,0,128,1,2,128,3,4, 0,1,128,2,3,128,4,5,
+  128,128,0,1,2,128,3,4, 0,128,1,2,3,128,4,5, 128,0,1,2,3,128,4,5, 0,1,2,3,4,128,5,6,
+  128,128,128,128,128,0,1,2, 0,128,128,128,128,1,2,3, 128,0,128,128,128,1,2,3, 0,1,128,128,128,2,3,4,
+  128,128,0,128,128,1,2,3, 0,128,1,128,128,2,3,4, 128,0,1,128,128,2,3,4, 0,1,2,128,128,3,4,5,
+  128,128,128,0,128,1,2,3, 0,128,128,1,128,2,3,4, 128,0,128,1,128,2,3,4, 0,1,128,2,128,3,4,5,
+  128,128,0,1,128,2,3,4, 0,128,1,2,128,3,4,5, 128,0,1,2,128,3,4,5, 0,1,2,3,128,4,5,6,
+  128,128,128,128,0,1,2,3, 0,128,128,128,1,2,3,4, 128,0,128,128,1,2,3,4, 0,1,128,128,2,3,4,5,
+  128,128,0,128,1,2,3,4, 0,128,1,128,2,3,4,5, 128,0,1,128,2,3,4,5, 0,1,2,128,3,4,5,6,
+  128,128,128,0,1,2,3,4, 0,128,128,1,2,3,4,5, 128,0,128,1,2,3,4,5, 0,1,128,2,3,4,5,6,
+  128,128,0,1,2,3,4,5, 0,128,1,2,3,4,5,6, 128,0,1,2,3,4,5,6, 0,1,2,3,4,5,6,7
+};
+#endif
+
+static size_t expand_tail(char *dest, size_t i, size_t howmany, const uint64_t *mask, const char *source,
+                          size_t from, size_t sourceLength, char fill) {
+  for (; i < howmany; ++i) {
+    if (((mask[i / 64] >> (i % 64)) & 1) != 0 && from < sourceLength) {
+      dest[i] = source[from++];
+    } else {
+      dest[i] = fill;
+    }
+  }
+  return from;
+}
+
+size_t expand_bytes_scalar(char *dest, size_t howmany, const uint64_t *mask, const char *source,
+                           size_t sourceLength, char fill) {
+  return expand_tail(dest, 0, howmany, mask, source, 0, sourceLength, fill);
+}
+
+// The 16 mask bits from position i, which is a multiple of 16.
+static inline unsigned mask_bits16(const uint64_t *mask, size_t i) {
+  return (unsigned)(mask[i / 64] >> (i % 64)) & 0xFFFF;
+}
+
+#if defined(__SSSE3__) || defined(__AVX2__)
+// A row of the table with offset added to every index; gaps stay negative.
+static inline long long expand_indices8(unsigned bits, unsigned offset) {
+  uint64_t row;
+  memcpy(&row, expand_shuffle + 8 * bits, sizeof(row));
+  return (long long)(row + offset * UINT64_C(0x0101010101010101));
+}
+#endif
+
+#if defined(__aarch64__)
+size_t neon_expand_bytes(char *dest, size_t howmany, const uint64_t *mask, const char *source,
+                         size_t sourceLength, char fill) {
+  const uint8x16_t fillVector = vdupq_n_u8((uint8_t)fill);
+  size_t i = 0, from = 0;
+  for (; i + 16 <= howmany && from + 16 <= sourceLength; i += 16) {
+    const unsigned bits = mask_bits16(mask, i);
+    const unsigned low = bits & 0xFF, high = bits >> 8;
+    const uint8x16_t indices = vcombine_u8(
+        vld1_u8(expand_shuffle + 8 * low),
+        vadd_u8(vld1_u8(expand_shuffle + 8 * high), vdup_n_u8((uint8_t)__builtin_popcount(low))));
+    vst1q_u8((uint8_t *)dest + i, vqtbx1q_u8(fillVector, vld1q_u8((const uint8_t *)source + from), indices));
+    from += (size_t)__builtin_popcount(bits);
+  }
+  return expand_tail(dest, i, howmany, mask, source, from, sourceLength, fill);
+}
+#endif
+
+#if defined(__SSSE3__)
+size_t ssse3_expand_bytes(char *dest, size_t howmany, const uint64_t *mask, const char *source,
+                          size_t sourceLength, char fill) {
+  const __m128i fillVector = _mm_set1_epi8(fill);
+  size_t i = 0, from = 0;
+  for (; i + 16 <= howmany && from + 16 <= sourceLength; i += 16) {
+    const unsigned bits = mask_bits16(mask, i);
+    const unsigned low = bits & 0xFF, high = bits >> 8;
+    const __m128i indices = _mm_set_epi64x(expand_indices8(high, (unsigned)__builtin_popcount(low)),
+                                           expand_indices8(low, 0));
+    const __m128i expanded = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(source + from)), indices);
+    const __m128i gaps = _mm_cmplt_epi8(indices, _mm_setzero_si128());
+    _mm_storeu_si128((__m128i *)(dest + i), _mm_or_si128(expanded, _mm_and_si128(gaps, fillVector)));
+    from += (size_t)__builtin_popcount(bits);
+  }
+  return expand_tail(dest, i, howmany, mask, source, from, sourceLength, fill);
+}
+#endif
+
+#if defined(__AVX2__)
+size_t avx2_expand_bytes(char *dest, size_t howmany, const uint64_t *mask, const char *source,
+                         size_t sourceLength, char fill) {
+  const __m256i fillVector = _mm256_set1_epi8(fill);
+  size_t i = 0, from = 0;
+  for (; i + 32 <= howmany; i += 32) {
+    const unsigned bits = (unsigned)(mask[i / 64] >> (i % 64));
+    const unsigned byte0 = bits & 0xFF, byte1 = (bits >> 8) & 0xFF, byte2 = (bits >> 16) & 0xFF, byte3 = bits >> 24;
+    // pshufb can't cross lanes, so the upper lane reads from where the
+    // lower one's bytes end.
+    const size_t lowerCount = (size_t)__builtin_popcount(bits & 0xFFFF);
+    if (from + lowerCount + 16 > sourceLength) {
+      break;
+    }
+    const __m256i indices = _mm256_set_epi64x(expand_indices8(byte3, (unsigned)__builtin_popcount(byte2)),
+                                              expand_indices8(byte2, 0),
+                                              expand_indices8(byte1, (unsigned)__builtin_popcount(byte0)),
+                                              expand_indices8(byte0, 0));
+    const __m256i input = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(source + from))),
+        _mm_loadu_si128((const __m128i *)(source + from + lowerCount)), 1);
+    const __m256i expanded = _mm256_shuffle_epi8(input, indices);
+    const __m256i gaps = _mm256_cmpgt_epi8(_mm256_setzero_si256(), indices);
+    _mm256_storeu_si256((__m256i *)(dest + i), _mm256_or_si256(expanded, _mm256_and_si256(gaps, fillVector)));
+    from += (size_t)__builtin_popcount(bits);
+  }
+  return expand_tail(dest, i, howmany, mask, source, from, sourceLength, fill);
+}
+#endif
+
+#if defined(__AVX512VBMI2__) && defined(__AVX512BW__)
+size_t avx512_expand_bytes(char *dest, size_t howmany, const uint64_t *mask, const char *source,
+                           size_t sourceLength, char fill) {
+  const __m512i fillVector = _mm512_set1_epi8(fill);
+  size_t i = 0, from = 0;
+  for (; i + 64 <= howmany; i += 64) {
+    const uint64_t bits = mask[i / 64];
+    const size_t count = (size_t)__builtin_popcountll(bits);
+    if (from + count > sourceLength) {
+      break;
+    }
+    // Only the selected bytes are read, so this never reads past source.
+    _mm512_storeu_si512(dest + i, _mm512_mask_expandloadu_epi8(fillVector, bits, source + from));
+    from += count;
+  }
+  return expand_tail(dest, i, howmany, mask, source, from, sourceLength, fill);
+}
+#endif
+
+size_t expand_bytes(char *dest, size_t howmany, const uint64_t *mask, const char *source,
+                    size_t sourceLength, char fill) {
+#if defined(__AVX512VBMI2__) && defined(__AVX512BW__)
+  return avx512_expand_bytes(dest, howmany, mask, source, sourceLength, fill);
+#elif defined(__AVX2__)
+  return avx2_expand_bytes(dest, howmany, mask, source, sourceLength, fill);
+#elif defined(__SSSE3__)
+  return ssse3_expand_bytes(dest, howmany, mask, source, sourceLength, fill);
+#elif defined(__aarch64__)
+  return neon_expand_bytes(dest, howmany, mask, source, sourceLength, fill);
+#else
+  return expand_bytes_scalar(dest, howmany, mask, source, sourceLength, fill);
+#endif
+}
@@ -0,0 +1,53 @@
+//
+//  byte_expander.h
+//  SpacePruner
+//
+
+// The inverse of the compaction in the despacing kernels: scatters a dense
+// stream of bytes into the positions a bitmask selects and fills the rest.
+
+#ifndef byte_expander_h
+#define byte_expander_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ Writes howmany bytes to dest. Where bit i of the mask (bit i % 64 of
+ mask[i / 64]) is set, dest[i] is the next byte of source; elsewhere it's
+ fill. Returns how many source bytes were used. If the mask selects more
+ than sourceLength bytes, the positions past the end of source get fill too.
+
+ The vector kernels never read past source + sourceLength.
+ */
+size_t expand_bytes_scalar(char *dest, size_t howmany, const uint64_t *mask, const char *source,
+                           size_t sourceLength, char fill);
+
+#if defined(__aarch64__)
+// 16 bytes at a time with vqtbx1q_u8, whose out-of-range indices keep fill.
+size_t neon_expand_bytes(char *dest, size_t howmany, const uint64_t *mask, const char *source,
+                         size_t sourceLength, char fill);
+#endif
+
+#if defined(__SSSE3__)
+size_t ssse3_expand_bytes(char *dest, size_t howmany, const uint64_t *mask, const char *source,
+                          size_t sourceLength, char fill);
+#endif
+
+#if defined(__AVX2__)
+// 32 bytes at a time; each 128-bit lane loads its own window of source.
+size_t avx2_expand_bytes(char *dest, size_t howmany, const uint64_t *mask, const char *source,
+                         size_t sourceLength, char fill);
+#endif
+
+#if defined(__AVX512VBMI2__) && defined(__AVX512BW__)
+// 64 bytes at a time with vpexpandb, which needs no table.
+size_t avx512_expand_bytes(char *dest, size_t howmany, const uint64_t *mask, const char *source,
+                           size_t sourceLength, char fill);
+#endif
+
+// The fastest of the above that this build has.
+size_t expand_bytes(char *dest, size_t howmany, const uint64_t *mask, const char *source,
+                    size_t sourceLength, char fill);
+
+#endif /* byte_expander_h */
@@ -0,0 +1,88 @@
+//
+//  cache_pollution.c
+//  SpacePruner
+//
+
+#include "cache_pollution.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark_timing.h"
+
+static const size_t cacheLineSize = 64;
+
+void evict_caches(uint8_t *evictionBuffer, size_t bytes) {
+  for (size_t i = 0; i < bytes; i += cacheLineSize) {
+    evictionBuffer[i]++;
+  }
+  __asm volatile("" ::: /* pretend to clobber */ "memory");
+}
+
+struct CacheThrasher {
+  pthread_t thread;
+  uint8_t *buffer;
+  size_t bytes;
+  int cpu;
+  atomic_bool stop;
+  uint64_t passes;
+};
+
+static void *thrash(void *context) {
+  struct CacheThrasher *thrasher = context;
+  if (thrasher->cpu >= 0) {
+    pin_current_thread_to_cpu(thrasher->cpu);
+  }
+  uint64_t passes = 0;
+  while (!atomic_load_explicit(&thrasher->stop, memory_order_relaxed)) {
+    // Check for the stop request every 256 KiB so that large buffers don't
+    // delay it.
+    for (size_t i = 0; i < thrasher->bytes; i += cacheLineSize) {
+      thrasher->buffer[i] += 1;
+      if ((i & ((1 << 18) - 1)) == 0 && atomic_load_explicit(&thrasher->stop, memory_order_relaxed)) {
+        break;
+      }
+    }
+    __asm volatile("" ::: /* pretend to clobber */ "memory");
+    ++passes;
+  }
+  thrasher->passes = passes;
+  return NULL;
+}
+
+struct CacheThrasher *cache_thrasher_start(size_t bytes, int cpu) {
+  struct CacheThrasher *thrasher = calloc(1, sizeof(*thrasher));
+  if (!thrasher) {
+    return NULL;
+  }
+  thrasher->buffer = malloc(bytes);
+  if (!thrasher->buffer) {
+    free(thrasher);
+    return NULL;
+  }
+  memset(thrasher->buffer, 0, bytes);
+  thrasher->bytes = bytes;
+  thrasher->cpu = cpu;
+  atomic_init(&thrasher->stop, false);
+  if (pthread_create(&thrasher->thread, NULL, &thrash, thrasher) != 0) {
+    free(thrasher->buffer);
+    free(thrasher);
+    return NULL;
+  }
+  return thrasher;
+}
+
+uint64_t cache_thrasher_stop(struct CacheThrasher *thrasher) {
+  if (!thrasher) {
+    return 0;
+  }
+  atomic_store(&thrasher->stop, true);
+  pthread_join(thrasher->thread, NULL);
+  const uint64_t passes = thrasher->passes;
+  free(thrasher->buffer);
+  free(thrasher);
+  return passes;
+}
@@ -0,0 +1,26 @@
+//
+//  cache_pollution.h
+//  SpacePruner
+//
+
+#ifndef cache_pollution_h
+#define cache_pollution_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Writes one byte in every cache line of the buffer, which should be larger
+// than the last-level cache, pushing everything else out of the caches.
+void evict_caches(uint8_t *evictionBuffer, size_t bytes);
+
+struct CacheThrasher;
+
+// Starts a thread that keeps reading and writing every cache line of a
+// `bytes`-sized buffer, competing with the benchmark for cache capacity and
+// memory bandwidth. Pins it to `cpu` unless that is negative.
+struct CacheThrasher *cache_thrasher_start(size_t bytes, int cpu);
+
+// Stops and frees the thread. Returns how many passes it made over its buffer.
+uint64_t cache_thrasher_stop(struct CacheThrasher *thrasher);
+
+#endif /* cache_pollution_h */
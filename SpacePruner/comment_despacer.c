@@ -0,0 +1,361 @@
+//
+//  comment_despacer.c
+//  SpacePruner
+//
+
+#include "comment_despacer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "despace_vector.h"
+
+#if !defined(__aarch64__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+enum { IN_CODE, IN_STRING, IN_LINE_COMMENT, IN_BLOCK_COMMENT };
+
+size_t comment_despace_scalar(char *bytes, size_t howmany, int syntax) {
+  const bool c = syntax == DESPACE_COMMENTS_C;
+  int mode = IN_CODE;
+  char closing = 0;
+  size_t pos = 0;
+  for (size_t i = 0; i < howmany; ++i) {
+    const char b = bytes[i];
+    const char next = i + 1 < howmany ? bytes[i + 1] : 0;
+    switch (mode) {
+      case IN_CODE:
+        if (b == '"' || (c && b == '\'')) {
+          mode = IN_STRING;
+          closing = b;
+          bytes[pos++] = b;
+        } else if ((c && b == '/' && next == '/') || (!c && b == '#')) {
+          mode = IN_LINE_COMMENT;
+        } else if (c && b == '/' && next == '*') {
+          mode = IN_BLOCK_COMMENT;
+          ++i;
+        } else {
+          pos = despace_byte_to(bytes, pos, (unsigned char)b);
+        }
+        break;
+      case IN_STRING:
+        bytes[pos++] = b;
+        if (b == '\\' && i + 1 < howmany) {
+          bytes[pos++] = bytes[++i];
+        } else if (b == closing) {
+          mode = IN_CODE;
+        }
+        break;
+      case IN_LINE_COMMENT:
+        if (b == '\n') {
+          mode = IN_CODE;
+        }
+        break;
+      case IN_BLOCK_COMMENT:
+        if (b == '*' && next == '/') {
+          mode = IN_CODE;
+          ++i;
+        }
+        break;
+    }
+  }
+  return pos;
+}
+
+/*
+ The bytes a block's masks are made from, each 64-bit mask having bit j for
+ byte j. One pass over the block fills them all, for the fast paths need
+ most of them to decide that they apply.
+ */
+struct ByteClasses {
+  uint64_t white;
+  uint64_t quote;      // '"'
+  uint64_t apostrophe; // '\''
+  uint64_t backslash;
+  uint64_t newline;
+  uint64_t opener;     // '/' in C, '#' otherwise
+  uint64_t star;
+};
+
+#if defined(__aarch64__)
+
+#define MATCH_MASK(v, c) \
+  block_mask(vceqq_u8(v[0], vdupq_n_u8(c)), vceqq_u8(v[1], vdupq_n_u8(c)), vceqq_u8(v[2], vdupq_n_u8(c)), \
+          vceqq_u8(v[3], vdupq_n_u8(c)))
+
+static inline void classify_block(const uint8_t *p, uint8_t opener, struct ByteClasses *classes) {
+  const uint8x16_t v[4] = { vld1q_u8(p), vld1q_u8(p + 16), vld1q_u8(p + 32), vld1q_u8(p + 48) };
+  classes->white = block_mask(is_white(v[0]), is_white(v[1]), is_white(v[2]), is_white(v[3]));
+  classes->quote = MATCH_MASK(v, '"');
+  classes->apostrophe = MATCH_MASK(v, '\'');
+  classes->backslash = MATCH_MASK(v, '\\');
+  classes->newline = MATCH_MASK(v, '\n');
+  classes->opener = MATCH_MASK(v, opener);
+  classes->star = MATCH_MASK(v, '*');
+}
+
+#undef MATCH_MASK
+
+#elif defined(__SSE2__)
+
+static inline void classify_block(const uint8_t *p, uint8_t opener, struct ByteClasses *classes) {
+  memset(classes, 0, sizeof(*classes));
+  classes->white = white_block_mask(p);
+  for (int k = 0; k != 4; ++k) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+#define MATCH_MASK(c) ((uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)(c)))) << (16 * k))
+    classes->quote |= MATCH_MASK('"');
+    classes->apostrophe |= MATCH_MASK('\'');
+    classes->backslash |= MATCH_MASK('\\');
+    classes->newline |= MATCH_MASK('\n');
+    classes->opener |= MATCH_MASK(opener);
+    classes->star |= MATCH_MASK('*');
+#undef MATCH_MASK
+  }
+}
+
+#else
+
+static inline void classify_block(const uint8_t *p, uint8_t opener, struct ByteClasses *classes) {
+  memset(classes, 0, sizeof(*classes));
+  classes->white = white_block_mask(p);
+  for (int j = 0; j != 64; ++j) {
+    const uint64_t bit = UINT64_C(1) << j;
+    classes->quote |= p[j] == '"' ? bit : 0;
+    classes->apostrophe |= p[j] == '\'' ? bit : 0;
+    classes->backslash |= p[j] == '\\' ? bit : 0;
+    classes->newline |= p[j] == '\n' ? bit : 0;
+    classes->opener |= p[j] == opener ? bit : 0;
+    classes->star |= p[j] == '*' ? bit : 0;
+  }
+}
+
+#endif
+
+// Bit j is the parity of the bits up to and including j.
+static inline uint64_t prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+struct BlockMasks {
+  uint64_t white;
+  uint64_t quote;        // '"'
+  uint64_t apostrophe;   // '\'', in C
+  uint64_t backslash;
+  uint64_t newline;
+  uint64_t lineStart;    // '#', or the first '/' of "//"
+  uint64_t blockStart;   // the '/' of "/" "*"
+  uint64_t blockEnd;     // the '*' of "*" "/"
+};
+
+struct CommentState {
+  int mode;
+  bool apostrophe;       // the string is closed by '\'' rather than '"'
+  unsigned carry;        // bytes at the start of the next block that belong to a marker or escape
+  bool carryRemoved;
+};
+
+/*
+ Finds the bytes to remove by going from one marker to the next. Past a
+ marker at bit 63, the byte it takes from the next block is left in carry.
+ */
+static uint64_t walk_block(struct CommentState *state, const struct BlockMasks *m) {
+  uint64_t remove = 0;
+  unsigned bit = state->carry;
+  if (state->carryRemoved) {
+    remove |= bit_range(0, bit);
+  }
+  state->carry = 0;
+  state->carryRemoved = false;
+  while (bit < 64) {
+    const uint64_t from = ~UINT64_C(0) << bit;
+    switch (state->mode) {
+      case IN_CODE: {
+        const uint64_t markers = (m->quote | m->apostrophe | m->lineStart | m->blockStart) & from;
+        if (markers == 0) {
+          remove |= m->white & from;
+          bit = 64;
+          break;
+        }
+        const unsigned j = (unsigned)__builtin_ctzll(markers);
+        const uint64_t at = UINT64_C(1) << j;
+        remove |= m->white & bit_range(bit, j);
+        if ((m->quote | m->apostrophe) & at) {
+          state->mode = IN_STRING;
+          state->apostrophe = (m->apostrophe & at) != 0;
+          bit = j + 1;
+        } else if (m->lineStart & at) {
+          state->mode = IN_LINE_COMMENT;
+          bit = j;
+        } else {
+          state->mode = IN_BLOCK_COMMENT;
+          remove |= at;
+          if (j == 63) {
+            state->carry = 1;
+            state->carryRemoved = true;
+            bit = 64;
+          } else {
+            remove |= at << 1;
+            bit = j + 2;
+          }
+        }
+        break;
+      }
+      case IN_STRING: {
+        const uint64_t closing = state->apostrophe ? m->apostrophe : m->quote;
+        const uint64_t events = (closing | m->backslash) & from;
+        if (events == 0) {
+          bit = 64;
+          break;
+        }
+        const unsigned j = (unsigned)__builtin_ctzll(events);
+        if (m->backslash & (UINT64_C(1) << j)) {
+          if (j == 63) {
+            state->carry = 1;
+          }
+          bit = j + 2;
+        } else {
+          state->mode = IN_CODE;
+          bit = j + 1;
+        }
+        break;
+      }
+      case IN_LINE_COMMENT: {
+        const uint64_t ends = m->newline & from;
+        if (ends == 0) {
+          remove |= from;
+          bit = 64;
+          break;
+        }
+        const unsigned j = (unsigned)__builtin_ctzll(ends);
+        remove |= bit_range(bit, j);
+        state->mode = IN_CODE;
+        bit = j;
+        break;
+      }
+      case IN_BLOCK_COMMENT: {
+        const uint64_t ends = m->blockEnd & from;
+        if (ends == 0) {
+          remove |= from;
+          bit = 64;
+          break;
+        }
+        const unsigned j = (unsigned)__builtin_ctzll(ends);
+        state->mode = IN_CODE;
+        if (j == 63) {
+          remove |= bit_range(bit, 64);
+          state->carry = 1;
+          state->carryRemoved = true;
+          bit = 64;
+        } else {
+          remove |= bit_range(bit, j + 2);
+          bit = j + 2;
+        }
+        break;
+      }
+    }
+  }
+  return ~remove;
+}
+
+// Which of the 64 bytes at p to keep. p[64] must be readable, for markers
+// that straddle the end of the block.
+static inline uint64_t keep_mask(struct CommentState *state, const uint8_t *p, bool c) {
+  struct ByteClasses classes;
+  classify_block(p, c ? '/' : '#', &classes);
+  const uint64_t apostrophe = c ? classes.apostrophe : 0;
+  if (state->carry == 0) {
+    // Nothing but whitespace to remove.
+    if (state->mode == IN_CODE && (classes.quote | apostrophe | classes.opener) == 0) {
+      return ~classes.white;
+    }
+    // Strings without escapes or comment markers nearby: the bytes inside
+    // are those after an odd number of quotes, counting from the state
+    // carried in.
+    if ((state->mode == IN_CODE || state->mode == IN_STRING) && (classes.opener | classes.backslash) == 0
+        && (classes.quote == 0 || apostrophe == 0)) {
+      const bool sameKind = state->mode == IN_CODE || (state->apostrophe ? classes.quote == 0 : apostrophe == 0);
+      if (sameKind) {
+        const uint64_t quotes = classes.quote | apostrophe;
+        uint64_t inside = prefix_xor(quotes);
+        if (state->mode == IN_STRING) {
+          inside = ~inside;
+        }
+        if (__builtin_popcountll(quotes) & 1) {
+          state->apostrophe = state->mode == IN_CODE ? apostrophe != 0 : state->apostrophe;
+          state->mode = state->mode == IN_CODE ? IN_STRING : IN_CODE;
+        }
+        return ~(classes.white & ~inside);
+      }
+    }
+  }
+  struct BlockMasks m;
+  m.white = classes.white;
+  m.quote = classes.quote;
+  m.apostrophe = apostrophe;
+  m.backslash = classes.backslash;
+  m.newline = classes.newline;
+  if (c) {
+    const uint64_t slashNext = classes.opener >> 1 | (uint64_t)(p[64] == '/') << 63;
+    const uint64_t starNext = classes.star >> 1 | (uint64_t)(p[64] == '*') << 63;
+    m.lineStart = classes.opener & slashNext;
+    m.blockStart = classes.opener & starNext;
+    m.blockEnd = classes.star & slashNext;
+  } else {
+    m.lineStart = classes.opener;
+    m.blockStart = 0;
+    m.blockEnd = 0;
+  }
+  return walk_block(state, &m);
+}
+
+size_t comment_despace(char *bytes, size_t howmany, int syntax) {
+  uint8_t *data = (uint8_t *)bytes;
+  const bool c = syntax == DESPACE_COMMENTS_C;
+  struct CommentState state = { IN_CODE, false, 0, false };
+  size_t pos = 0;
+  size_t i = 0;
+  for (; i + 64 < howmany; i += 64) {
+    const uint64_t keep = keep_mask(&state, data + i, c);
+    if (keep == ~UINT64_C(0)) {
+      if (pos != i) {
+        memmove(data + pos, data + i, 64);
+      }
+      pos += 64;
+      continue;
+    }
+#if DESPACE_VECTOR
+    for (int k = 0; k != 4; ++k) {
+      const unsigned keep16 = (unsigned)(keep >> (16 * k)) & 0xFFFF;
+      store_vector(data + pos, compact_vector_by_mask(load_vector(data + i + 16 * k), keep16));
+      pos += (size_t)__builtin_popcount(keep16);
+    }
+#else
+    for (size_t j = 0; j != 64; ++j) {
+      data[pos] = data[i + j];
+      pos += (keep >> j) & 1;
+    }
+#endif
+  }
+  if (i < howmany) {
+    // The last block, padded with whitespace, which nothing keeps; a zero
+    // after it ends no marker.
+    uint8_t last[65] = { 0 };
+    const size_t count = howmany - i;
+    memcpy(last, data + i, count);
+    const uint64_t keep = keep_mask(&state, last, c);
+    for (size_t j = 0; j != count; ++j) {
+      data[pos] = last[j];
+      pos += (keep >> j) & 1;
+    }
+  }
+  return pos;
+}
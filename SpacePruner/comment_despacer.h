@@ -0,0 +1,43 @@
+//
+//  comment_despacer.h
+//  SpacePruner
+//
+
+#ifndef comment_despacer_h
+#define comment_despacer_h
+
+#include <stddef.h>
+
+/*
+ Minifies config files and C-like sources: despaces bytes in place and
+ drops comments along with the whitespace. With DESPACE_COMMENTS_HASH,
+ comments run from '#' to the end of the line; with DESPACE_COMMENTS_C,
+ from "//" to the end of the line and from "/" "*" to the next "*" "/".
+
+ Strings are left alone, whitespace and all: "..." in both syntaxes and
+ '...' in C, where a backslash escapes the character after it. A string or
+ comment left open at the end runs to the end of the input.
+ */
+
+enum { DESPACE_COMMENTS_HASH = 0, DESPACE_COMMENTS_C = 1 };
+
+// One byte at a time, for reference.
+size_t comment_despace_scalar(char *bytes, size_t howmany, int syntax);
+
+/*
+ The same 64 bytes at a time. Each block is classified into bitmasks
+ (whitespace, quotes, comment markers, line feeds) and the bytes to keep are
+ worked out on the masks: a block with nothing but whitespace to remove is
+ compacted straight away, strings without escapes are found with a
+ prefix XOR of the quote mask, carried from block to block, and otherwise
+ the masks are walked from one marker to the next, each comment or string
+ ending at the first line feed or closing marker after it. Blocks wholly
+ inside a comment cost one test of the closing mask.
+
+ The walk is scalar and only 16-byte vectors are used, so how far this is
+ behind despace_best depends mostly on how wide despace_best gets on the
+ machine; minifybenchmark reports the ratio.
+ */
+size_t comment_despace(char *bytes, size_t howmany, int syntax);
+
+#endif /* comment_despacer_h */
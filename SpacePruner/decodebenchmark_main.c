@@ -0,0 +1,271 @@
+// gcc -std=gnu11 -O3 -o decodebenchmark decodebenchmark_main.c base64_decoder.c hex_decoder.c best_despacer.c adaptive_despacer.c staged_despacer.c interleaved_despacer.c nontemporal_despacer.c bigtable.c benchmark_timing.c -lm -lpthread
+//
+//  decodebenchmark_main.c
+//  SpacePruner
+//
+//  Times decoding that skips whitespace as it goes against despacing first
+//  and decoding the clean text after, on base64 wrapped like MIME bodies and
+//  on hex dumps with a space between bytes.
+//
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "base64_decoder.h"
+#include "benchmark_timing.h"
+#include "best_despacer.h"
+#include "hex_decoder.h"
+
+typedef size_t (*decode_function_ptr)(uint8_t *dest, const char *source, size_t howmany, size_t *errorOffset);
+
+// Text the two-pass decoders despace, since the input is left alone.
+static char *scratch;
+
+// The input is const, so a caller that wants to despace first has to copy
+// it; that copy is part of the cost of two passes.
+static size_t despace_then_base64_decode(uint8_t *dest, const char *source, size_t howmany, size_t *errorOffset) {
+  memcpy(scratch, source, howmany);
+  const size_t length = despace_best(scratch, howmany);
+  return base64_decode_despacing(dest, scratch, length, errorOffset);
+}
+
+static size_t despace_then_hex_decode(uint8_t *dest, const char *source, size_t howmany, size_t *errorOffset) {
+  memcpy(scratch, source, howmany);
+  const size_t length = despace_best(scratch, howmany);
+  return hex_decode_despacing(dest, scratch, length, errorOffset);
+}
+
+struct DecoderAndName {
+  decode_function_ptr ptr;
+  const char *name;
+};
+
+static const struct DecoderAndName base64Decoders[] = {
+  { base64_decode_despacing, "base64_decode_despacing" },
+  { despace_then_base64_decode, "despace_then_base64_decode" },
+  { base64_decode_despacing_scalar, "base64_decode_despacing_scalar" },
+  { NULL, NULL },
+};
+
+static const struct DecoderAndName hexDecoders[] = {
+  { hex_decode_despacing, "hex_decode_despacing" },
+  { despace_then_hex_decode, "despace_then_hex_decode" },
+  { hex_decode_despacing_scalar, "hex_decode_despacing_scalar" },
+  { NULL, NULL },
+};
+
+static const char base64Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Encodes howmany bytes with padding, breaking lines every lineLength
+// characters with CRLF. Returns the length of the text.
+static size_t base64_encode_wrapped(char *text, const uint8_t *bytes, size_t howmany, size_t lineLength) {
+  size_t pos = 0;
+  size_t column = 0;
+  for (size_t i = 0; i < howmany; i += 3) {
+    const size_t left = howmany - i;
+    const uint32_t bits = (uint32_t)bytes[i] << 16 | (left > 1 ? (uint32_t)bytes[i + 1] << 8 : 0)
+                          | (left > 2 ? bytes[i + 2] : 0);
+    const char quantum[4] = {
+      base64Digits[bits >> 18], base64Digits[(bits >> 12) & 63],
+      left > 1 ? base64Digits[(bits >> 6) & 63] : '=', left > 2 ? base64Digits[bits & 63] : '=',
+    };
+    for (int k = 0; k != 4; ++k) {
+      if (column == lineLength) {
+        text[pos++] = '\r';
+        text[pos++] = '\n';
+        column = 0;
+      }
+      text[pos++] = quantum[k];
+      ++column;
+    }
+  }
+  return pos;
+}
+
+// Writes bytes as "de ad be ef ...", lineLength bytes to a line. Returns the
+// length of the text.
+static size_t hex_encode_wrapped(char *text, const uint8_t *bytes, size_t howmany, size_t lineLength) {
+  static const char digits[] = "0123456789abcdef";
+  size_t pos = 0;
+  for (size_t i = 0; i != howmany; ++i) {
+    text[pos++] = digits[bytes[i] >> 4];
+    text[pos++] = digits[bytes[i] & 15];
+    text[pos++] = (i + 1) % lineLength == 0 || i + 1 == howmany ? '\n' : ' ';
+  }
+  return pos;
+}
+
+typedef size_t (*encode_function_ptr)(char *text, const uint8_t *bytes, size_t howmany, size_t lineLength);
+
+struct Format {
+  const char *name;
+  encode_function_ptr encode;
+  size_t (*textBound)(size_t howmany, size_t lineLength);
+  size_t lineLength;  // characters for base64, bytes for hex
+  const struct DecoderAndName *decoders;
+};
+
+static size_t base64_text_bound(size_t howmany, size_t lineLength) {
+  const size_t characters = (howmany + 2) / 3 * 4;
+  return characters + 2 * (characters / lineLength + 1);
+}
+
+static size_t hex_text_bound(size_t howmany, size_t lineLength) {
+  (void)lineLength;
+  return 3 * howmany;
+}
+
+static size_t parse_size(const char *text) {
+  char *end;
+  double value = strtod(text, &end);
+  switch (*end) {
+    case 'G': case 'g': value *= 1024;  // fall through
+    case 'M': case 'm': value *= 1024;  // fall through
+    case 'K': case 'k': value *= 1024;
+  }
+  return (size_t)value;
+}
+
+// Checks that decoder gets the original back, and that it finds a bad
+// character put in the middle of the text. Returns false if not.
+static bool check_decoder(const struct DecoderAndName *decoder, char *text, size_t textLength,
+                          const uint8_t *expected, size_t expectedLength, uint8_t *out) {
+  size_t errorOffset = 0;
+  const size_t length = decoder->ptr(out, text, textLength, &errorOffset);
+  if (length != expectedLength || memcmp(out, expected, expectedLength) != 0) {
+    printf("%s: wrong result\n", decoder->name);
+    return false;
+  }
+  size_t bad = textLength / 2;
+  while (bad < textLength && (unsigned char)text[bad] <= ' ') {
+    ++bad;
+  }
+  if (bad == textLength) {
+    return true;
+  }
+  const char saved = text[bad];
+  text[bad] = '*';
+  const size_t failed = decoder->ptr(out, text, textLength, &errorOffset);
+  text[bad] = saved;
+  if (failed != SIZE_MAX) {
+    printf("%s: missed an invalid character\n", decoder->name);
+    return false;
+  }
+  // After despacing, offsets are into the clean text.
+  if (decoder->ptr != despace_then_base64_decode && decoder->ptr != despace_then_hex_decode && errorOffset != bad) {
+    printf("%s: invalid character at %zu reported at %zu\n", decoder->name, bad, errorOffset);
+    return false;
+  }
+  return true;
+}
+
+static void time_decoder(const struct DecoderAndName *decoder, const char *text, size_t textLength, uint8_t *out,
+                         size_t repeat, uint64_t *samples) {
+  size_t errorOffset;
+  for (size_t r = 0; r != repeat; ++r) {
+    const uint64_t start = time_in_ns();
+    const size_t length = decoder->ptr(out, text, textLength, &errorOffset);
+    samples[r] = time_in_ns() - start;
+    if (length == SIZE_MAX) {
+      abort();
+    }
+  }
+  struct BenchmarkStats stats;
+  compute_benchmark_stats(samples, repeat, &stats);
+  printf("%-32s %8.3f ns/byte %8.2f GB/s  spread %5.1f%%\n", decoder->name,
+         (double)stats.median / (double)textLength, (double)textLength / (double)stats.median,
+         100 * benchmark_stats_spread(&stats));
+}
+
+static void usage(FILE *stream, const char *program) {
+  fprintf(stream,
+          "usage: %s [options]\n"
+          "  --repeat N         timed samples per decoder (default 100)\n"
+          "  --sizes A,B,...    decoded sizes to time (default 4K,64K,1M,16M)\n"
+          "  --line N           base64 characters per line (default 76, as in MIME)\n"
+          "Sizes accept K, M and G suffixes.\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  static const struct option longOptions[] = {
+    { "repeat", required_argument, NULL, 'r' },
+    { "sizes", required_argument, NULL, 's' },
+    { "line", required_argument, NULL, 'l' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  size_t repeat = 100;
+  size_t lineLength = 76;
+  size_t sizes[16] = { 4096, 65536, 1 << 20, 16 << 20 };
+  size_t sizeCount = 4;
+  int option;
+  while ((option = getopt_long(argc, argv, "h", longOptions, NULL)) != -1) {
+    switch (option) {
+      case 'r': repeat = parse_size(optarg); break;
+      case 'l': lineLength = parse_size(optarg); break;
+      case 's':
+        sizeCount = 0;
+        for (char *item = strtok(optarg, ","); item && sizeCount != 16; item = strtok(NULL, ",")) {
+          sizes[sizeCount++] = parse_size(item);
+        }
+        break;
+      case 'h':
+        usage(stdout, argv[0]);
+        return 0;
+      default:
+        usage(stderr, argv[0]);
+        return 2;
+    }
+  }
+  if (repeat == 0 || lineLength == 0) {
+    usage(stderr, argv[0]);
+    return 2;
+  }
+
+  pin_current_thread_to_cpu(-1);
+  wait_for_stable_frequency(500 * 1000 * 1000);
+  printf("two-pass decoders despace with %s\n", despace_best_name());
+  uint64_t *samples = malloc(repeat * sizeof(uint64_t));
+  bool ok = samples != NULL;
+  srand(1234);
+  const struct Format formats[] = {
+    { "base64", base64_encode_wrapped, base64_text_bound, lineLength, base64Decoders },
+    { "hex", hex_encode_wrapped, hex_text_bound, 16, hexDecoders },
+  };
+  for (size_t f = 0; f != sizeof(formats) / sizeof(formats[0]); ++f) {
+    const struct Format *format = &formats[f];
+    for (size_t s = 0; s != sizeCount && ok; ++s) {
+      const size_t size = sizes[s];
+      const size_t textCapacity = format->textBound(size, format->lineLength);
+      uint8_t *original = malloc(size + 1);
+      char *text = malloc(textCapacity);
+      scratch = malloc(textCapacity);
+      uint8_t *out = malloc(size + 16);
+      if (original == NULL || text == NULL || scratch == NULL || out == NULL) {
+        ok = false;
+      } else {
+        for (size_t i = 0; i != size; ++i) {
+          original[i] = (uint8_t)rand();
+        }
+        const size_t textLength = format->encode(text, original, size, format->lineLength);
+        printf("\n%s, %zu bytes from %zu characters\n", format->name, size, textLength);
+        for (const struct DecoderAndName *decoder = format->decoders; decoder->ptr != NULL; ++decoder) {
+          if (!check_decoder(decoder, text, textLength, original, size, out)) {
+            ok = false;
+            continue;
+          }
+          time_decoder(decoder, text, textLength, out, repeat, samples);
+        }
+      }
+      free(original);
+      free(text);
+      free(scratch);
+      free(out);
+    }
+  }
+  free(samples);
+  return ok ? 0 : 2;
+}
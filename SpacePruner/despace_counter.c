@@ -0,0 +1,349 @@
+//
+//  despace_counter.c
+//  SpacePruner
+//
+
+#include "despace_counter.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "despacer.h"
+
+#if !__ARM_NEON && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if __ARM_NEON
+#include <arm_neon.h>
+
+static inline uint64_t sum_bytes(uint8x16_t v) {
+  const uint64x2_t sums = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(v)));
+  return vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1);
+}
+
+size_t despace_count(const char *bytes, size_t howmany) {
+  const uint8_t *data = (const uint8_t *)bytes;
+  const size_t chunk_size = 16 * 4;
+  // A byte lane can count 255 whitespace bytes before it has to be widened.
+  const size_t chunksPerFlush = 255;
+  size_t i = 0, white = 0;
+  while (i + chunk_size <= howmany) {
+    size_t chunks = (howmany - i) / chunk_size;
+    if (chunks > chunksPerFlush) {
+      chunks = chunksPerFlush;
+    }
+    // Four independent accumulators, so that the loads aren't serialized
+    // behind one chain of additions. is_white gives 0xFF, i.e. -1, for
+    // whitespace, so subtracting it counts.
+    uint8x16_t count0 = vdupq_n_u8(0);
+    uint8x16_t count1 = vdupq_n_u8(0);
+    uint8x16_t count2 = vdupq_n_u8(0);
+    uint8x16_t count3 = vdupq_n_u8(0);
+    for (; chunks != 0; --chunks, i += chunk_size) {
+      count0 = vsubq_u8(count0, is_white(vld1q_u8(data + i)));
+      count1 = vsubq_u8(count1, is_white(vld1q_u8(data + i + 16)));
+      count2 = vsubq_u8(count2, is_white(vld1q_u8(data + i + 32)));
+      count3 = vsubq_u8(count3, is_white(vld1q_u8(data + i + 48)));
+    }
+    white += sum_bytes(count0) + sum_bytes(count1) + sum_bytes(count2) + sum_bytes(count3);
+  }
+  size_t kept = i - white;
+  for (; i < howmany; ++i) {
+    kept += (data[i] > 32) ? 1 : 0;
+  }
+  return kept;
+}
+
+#elif defined(__SSE2__)
+
+// Sums of absolute differences from zero add up each half's bytes.
+static inline uint64_t sum_bytes(__m128i v) {
+  const __m128i sums = _mm_sad_epu8(v, _mm_setzero_si128());
+  return (uint64_t)_mm_cvtsi128_si32(sums) + (uint64_t)_mm_extract_epi16(sums, 4);
+}
+
+// The same as the NEON version, counting kept bytes rather than whitespace.
+// SSE2 only compares signed bytes, so both sides are offset by 0x80 to
+// compare them as unsigned.
+size_t despace_count(const char *bytes, size_t howmany) {
+  const uint8_t *data = (const uint8_t *)bytes;
+  const size_t chunk_size = 16 * 4;
+  const size_t chunksPerFlush = 255;
+  const __m128i bias = _mm_set1_epi8((char)0x80);
+  const __m128i space = _mm_set1_epi8((char)(' ' ^ 0x80));
+  size_t i = 0, kept = 0;
+  while (i + chunk_size <= howmany) {
+    size_t chunks = (howmany - i) / chunk_size;
+    if (chunks > chunksPerFlush) {
+      chunks = chunksPerFlush;
+    }
+    __m128i count0 = _mm_setzero_si128();
+    __m128i count1 = _mm_setzero_si128();
+    __m128i count2 = _mm_setzero_si128();
+    __m128i count3 = _mm_setzero_si128();
+    for (; chunks != 0; --chunks, i += chunk_size) {
+      const __m128i v0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(data + i)), bias);
+      const __m128i v1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(data + i + 16)), bias);
+      const __m128i v2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(data + i + 32)), bias);
+      const __m128i v3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(data + i + 48)), bias);
+      count0 = _mm_sub_epi8(count0, _mm_cmpgt_epi8(v0, space));
+      count1 = _mm_sub_epi8(count1, _mm_cmpgt_epi8(v1, space));
+      count2 = _mm_sub_epi8(count2, _mm_cmpgt_epi8(v2, space));
+      count3 = _mm_sub_epi8(count3, _mm_cmpgt_epi8(v3, space));
+    }
+    kept += sum_bytes(count0) + sum_bytes(count1) + sum_bytes(count2) + sum_bytes(count3);
+  }
+  for (; i < howmany; ++i) {
+    kept += (data[i] > 32) ? 1 : 0;
+  }
+  return kept;
+}
+
+#else
+
+size_t despace_count(const char *bytes, size_t howmany) {
+  const uint8_t *data = (const uint8_t *)bytes;
+  size_t kept = 0;
+  for (size_t i = 0; i < howmany; ++i) {
+    kept += (data[i] > 32) ? 1 : 0;
+  }
+  return kept;
+}
+
+#endif // __ARM_NEON
+
+/*
+ Words are counted by their first bytes: kept bytes whose neighbour below is
+ not kept. Each vector's neighbours are the kept mask shifted up a byte, with
+ the top byte of the vector before carried in, and like whitespace in
+ despace_count, line feeds, first bytes and kept bytes are counted in byte
+ lanes that are widened every 255 vectors.
+ */
+static void count_text_after(const uint8_t *data, size_t howmany, bool afterWord, struct TextCounts *counts) {
+  size_t i = 0;
+  uint64_t lines = 0, words = 0, white = 0;
+  const size_t chunk_size = 16;
+  const size_t chunksPerFlush = 255;
+#if __ARM_NEON
+  uint8x16_t previous = vdupq_n_u8(afterWord ? 0xFF : 0);
+  while (i + chunk_size <= howmany) {
+    size_t chunks = (howmany - i) / chunk_size;
+    if (chunks > chunksPerFlush) {
+      chunks = chunksPerFlush;
+    }
+    uint8x16_t lineCount = vdupq_n_u8(0);
+    uint8x16_t wordCount = vdupq_n_u8(0);
+    uint8x16_t whiteCount = vdupq_n_u8(0);
+    for (; chunks != 0; --chunks, i += chunk_size) {
+      const uint8x16_t v = vld1q_u8(data + i);
+      const uint8x16_t w = is_white(v);
+      const uint8x16_t kept = vmvnq_u8(w);
+      const uint8x16_t below = vextq_u8(previous, kept, 15);
+      whiteCount = vsubq_u8(whiteCount, w);
+      wordCount = vsubq_u8(wordCount, vbicq_u8(kept, below));
+      lineCount = vsubq_u8(lineCount, vceqq_u8(v, vdupq_n_u8('\n')));
+      previous = kept;
+    }
+    lines += sum_bytes(lineCount);
+    words += sum_bytes(wordCount);
+    white += sum_bytes(whiteCount);
+  }
+  if (i != 0) {
+    afterWord = vgetq_lane_u8(previous, 15) != 0;
+  }
+#elif defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i previous = afterWord ? _mm_set1_epi8(-1) : zero;
+  while (i + chunk_size <= howmany) {
+    size_t chunks = (howmany - i) / chunk_size;
+    if (chunks > chunksPerFlush) {
+      chunks = chunksPerFlush;
+    }
+    __m128i lineCount = zero;
+    __m128i wordCount = zero;
+    __m128i whiteCount = zero;
+    for (; chunks != 0; --chunks, i += chunk_size) {
+      const __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+      const __m128i w = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(' ')), v);
+      const __m128i kept = _mm_xor_si128(w, _mm_set1_epi8(-1));
+      const __m128i below = _mm_or_si128(_mm_slli_si128(kept, 1), _mm_srli_si128(previous, 15));
+      whiteCount = _mm_sub_epi8(whiteCount, w);
+      wordCount = _mm_sub_epi8(wordCount, _mm_andnot_si128(below, kept));
+      lineCount = _mm_sub_epi8(lineCount, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+      previous = kept;
+    }
+    lines += sum_bytes(lineCount);
+    words += sum_bytes(wordCount);
+    white += sum_bytes(whiteCount);
+  }
+  if (i != 0) {
+    afterWord = (_mm_movemask_epi8(previous) & 0x8000) != 0;
+  }
+#else
+  (void)chunk_size;
+  (void)chunksPerFlush;
+#endif
+  uint64_t kept = i - white;
+  for (; i < howmany; ++i) {
+    const bool keep = data[i] > 32;
+    kept += keep;
+    words += keep && !afterWord;
+    lines += data[i] == '\n';
+    afterWord = keep;
+  }
+  counts->lines = lines;
+  counts->words = words;
+  counts->kept = kept;
+  counts->bytes = howmany;
+}
+
+void count_text(const char *bytes, size_t howmany, struct TextCounts *counts) {
+  count_text_after((const uint8_t *)bytes, howmany, false, counts);
+}
+
+// Below this, a thread costs more to start than it saves.
+static const size_t minBytesPerThread = 256 * 1024;
+enum { maxThreadCount = 64 };
+
+struct CountSlice {
+  pthread_t thread;
+  const char *bytes;
+  size_t howmany;
+  size_t kept;
+};
+
+static void *count_slice(void *context) {
+  struct CountSlice *slice = context;
+  slice->kept = despace_count(slice->bytes, slice->howmany);
+  return NULL;
+}
+
+size_t despace_count_parallel(const char *bytes, size_t howmany, size_t threadCount) {
+  if (threadCount == 0) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threadCount = cpus > 0 ? (size_t)cpus : 1;
+  }
+  if (threadCount > howmany / minBytesPerThread) {
+    threadCount = howmany / minBytesPerThread;
+  }
+  if (threadCount > maxThreadCount) {
+    threadCount = maxThreadCount;
+  }
+  if (threadCount <= 1) {
+    return despace_count(bytes, howmany);
+  }
+
+  struct CountSlice slices[maxThreadCount];
+  bool started[maxThreadCount];
+  const size_t sliceSize = howmany / threadCount;
+  for (size_t t = 0; t != threadCount; ++t) {
+    slices[t].bytes = bytes + t * sliceSize;
+    slices[t].howmany = (t + 1 == threadCount) ? howmany - t * sliceSize : sliceSize;
+  }
+  // The calling thread counts the last slice itself.
+  for (size_t t = 0; t + 1 != threadCount; ++t) {
+    started[t] = pthread_create(&slices[t].thread, NULL, &count_slice, &slices[t]) == 0;
+  }
+  count_slice(&slices[threadCount - 1]);
+
+  size_t kept = slices[threadCount - 1].kept;
+  for (size_t t = 0; t + 1 != threadCount; ++t) {
+    if (started[t]) {
+      pthread_join(slices[t].thread, NULL);
+    } else {
+      count_slice(&slices[t]);
+    }
+    kept += slices[t].kept;
+  }
+  return kept;
+}
+
+struct TextSlice {
+  pthread_t thread;
+  const uint8_t *bytes;
+  size_t howmany;
+  bool afterWord;
+  struct TextCounts counts;
+};
+
+static void *count_text_slice(void *context) {
+  struct TextSlice *slice = context;
+  count_text_after(slice->bytes, slice->howmany, slice->afterWord, &slice->counts);
+  return NULL;
+}
+
+void count_text_parallel(const char *bytes, size_t howmany, size_t threadCount, struct TextCounts *counts) {
+  if (threadCount == 0) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threadCount = cpus > 0 ? (size_t)cpus : 1;
+  }
+  if (threadCount > howmany / minBytesPerThread) {
+    threadCount = howmany / minBytesPerThread;
+  }
+  if (threadCount > maxThreadCount) {
+    threadCount = maxThreadCount;
+  }
+  if (threadCount <= 1) {
+    count_text(bytes, howmany, counts);
+    return;
+  }
+
+  const uint8_t *data = (const uint8_t *)bytes;
+  struct TextSlice slices[maxThreadCount];
+  bool started[maxThreadCount];
+  const size_t sliceSize = howmany / threadCount;
+  for (size_t t = 0; t != threadCount; ++t) {
+    slices[t].bytes = data + t * sliceSize;
+    slices[t].howmany = (t + 1 == threadCount) ? howmany - t * sliceSize : sliceSize;
+    slices[t].afterWord = t != 0 && data[t * sliceSize - 1] > 32;
+  }
+  for (size_t t = 0; t + 1 != threadCount; ++t) {
+    started[t] = pthread_create(&slices[t].thread, NULL, &count_text_slice, &slices[t]) == 0;
+  }
+  count_text_slice(&slices[threadCount - 1]);
+
+  *counts = slices[threadCount - 1].counts;
+  for (size_t t = 0; t + 1 != threadCount; ++t) {
+    if (started[t]) {
+      pthread_join(slices[t].thread, NULL);
+    } else {
+      count_text_slice(&slices[t]);
+    }
+    counts->lines += slices[t].counts.lines;
+    counts->words += slices[t].counts.words;
+    counts->kept += slices[t].counts.kept;
+    counts->bytes += slices[t].counts.bytes;
+  }
+}
+
+void text_counter_init(struct TextCounter *counter) {
+  counter->counts = (struct TextCounts){ 0, 0, 0, 0 };
+  counter->inWord = false;
+}
+
+void text_counter_update(struct TextCounter *counter, const char *bytes, size_t howmany) {
+  if (howmany == 0) {
+    return;
+  }
+  struct TextCounts counts;
+  count_text_after((const uint8_t *)bytes, howmany, counter->inWord, &counts);
+  counter->counts.lines += counts.lines;
+  counter->counts.words += counts.words;
+  counter->counts.kept += counts.kept;
+  counter->counts.bytes += counts.bytes;
+  counter->inWord = (unsigned char)bytes[howmany - 1] > 32;
+}
+
+void despace_counter_init(struct DespaceCounter *counter) {
+  counter->kept = 0;
+}
+
+void despace_counter_update(struct DespaceCounter *counter, const char *bytes, size_t howmany) {
+  counter->kept += despace_count(bytes, howmany);
+}
+
+uint64_t despace_counter_result(const struct DespaceCounter *counter) {
+  return counter->kept;
+}
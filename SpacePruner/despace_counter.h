@@ -0,0 +1,58 @@
+//
+//  despace_counter.h
+//  SpacePruner
+//
+
+#ifndef despace_counter_h
+#define despace_counter_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The number of bytes that despacing would keep, i.e. the despaced length,
+// for sizing an output buffer before copying into it. Only reads.
+size_t despace_count(const char *bytes, size_t howmany);
+
+// Splits the input among threadCount threads, or one per online CPU if
+// threadCount is 0. Inputs too small to be worth that many threads use fewer.
+size_t despace_count_parallel(const char *bytes, size_t howmany, size_t threadCount);
+
+// Counts input that arrives in pieces.
+struct DespaceCounter {
+  uint64_t kept;
+};
+
+void despace_counter_init(struct DespaceCounter *counter);
+void despace_counter_update(struct DespaceCounter *counter, const char *bytes, size_t howmany);
+uint64_t despace_counter_result(const struct DespaceCounter *counter);
+
+/*
+ What wc counts, plus the despaced length, from one read-only pass: lines
+ are line feeds, words are runs of bytes that despacing keeps, so unlike wc
+ every byte up to 32 separates words.
+ */
+struct TextCounts {
+  uint64_t lines;
+  uint64_t words;
+  uint64_t kept;
+  uint64_t bytes;
+};
+
+void count_text(const char *bytes, size_t howmany, struct TextCounts *counts);
+
+// Like despace_count_parallel. Each slice looks at the byte before it to
+// know whether its first word started in the slice before, so the slices'
+// counts just add up.
+void count_text_parallel(const char *bytes, size_t howmany, size_t threadCount, struct TextCounts *counts);
+
+// Counts text that arrives in pieces, which may split words.
+struct TextCounter {
+  struct TextCounts counts;
+  bool inWord;
+};
+
+void text_counter_init(struct TextCounter *counter);
+void text_counter_update(struct TextCounter *counter, const char *bytes, size_t howmany);
+
+#endif /* despace_counter_h */
@@ -0,0 +1,368 @@
+//
+//  despace_pipeline.c
+//  SpacePruner
+//
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
+#include "despace_pipeline.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "best_despacer.h"
+#include "spsc_ring.h"
+
+static const size_t blockSize = 64;
+static const size_t pageSize = 4096;
+
+struct PipelineBuffer {
+  char *data;
+  size_t length;
+};
+
+// Sent to every worker, and by them to the writer, after the last buffer.
+static struct PipelineBuffer endOfInput;
+
+struct Worker {
+  pthread_t thread;
+  struct SpscRing input;   // reader to worker
+  struct SpscRing output;  // worker to writer
+};
+
+struct Pipeline {
+  const struct DespacePipelineOptions *options;
+  int inputFd;
+  int outputFd;
+  struct PipelineBuffer *buffers;
+  struct SpscRing freeBuffers;  // writer to reader
+  struct Worker *workers;
+  atomic_int readError;
+  atomic_int writeError;
+  uint64_t bytesIn;
+};
+
+void despace_pipeline_default_options(struct DespacePipelineOptions *options) {
+  options->bufferSize = 1024 * 1024;
+  options->bufferCount = 8;
+  options->workerCount = 1;
+  options->spliceOutput = false;
+}
+
+// Fills the buffer after `filled` bytes as far as one read() goes. Returns
+// the new fill level, or (size_t)-1 on error.
+static size_t read_some(struct Pipeline *pipeline, struct PipelineBuffer *buffer, size_t filled) {
+  for (;;) {
+    const ssize_t count = read(pipeline->inputFd, buffer->data + filled, pipeline->options->bufferSize - filled);
+    if (count >= 0) {
+      return filled + (size_t)count;
+    }
+    if (errno != EINTR) {
+      atomic_store(&pipeline->readError, errno);
+      return (size_t)-1;
+    }
+  }
+}
+
+static void *run_reader(void *context) {
+  struct Pipeline *pipeline = context;
+  const size_t workerCount = pipeline->options->workerCount;
+  size_t nextWorker = 0;
+  struct PipelineBuffer *buffer = spsc_ring_pop(&pipeline->freeBuffers);
+  size_t filled = 0;
+  for (;;) {
+    const size_t newFilled = read_some(pipeline, buffer, filled);
+    if (newFilled == (size_t)-1 || atomic_load(&pipeline->writeError) != 0) {
+      break;
+    }
+    const bool atEnd = newFilled == filled;
+    pipeline->bytesIn += newFilled - filled;
+    filled = newFilled;
+    // Hand on whole blocks only, unless the input has ended or the buffer
+    // is full, and carry the rest to the next buffer.
+    const size_t length = atEnd ? filled : filled - filled % blockSize;
+    if (length == 0) {
+      if (atEnd) {
+        break;
+      }
+      continue;
+    }
+    struct PipelineBuffer *next = spsc_ring_pop(&pipeline->freeBuffers);
+    memcpy(next->data, buffer->data + length, filled - length);
+    filled -= length;
+    buffer->length = length;
+    spsc_ring_push(&pipeline->workers[nextWorker].input, buffer);
+    nextWorker = (nextWorker + 1) % workerCount;
+    buffer = next;
+    if (atEnd) {
+      break;
+    }
+  }
+  // The writer takes buffers in the same order, so it meets the first of
+  // these right after the last real buffer.
+  for (size_t w = 0; w != workerCount; ++w) {
+    spsc_ring_push(&pipeline->workers[(nextWorker + w) % workerCount].input, &endOfInput);
+  }
+  return NULL;
+}
+
+// Page-aligned, for the kernels and for the system. Buffers that may be
+// gifted to a pipe are mapped on their own, so that they can be unmapped.
+static char *allocate_buffer(const struct DespacePipelineOptions *options) {
+#if defined(__linux__)
+  if (options->spliceOutput) {
+    void *data = mmap(NULL, options->bufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return data != MAP_FAILED ? data : NULL;
+  }
+#endif
+  void *data = NULL;
+  return posix_memalign(&data, pageSize, options->bufferSize) == 0 ? data : NULL;
+}
+
+static void free_buffer(const struct DespacePipelineOptions *options, char *data) {
+#if defined(__linux__)
+  if (options->spliceOutput) {
+    if (data != NULL) {
+      munmap(data, options->bufferSize);
+    }
+    return;
+  }
+#endif
+  free(data);
+}
+
+static void *run_worker(void *context) {
+  struct Worker *worker = context;
+  for (;;) {
+    struct PipelineBuffer *buffer = spsc_ring_pop(&worker->input);
+    if (buffer != &endOfInput) {
+      buffer->length = despace_best(buffer->data, buffer->length);
+    }
+    spsc_ring_push(&worker->output, buffer);
+    if (buffer == &endOfInput) {
+      return NULL;
+    }
+  }
+}
+
+static int write_all(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    const ssize_t count = write(fd, data, length);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    data += count;
+    length -= (size_t)count;
+  }
+  return 0;
+}
+
+#if defined(__linux__)
+
+/*
+ Gifting a buffer's pages to a pipe with vmsplice saves copying the output
+ into the kernel, but the pages then belong to the pipe and whatever it
+ passes them on to: a reader that splices onwards can hold them long after
+ the pipe looks empty. So a gifted buffer is never written again. Its pages
+ are unmapped, which leaves the kernel's references alone, and it gets fresh
+ ones, which cost page faults as the reader fills them.
+ */
+
+// Returns 0 or an errno value, and how much was spliced in *done.
+static int splice_all(int fd, const char *data, size_t length, size_t *done) {
+  *done = 0;
+  while (*done < length) {
+    struct iovec iov = { (void *)(data + *done), length - *done };
+    const ssize_t count = vmsplice(fd, &iov, 1, SPLICE_F_GIFT);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    *done += (size_t)count;
+  }
+  return 0;
+}
+
+// Whether output can go through vmsplice; if so, makes the pipe hold a
+// whole buffer, so that one call can take it.
+static bool prepare_splice_output(struct Pipeline *pipeline) {
+  struct stat status;
+  if (!pipeline->options->spliceOutput || fstat(pipeline->outputFd, &status) != 0 || !S_ISFIFO(status.st_mode)) {
+    return false;
+  }
+  // Only a hint: unprivileged processes are limited by pipe-max-size.
+  fcntl(pipeline->outputFd, F_SETPIPE_SZ, (int)pipeline->options->bufferSize);
+  return true;
+}
+
+#endif // defined(__linux__)
+
+static void run_writer(struct Pipeline *pipeline, struct DespacePipelineStats *stats) {
+  const size_t workerCount = pipeline->options->workerCount;
+#if defined(__linux__)
+  bool splicing = prepare_splice_output(pipeline);
+#endif
+  for (size_t w = 0;; w = (w + 1) % workerCount) {
+    struct PipelineBuffer *buffer = spsc_ring_pop(&pipeline->workers[w].output);
+    if (buffer == &endOfInput) {
+      break;
+    }
+    // After a write error, keep draining so that nobody blocks.
+    if (atomic_load(&pipeline->writeError) == 0) {
+      int error = 0;
+      size_t done = 0;
+#if defined(__linux__)
+      if (splicing) {
+        error = splice_all(pipeline->outputFd, buffer->data, buffer->length, &done);
+        if (error == EINVAL || error == ENOSYS) {
+          // This pipe doesn't take spliced pages after all.
+          splicing = false;
+          error = 0;
+        }
+      }
+#endif
+      if (error == 0 && done < buffer->length) {
+        error = write_all(pipeline->outputFd, buffer->data + done, buffer->length - done);
+      }
+      if (error != 0) {
+        atomic_store(&pipeline->writeError, error);
+      }
+      stats->bytesOut += buffer->length;
+#if defined(__linux__)
+      if (done > 0) {
+        char *fresh = allocate_buffer(pipeline->options);
+        if (fresh == NULL) {
+          // The buffer can't be used again, so it stays out of the ring;
+          // the others are enough to drain what is in flight.
+          atomic_store(&pipeline->writeError, ENOMEM);
+          continue;
+        }
+        free_buffer(pipeline->options, buffer->data);
+        buffer->data = fresh;
+      }
+#endif
+    }
+    spsc_ring_push(&pipeline->freeBuffers, buffer);
+  }
+}
+
+int despace_pipeline(int inputFd, int outputFd, const struct DespacePipelineOptions *requested,
+                     struct DespacePipelineStats *stats) {
+  struct DespacePipelineOptions options = *requested;
+  if (options.workerCount == 0) {
+    options.workerCount = 1;
+  }
+  options.bufferSize -= options.bufferSize % blockSize;
+  if (options.bufferSize < blockSize) {
+    options.bufferSize = blockSize;
+  }
+  // The reader holds one buffer while it waits for the next, and every
+  // worker should have one to work on while another is written.
+  if (options.bufferCount < 2 * options.workerCount + 1) {
+    options.bufferCount = 2 * options.workerCount + 1;
+  }
+  stats->bytesIn = 0;
+  stats->bytesOut = 0;
+
+  struct Pipeline pipeline;
+  memset(&pipeline, 0, sizeof(pipeline));
+  pipeline.options = &options;
+  pipeline.inputFd = inputFd;
+  pipeline.outputFd = outputFd;
+  atomic_init(&pipeline.readError, 0);
+  atomic_init(&pipeline.writeError, 0);
+
+  int result = ENOMEM;
+  size_t allocatedBuffers = 0;
+  size_t startedWorkers = 0;
+  bool readerStarted = false;
+  pthread_t reader;
+  pipeline.buffers = calloc(options.bufferCount, sizeof(struct PipelineBuffer));
+  pipeline.workers = calloc(options.workerCount, sizeof(struct Worker));
+  if (!pipeline.buffers || !pipeline.workers || !spsc_ring_init(&pipeline.freeBuffers, options.bufferCount)) {
+    goto done;
+  }
+  for (; allocatedBuffers != options.bufferCount; ++allocatedBuffers) {
+    char *data = allocate_buffer(&options);
+    if (data == NULL) {
+      goto done;
+    }
+    pipeline.buffers[allocatedBuffers].data = data;
+    spsc_ring_push(&pipeline.freeBuffers, &pipeline.buffers[allocatedBuffers]);
+  }
+  for (size_t w = 0; w != options.workerCount; ++w) {
+    // Room for every buffer plus the end marker, so pushes never wait on a
+    // full ring.
+    if (!spsc_ring_init(&pipeline.workers[w].input, options.bufferCount + 1)
+        || !spsc_ring_init(&pipeline.workers[w].output, options.bufferCount + 1)) {
+      goto done;
+    }
+  }
+  for (; startedWorkers != options.workerCount; ++startedWorkers) {
+    struct Worker *worker = &pipeline.workers[startedWorkers];
+    if (pthread_create(&worker->thread, NULL, &run_worker, worker) != 0) {
+      result = EAGAIN;
+      goto done;
+    }
+  }
+#if defined(__linux__)
+  struct stat inputStatus;
+  if (fstat(inputFd, &inputStatus) == 0 && S_ISREG(inputStatus.st_mode)) {
+    posix_fadvise(inputFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+#endif
+  if (pthread_create(&reader, NULL, &run_reader, &pipeline) != 0) {
+    result = EAGAIN;
+    goto done;
+  }
+  readerStarted = true;
+
+  run_writer(&pipeline, stats);
+  result = atomic_load(&pipeline.readError);
+  if (result == 0) {
+    result = atomic_load(&pipeline.writeError);
+  }
+
+done:
+  if (readerStarted) {
+    pthread_join(reader, NULL);
+  } else {
+    // Stop any workers that did start.
+    for (size_t w = 0; w != startedWorkers; ++w) {
+      spsc_ring_push(&pipeline.workers[w].input, &endOfInput);
+    }
+  }
+  for (size_t w = 0; w != startedWorkers; ++w) {
+    pthread_join(pipeline.workers[w].thread, NULL);
+  }
+  if (pipeline.workers) {
+    for (size_t w = 0; w != options.workerCount; ++w) {
+      spsc_ring_destroy(&pipeline.workers[w].input);
+      spsc_ring_destroy(&pipeline.workers[w].output);
+    }
+  }
+  spsc_ring_destroy(&pipeline.freeBuffers);
+  for (size_t b = 0; b != allocatedBuffers; ++b) {
+    free_buffer(&options, pipeline.buffers[b].data);
+  }
+  free(pipeline.buffers);
+  free(pipeline.workers);
+  stats->bytesIn = pipeline.bytesIn;
+  return result;
+}
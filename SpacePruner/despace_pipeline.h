@@ -0,0 +1,48 @@
+//
+//  despace_pipeline.h
+//  SpacePruner
+//
+
+#ifndef despace_pipeline_h
+#define despace_pipeline_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct DespacePipelineOptions {
+  size_t bufferSize;    // bytes per buffer, rounded down to a multiple of 64
+  size_t bufferCount;   // buffers in flight, at least two per worker
+  size_t workerCount;   // despacing threads
+  bool spliceOutput;    // Linux: gift buffers to an output pipe with vmsplice and map fresh ones, rather than write()
+};
+
+struct DespacePipelineStats {
+  uint64_t bytesIn;
+  uint64_t bytesOut;
+};
+
+void despace_pipeline_default_options(struct DespacePipelineOptions *options);
+
+/*
+ Copies inputFd to outputFd without whitespace, like a filter. A reader
+ thread, the workers and the calling thread, which writes, pass buffers
+ through lock-free single-producer, single-consumer rings, so reading,
+ despacing and writing overlap. Each worker has its own pair of rings and
+ gets buffers in turn, so the output stays in order.
+
+ The reader only hands on whole 64-byte blocks and carries the rest over to
+ the next buffer, so the kernels' scalar tails only run at the end of the
+ input.
+
+ Input is read with read(), which is the one copy that can't be avoided:
+ splice only moves data between descriptors and pipes, never into the
+ buffers the kernels work on. Regular files are read with a sequential
+ access hint.
+
+ Returns 0, or an errno value if reading, writing or allocating failed.
+ */
+int despace_pipeline(int inputFd, int outputFd, const struct DespacePipelineOptions *options,
+                     struct DespacePipelineStats *stats);
+
+#endif /* despace_pipeline_h */
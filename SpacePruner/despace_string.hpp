@@ -0,0 +1,129 @@
+//
+//  despace_string.hpp
+//  SpacePruner
+//
+//  C++ front-end to the kernels, for callers that would otherwise write
+//  erase(remove_if(...)) and despace a byte at a time.
+//
+
+#ifndef despace_string_hpp
+#define despace_string_hpp
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#if defined(__has_include)
+#if __has_include(<version>)
+#include <version>
+#endif
+#endif
+#if defined(__cpp_lib_string_view)
+#include <string_view>
+#endif
+#if defined(__cpp_lib_span)
+#include <span>
+#endif
+
+extern "C" {
+#include "best_despacer.h"
+#include "despace_counter.h"
+#include "nontemporal_despacer.h"
+#include "parallel_despacer.h"
+}
+
+// Inputs at least this large are split among threads, which despace_parallel
+// only does from 4 MB a thread.
+#ifndef DESPACE_PARALLEL_THRESHOLD
+#define DESPACE_PARALLEL_THRESHOLD (8 * 1024 * 1024)
+#endif
+
+// Inputs up to this large are despaced into a buffer on the stack and then
+// copied out, which for short strings is cheaper than counting first or
+// aligning in place.
+#ifndef DESPACE_STACK_THRESHOLD
+#define DESPACE_STACK_THRESHOLD 1024
+#endif
+
+namespace spacepruner {
+
+namespace detail {
+
+// Short inputs are copied to the stack and back, since the best kernel may
+// first go a byte at a time to align its stores.
+inline std::size_t despace_in_place(char *bytes, std::size_t howmany) {
+  if (howmany <= DESPACE_STACK_THRESHOLD) {
+    char buffer[DESPACE_STACK_THRESHOLD];
+    const std::size_t kept = despace_to_cached(buffer, bytes, howmany);
+    std::memcpy(bytes, buffer, kept);
+    return kept;
+  }
+  if (howmany >= DESPACE_PARALLEL_THRESHOLD) {
+    return despace_parallel(bytes, howmany, 0);
+  }
+  return despace_best(bytes, howmany);
+}
+
+/*
+ The despaced copy goes straight into a string sized from a count of the
+ kept bytes, plus the few the kernel may store past them, so there is one
+ allocation and nothing left over but that slack. Without
+ resize_and_overwrite the string is zeroed first.
+ */
+inline std::string despaced_copy(const char *bytes, std::size_t howmany) {
+  if (howmany <= DESPACE_STACK_THRESHOLD) {
+    char buffer[DESPACE_STACK_THRESHOLD];
+    return std::string(buffer, despace_to_cached(buffer, bytes, howmany));
+  }
+  const std::size_t kept = howmany >= DESPACE_PARALLEL_THRESHOLD ? despace_count_parallel(bytes, howmany, 0)
+                                                                 : despace_count(bytes, howmany);
+  std::string result;
+#if defined(__cpp_lib_string_resize_and_overwrite)
+  result.resize_and_overwrite(kept + DESPACE_TO_SLACK, [bytes, howmany](char *dest, std::size_t) {
+    return despace_to(dest, bytes, howmany);
+  });
+#else
+  result.resize(kept + DESPACE_TO_SLACK);
+  result.resize(despace_to(&result[0], bytes, howmany));
+#endif
+  return result;
+}
+
+}  // namespace detail
+
+// Removes whitespace (every byte up to 32) from text in place.
+inline void despace(std::string &text) {
+  if (!text.empty()) {
+    text.resize(detail::despace_in_place(&text[0], text.size()));
+  }
+}
+
+// A copy of text without whitespace.
+#if defined(__cpp_lib_string_view)
+inline std::string despaced(std::string_view text) {
+  return detail::despaced_copy(text.data(), text.size());
+}
+#else
+inline std::string despaced(const std::string &text) {
+  return detail::despaced_copy(text.data(), text.size());
+}
+
+inline std::string despaced(const char *text) {
+  return detail::despaced_copy(text, std::char_traits<char>::length(text));
+}
+#endif
+
+inline std::string despaced(const char *bytes, std::size_t howmany) {
+  return detail::despaced_copy(bytes, howmany);
+}
+
+#if defined(__cpp_lib_span)
+// Despaces bytes in place and returns the part of it that is left.
+inline std::span<char> despace(std::span<char> bytes) {
+  return bytes.first(detail::despace_in_place(bytes.data(), bytes.size()));
+}
+#endif
+
+}  // namespace spacepruner
+
+#endif /* despace_string_hpp */
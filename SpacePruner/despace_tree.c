@@ -0,0 +1,607 @@
+//
+//  despace_tree.c
+//  SpacePruner
+//
+
+// For nftw's FTW_PHYS.
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include "despace_tree.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "benchmark_timing.h"
+#include "best_despacer.h"
+#include "nontemporal_despacer.h"
+
+enum { maxThreadCount = 64 };
+
+void despace_tree_default_options(struct DespaceTreeOptions *options) {
+  memset(options, 0, sizeof(*options));
+  options->pieceSize = 8 * 1024 * 1024;
+  options->byteBudget = 256 * 1024 * 1024;
+}
+
+struct TreeFile {
+  char *path;
+  char *outputPath;  // NULL in place
+  dev_t device;
+  ino_t inode;
+  uint64_t size;
+  uint64_t charge;   // what it counts against the budget
+  int inputFd;
+  int outputFd;
+  const char *source;
+  char *dest;
+  size_t pieceCount;
+  size_t *kept;
+  atomic_size_t piecesLeft;
+  uint64_t start;
+  uint64_t latency;
+  bool done;
+};
+
+struct TreeTask {
+  struct TreeFile *file;
+  size_t piece;
+};
+
+// Owners take from the front and thieves from the back. All deques share
+// the pool's lock: a task is a whole file or a piece of several megabytes,
+// so it's never contended for long.
+struct TaskDeque {
+  struct TreeTask *tasks;
+  size_t head;
+  size_t tail;
+};
+
+struct TreePool {
+  const struct DespaceTreeOptions *options;
+  struct DespaceTreeStats *stats;
+  size_t threadCount;
+  struct TaskDeque files[maxThreadCount];   // not started yet, largest first
+  struct TaskDeque pieces[maxThreadCount];  // pieces of started files
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  size_t filesLeft;
+  uint64_t bytesInFlight;
+  int error;
+};
+
+struct TreeWorker {
+  pthread_t thread;
+  struct TreePool *pool;
+  size_t index;
+};
+
+// nftw has no context argument.
+struct TreeWalk {
+  const char *outputRoot;
+  size_t rootLength;
+  struct TreeFile *files;
+  size_t count;
+  size_t capacity;
+  int error;
+  struct DespaceTreeStats *stats;
+};
+
+static struct TreeWalk *currentWalk;
+
+static void record_error(int error, const char *path, int *firstError, struct DespaceTreeStats *stats) {
+  if (*firstError == 0) {
+    *firstError = error;
+    snprintf(stats->failedPath, sizeof(stats->failedPath), "%s", path);
+  }
+}
+
+static char *path_under(const char *outputRoot, const char *relative) {
+  const size_t length = strlen(outputRoot) + strlen(relative) + 1;
+  char *result = malloc(length);
+  if (result) {
+    snprintf(result, length, "%s%s", outputRoot, relative);
+  }
+  return result;
+}
+
+/*
+ The output root is created here, as the walk would first thing, so that it
+ can be resolved. Returns EINVAL if it is root or inside it: files would be
+ truncated before they were read, or the walk would go on into its own
+ output.
+ */
+static int check_output_root(const char *root, const char *outputRoot) {
+  const bool created = mkdir(outputRoot, 0777) == 0;
+  if (!created && errno != EEXIST) {
+    return errno;
+  }
+  char *input = realpath(root, NULL);
+  char *output = input ? realpath(outputRoot, NULL) : NULL;
+  int error = output ? 0 : errno;
+  if (output) {
+    const size_t length = strlen(input);
+    if (strncmp(output, input, length) == 0 && (output[length] == '\0' || output[length] == '/' || length == 1)) {
+      error = EINVAL;
+    }
+  }
+  if (error != 0 && created) {
+    rmdir(outputRoot);
+  }
+  free(input);
+  free(output);
+  return error;
+}
+
+static int visit(const char *path, const struct stat *status, int type, struct FTW *position) {
+  (void)position;
+  struct TreeWalk *walk = currentWalk;
+  const char *relative = path + walk->rootLength;
+  if (type == FTW_DNR || type == FTW_NS) {
+    record_error(EACCES, path, &walk->error, walk->stats);
+    return 1;
+  }
+  if (type == FTW_D && walk->outputRoot) {
+    char *directory = path_under(walk->outputRoot, relative);
+    if (!directory || (mkdir(directory, 0777) != 0 && errno != EEXIST)) {
+      record_error(directory ? errno : ENOMEM, directory ? directory : path, &walk->error, walk->stats);
+      free(directory);
+      return 1;
+    }
+    free(directory);
+    return 0;
+  }
+  if (type != FTW_F || !S_ISREG(status->st_mode)) {
+    return 0;
+  }
+  if (walk->count == walk->capacity) {
+    const size_t capacity = walk->capacity > 0 ? 2 * walk->capacity : 256;
+    struct TreeFile *files = realloc(walk->files, capacity * sizeof(struct TreeFile));
+    if (!files) {
+      record_error(ENOMEM, path, &walk->error, walk->stats);
+      return 1;
+    }
+    walk->files = files;
+    walk->capacity = capacity;
+  }
+  struct TreeFile *file = &walk->files[walk->count];
+  memset(file, 0, sizeof(*file));
+  file->path = strdup(path);
+  file->outputPath = walk->outputRoot ? path_under(walk->outputRoot, relative) : NULL;
+  file->device = status->st_dev;
+  file->inode = status->st_ino;
+  file->size = (uint64_t)status->st_size;
+  file->inputFd = file->outputFd = -1;
+  if (!file->path || (walk->outputRoot && !file->outputPath)) {
+    free(file->path);
+    free(file->outputPath);
+    record_error(ENOMEM, path, &walk->error, walk->stats);
+    return 1;
+  }
+  ++walk->count;
+  return 0;
+}
+
+static int by_inode(const void *a, const void *b) {
+  const struct TreeFile *fileA = a;
+  const struct TreeFile *fileB = b;
+  if (fileA->device != fileB->device) {
+    return fileA->device < fileB->device ? -1 : 1;
+  }
+  return fileA->inode < fileB->inode ? -1 : fileA->inode > fileB->inode ? 1 : 0;
+}
+
+/*
+ In place, the hard links to a file are one file: despacing it through two
+ of them at once would have one thread truncate it while another still has
+ it mapped. Keeps the first link to each and returns how many are left.
+ */
+static size_t drop_extra_links(struct TreeFile *files, size_t count) {
+  qsort(files, count, sizeof(struct TreeFile), by_inode);
+  size_t kept = 0;
+  for (size_t f = 0; f != count; ++f) {
+    if (kept > 0 && by_inode(&files[kept - 1], &files[f]) == 0) {
+      free(files[f].path);
+      continue;
+    }
+    files[kept++] = files[f];
+  }
+  return kept;
+}
+
+static int larger_first(const void *a, const void *b) {
+  const uint64_t sizeA = ((const struct TreeFile *)a)->size;
+  const uint64_t sizeB = ((const struct TreeFile *)b)->size;
+  return sizeA < sizeB ? 1 : sizeA > sizeB ? -1 : 0;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+  const uint64_t latencyA = *(const uint64_t *)a;
+  const uint64_t latencyB = *(const uint64_t *)b;
+  return latencyA < latencyB ? -1 : latencyA > latencyB ? 1 : 0;
+}
+
+static size_t choose_thread_count(size_t threadCount) {
+  if (threadCount == 0) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threadCount = cpus > 0 ? (size_t)cpus : 1;
+  }
+  if (threadCount > maxThreadCount) {
+    threadCount = maxThreadCount;
+  }
+  return threadCount;
+}
+
+// Moves the pieces together, truncates the output and lets the file go.
+// An error is put down to failedAt.
+static void finish_file(struct TreePool *pool, struct TreeFile *file, int error, const char *failedAt) {
+  size_t pos = 0;
+  if (file->dest) {
+    const size_t pieceSize = pool->options->pieceSize;
+    pos = file->kept[0];
+    for (size_t p = 1; p != file->pieceCount; ++p) {
+      memmove(file->dest + pos, file->dest + p * pieceSize, file->kept[p]);
+      pos += file->kept[p];
+    }
+    munmap(file->dest, (size_t)file->size);
+    if (file->source != file->dest) {
+      munmap((void *)file->source, (size_t)file->size);
+    }
+    // Unmapping writes the pages back; truncating drops what's past the result.
+    const int outputFd = file->outputPath ? file->outputFd : file->inputFd;
+    if (error == 0 && ftruncate(outputFd, (off_t)pos) != 0) {
+      error = errno;
+      failedAt = file->outputPath ? file->outputPath : file->path;
+    }
+  }
+  if (file->inputFd >= 0) {
+    close(file->inputFd);
+  }
+  if (file->outputFd >= 0) {
+    close(file->outputFd);
+  }
+  free(file->kept);
+  file->latency = time_in_ns() - file->start;
+  file->done = error == 0;
+  if (error == 0 && pool->options->fileDone) {
+    pool->options->fileDone(file->path, file->size, pos, file->latency, pool->options->context);
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  if (error != 0) {
+    record_error(error, failedAt, &pool->error, pool->stats);
+  } else {
+    ++pool->stats->files;
+    pool->stats->bytesIn += file->size;
+    pool->stats->bytesOut += pos;
+  }
+  pool->bytesInFlight -= file->charge;
+  --pool->filesLeft;
+  pthread_cond_broadcast(&pool->changed);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void run_piece(struct TreePool *pool, struct TreeFile *file, size_t piece) {
+  const size_t pieceSize = pool->options->pieceSize;
+  const size_t offset = piece * pieceSize;
+  const size_t length = (size_t)file->size - offset < pieceSize ? (size_t)file->size - offset : pieceSize;
+  if (file->source == file->dest) {
+    file->kept[piece] = despace_best(file->dest + offset, length);
+  } else {
+    file->kept[piece] = despace_to(file->dest + offset, file->source + offset, length);
+  }
+  if (atomic_fetch_sub(&file->piecesLeft, 1) == 1) {
+    finish_file(pool, file, 0, NULL);
+  }
+}
+
+// Maps the file. Returns 0, or an errno value after finishing the file.
+static int start_file(struct TreePool *pool, struct TreeFile *file) {
+  file->start = time_in_ns();
+  const bool inPlace = file->outputPath == NULL;
+  file->inputFd = open(file->path, inPlace ? O_RDWR : O_RDONLY);
+  if (file->inputFd < 0) {
+    const int error = errno;
+    finish_file(pool, file, error, file->path);
+    return error;
+  }
+  if (!inPlace) {
+    file->outputFd = open(file->outputPath, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (file->outputFd < 0) {
+      const int error = errno;
+      finish_file(pool, file, error, file->outputPath);
+      return error;
+    }
+  }
+  struct stat status;
+  if (fstat(file->inputFd, &status) != 0) {
+    const int error = errno;
+    finish_file(pool, file, error, file->path);
+    return error;
+  }
+  if ((uint64_t)status.st_size != file->size) {
+    // It changed since the walk, and its charge and pieces with it.
+    finish_file(pool, file, EAGAIN, file->path);
+    return EAGAIN;
+  }
+  if (file->size == 0) {
+    finish_file(pool, file, 0, NULL);
+    return 0;
+  }
+
+  const size_t length = (size_t)file->size;
+  if (!inPlace && ftruncate(file->outputFd, (off_t)length) != 0) {
+    const int error = errno;
+    finish_file(pool, file, error, file->outputPath);
+    return error;
+  }
+  void *source = mmap(NULL, length, inPlace ? PROT_READ | PROT_WRITE : PROT_READ,
+                      inPlace ? MAP_SHARED : MAP_PRIVATE, file->inputFd, 0);
+  void *dest = source;
+  if (source != MAP_FAILED && !inPlace) {
+    dest = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, file->outputFd, 0);
+    if (dest == MAP_FAILED) {
+      munmap(source, length);
+    }
+  }
+  file->pieceCount = (length + pool->options->pieceSize - 1) / pool->options->pieceSize;
+  file->kept = calloc(file->pieceCount, sizeof(size_t));
+  if (source == MAP_FAILED || dest == MAP_FAILED || !file->kept) {
+    const int error = file->kept ? errno : ENOMEM;
+    if (source != MAP_FAILED && dest != MAP_FAILED) {
+      munmap(source, length);
+      if (!inPlace) {
+        munmap(dest, length);
+      }
+    }
+    finish_file(pool, file, error, file->path);
+    return error;
+  }
+  madvise(source, length, MADV_SEQUENTIAL);
+  if (!inPlace) {
+    madvise(dest, length, MADV_SEQUENTIAL);
+  }
+  file->source = source;
+  file->dest = dest;
+  atomic_init(&file->piecesLeft, file->pieceCount);
+  return 0;
+}
+
+// The next piece of a started file: our own first, then anyone's.
+static bool take_piece(struct TreePool *pool, size_t index, struct TreeTask *task) {
+  struct TaskDeque *own = &pool->pieces[index];
+  if (own->head != own->tail) {
+    *task = own->tasks[own->head++];
+    return true;
+  }
+  for (size_t i = 1; i != pool->threadCount; ++i) {
+    struct TaskDeque *victim = &pool->pieces[(index + i) % pool->threadCount];
+    if (victim->head != victim->tail) {
+      *task = victim->tasks[--victim->tail];
+      return true;
+    }
+  }
+  return false;
+}
+
+enum TakeResult { TAKE_NOTHING, TAKE_FILE, TAKE_OVER_BUDGET };
+
+// The largest of our own files, or else the smallest of someone else's,
+// which is the least likely to leave one thread working at the end.
+static enum TakeResult take_file(struct TreePool *pool, size_t index, struct TreeTask *task) {
+  struct TaskDeque *deque = &pool->files[index];
+  bool front = true;
+  for (size_t i = 0; deque->head == deque->tail; ++i) {
+    if (i + 1 == pool->threadCount) {
+      return TAKE_NOTHING;
+    }
+    deque = &pool->files[(index + i + 1) % pool->threadCount];
+    front = false;
+  }
+  struct TreeFile *file = (front ? deque->tasks[deque->head] : deque->tasks[deque->tail - 1]).file;
+  if (pool->error == 0) {
+    const uint64_t budget = pool->options->byteBudget;
+    file->charge = file->size < budget ? file->size : budget;
+    if (pool->bytesInFlight > 0 && pool->bytesInFlight + file->charge > budget) {
+      return TAKE_OVER_BUDGET;
+    }
+    pool->bytesInFlight += file->charge;
+  }
+  *task = front ? deque->tasks[deque->head++] : deque->tasks[--deque->tail];
+  return TAKE_FILE;
+}
+
+static void *run_tree_worker(void *context) {
+  struct TreeWorker *worker = context;
+  struct TreePool *pool = worker->pool;
+  pthread_mutex_lock(&pool->lock);
+  while (pool->filesLeft > 0) {
+    struct TreeTask task;
+    if (take_piece(pool, worker->index, &task)) {
+      pthread_mutex_unlock(&pool->lock);
+      run_piece(pool, task.file, task.piece);
+      pthread_mutex_lock(&pool->lock);
+      continue;
+    }
+    const enum TakeResult taken = take_file(pool, worker->index, &task);
+    if (taken != TAKE_FILE) {
+      // Until a file finishes or some pieces show up.
+      pthread_cond_wait(&pool->changed, &pool->lock);
+      continue;
+    }
+    if (pool->error != 0) {
+      // Leave the rest alone.
+      if (--pool->filesLeft == 0) {
+        pthread_cond_broadcast(&pool->changed);
+      }
+      continue;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    struct TreeFile *file = task.file;
+    const bool started = start_file(pool, file) == 0 && file->size > 0;
+    pthread_mutex_lock(&pool->lock);
+    if (!started) {
+      continue;
+    }
+    // Our piece deque is empty, or we'd have taken from it.
+    if (file->pieceCount > 1) {
+      struct TaskDeque *pieces = &pool->pieces[worker->index];
+      pieces->head = pieces->tail = 0;
+      for (size_t p = 1; p != file->pieceCount; ++p) {
+        pieces->tasks[pieces->tail++] = (struct TreeTask){ file, p };
+      }
+      pthread_cond_broadcast(&pool->changed);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    run_piece(pool, file, 0);
+    pthread_mutex_lock(&pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+static int run_pool(struct TreePool *pool, struct TreeFile *files, size_t count) {
+  size_t maxPieces = 1;
+  for (size_t f = 0; f != count; ++f) {
+    const size_t pieces = (size_t)((files[f].size + pool->options->pieceSize - 1) / pool->options->pieceSize);
+    if (pieces > maxPieces) {
+      maxPieces = pieces;
+    }
+  }
+  int result = 0;
+  size_t t = 0;
+  for (; t != pool->threadCount; ++t) {
+    pool->files[t].tasks = malloc((count / pool->threadCount + 1) * sizeof(struct TreeTask));
+    pool->pieces[t].tasks = malloc(maxPieces * sizeof(struct TreeTask));
+    if (!pool->files[t].tasks || !pool->pieces[t].tasks) {
+      result = ENOMEM;
+      ++t;
+      goto done;
+    }
+  }
+  // Dealt in turn, so every thread starts with its share of the large ones.
+  for (size_t f = 0; f != count; ++f) {
+    struct TaskDeque *deque = &pool->files[f % pool->threadCount];
+    deque->tasks[deque->tail++] = (struct TreeTask){ &files[f], 0 };
+  }
+  pool->filesLeft = count;
+
+  struct TreeWorker workers[maxThreadCount];
+  bool started[maxThreadCount];
+  for (size_t w = 0; w != pool->threadCount; ++w) {
+    workers[w].pool = pool;
+    workers[w].index = w;
+  }
+  // The calling thread is worker 0. Any that don't start just leave their
+  // files to be stolen.
+  for (size_t w = 1; w != pool->threadCount; ++w) {
+    started[w] = pthread_create(&workers[w].thread, NULL, &run_tree_worker, &workers[w]) == 0;
+  }
+  run_tree_worker(&workers[0]);
+  for (size_t w = 1; w != pool->threadCount; ++w) {
+    if (started[w]) {
+      pthread_join(workers[w].thread, NULL);
+    }
+  }
+  result = pool->error;
+
+done:
+  while (t-- > 0) {
+    free(pool->files[t].tasks);
+    free(pool->pieces[t].tasks);
+  }
+  return result;
+}
+
+static void measure_latencies(const struct TreeFile *files, size_t count, struct DespaceTreeStats *stats) {
+  uint64_t *latencies = malloc((count > 0 ? count : 1) * sizeof(uint64_t));
+  if (!latencies) {
+    return;
+  }
+  size_t done = 0;
+  for (size_t f = 0; f != count; ++f) {
+    if (files[f].done) {
+      latencies[done++] = files[f].latency;
+    }
+  }
+  if (done > 0) {
+    qsort(latencies, done, sizeof(uint64_t), compare_latencies);
+    stats->medianLatency = latencies[done / 2];
+    stats->p99Latency = latencies[(done * 99) / 100];
+    stats->maxLatency = latencies[done - 1];
+  }
+  free(latencies);
+}
+
+int despace_tree(const char *root, const struct DespaceTreeOptions *requested, struct DespaceTreeStats *stats) {
+  struct DespaceTreeOptions options = *requested;
+  options.pieceSize -= options.pieceSize % 64;
+  if (options.pieceSize < 64 * 1024) {
+    options.pieceSize = 64 * 1024;
+  }
+  if (options.byteBudget == 0) {
+    options.byteBudget = 1;
+  }
+  memset(stats, 0, sizeof(*stats));
+  if (options.outputRoot) {
+    const int error = check_output_root(root, options.outputRoot);
+    if (error != 0) {
+      snprintf(stats->failedPath, sizeof(stats->failedPath), "%s", options.outputRoot);
+      return error;
+    }
+  }
+
+  // nftw joins names with a slash of its own.
+  size_t rootLength = strlen(root);
+  while (rootLength > 1 && root[rootLength - 1] == '/') {
+    --rootLength;
+  }
+  char *trimmedRoot = strndup(root, rootLength);
+  if (!trimmedRoot) {
+    return ENOMEM;
+  }
+  struct TreeWalk walk = { options.outputRoot, rootLength, NULL, 0, 0, 0, stats };
+  currentWalk = &walk;
+  if (nftw(trimmedRoot, &visit, 32, FTW_PHYS) != 0 && walk.error == 0) {
+    record_error(errno, trimmedRoot, &walk.error, stats);
+  }
+  currentWalk = NULL;
+  free(trimmedRoot);
+
+  int result = walk.error;
+  if (result == 0) {
+    if (!options.outputRoot) {
+      walk.count = drop_extra_links(walk.files, walk.count);
+    }
+    qsort(walk.files, walk.count, sizeof(struct TreeFile), larger_first);
+    struct TreePool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.options = &options;
+    pool.stats = stats;
+    pool.threadCount = choose_thread_count(options.threadCount);
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.changed, NULL);
+    result = run_pool(&pool, walk.files, walk.count);
+    pthread_cond_destroy(&pool.changed);
+    pthread_mutex_destroy(&pool.lock);
+    measure_latencies(walk.files, walk.count, stats);
+  }
+
+  for (size_t f = 0; f != walk.count; ++f) {
+    free(walk.files[f].path);
+    free(walk.files[f].outputPath);
+  }
+  free(walk.files);
+  return result;
+}
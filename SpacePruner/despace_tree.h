@@ -0,0 +1,52 @@
+//
+//  despace_tree.h
+//  SpacePruner
+//
+
+#ifndef despace_tree_h
+#define despace_tree_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct DespaceTreeOptions {
+  const char *outputRoot;  // mirror the tree here, or NULL to despace in place
+  size_t threadCount;      // 0 for one per CPU
+  size_t pieceSize;        // larger files are split into pieces of this size
+  size_t byteBudget;       // bytes of files mapped at once; a larger file runs on its own
+  // Called from the worker threads as each file is done, if set.
+  void (*fileDone)(const char *path, uint64_t before, uint64_t after, uint64_t nanoseconds, void *context);
+  void *context;
+};
+
+struct DespaceTreeStats {
+  uint64_t files;
+  uint64_t bytesIn;
+  uint64_t bytesOut;
+  uint64_t medianLatency;  // nanoseconds from mapping a file to truncating it
+  uint64_t p99Latency;
+  uint64_t maxLatency;
+  char failedPath[4096];   // the file or directory behind an error
+};
+
+void despace_tree_default_options(struct DespaceTreeOptions *options);
+
+/*
+ Despaces every regular file under root, without following symbolic links.
+ In place, a file with several hard links under root is despaced once.
+ The files are sorted by size and dealt out, largest first, to per-thread
+ deques; a thread that runs out steals from the others. A file larger than
+ pieceSize is split into pieces that go on its thread's piece deque, where
+ idle threads steal them too, and whoever finishes the last piece moves them
+ together and truncates the file.
+
+ A file only starts while the bytes of the files in flight stay within
+ byteBudget, so memory is bounded however large the tree is.
+
+ Returns 0, or the first errno value met, in which case failedPath says
+ where; files that weren't started by then are left alone. An outputRoot
+ that is root or inside it is refused with EINVAL before anything is read.
+ */
+int despace_tree(const char *root, const struct DespaceTreeOptions *options, struct DespaceTreeStats *stats);
+
+#endif /* despace_tree_h */
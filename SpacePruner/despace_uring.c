@@ -0,0 +1,627 @@
+//
+//  despace_uring.c
+//  SpacePruner
+//
+
+#include "despace_uring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define DESPACE_HAS_URING 1
+#endif
+#endif
+
+void despace_uring_default_options(struct DespaceUringOptions *options) {
+  options->bufferSize = 1024 * 1024;
+  options->queueDepth = 16;
+  options->workerCount = 1;
+}
+
+#if DESPACE_HAS_URING
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "best_despacer.h"
+#include "spsc_ring.h"
+
+static const size_t blockSize = 64;
+static const size_t pageSize = 4096;
+
+// The submission and completion rings, shared with the kernel.
+struct Uring {
+  int fd;
+  unsigned entries;
+  unsigned *sqHead;
+  unsigned *sqTail;
+  unsigned *sqMask;
+  unsigned *sqArray;
+  struct io_uring_sqe *sqes;
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned *cqMask;
+  struct io_uring_cqe *cqes;
+  void *sqRing;
+  void *cqRing;
+  size_t sqRingSize;
+  size_t cqRingSize;
+  size_t sqesSize;
+  unsigned unsubmitted;
+};
+
+static int uring_setup(struct Uring *ring, unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0) {
+    return errno;
+  }
+  ring->entries = params.sq_entries;
+  ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMap && ring->cqRingSize > ring->sqRingSize) {
+    ring->sqRingSize = ring->cqRingSize;
+  }
+  ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sqRing == MAP_FAILED) {
+    const int error = errno;
+    close(ring->fd);
+    return error;
+  }
+  ring->cqRing = singleMap ? ring->sqRing
+      : mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             ring->fd, IORING_OFF_CQ_RING);
+  ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring->fd, IORING_OFF_SQES);
+  if (ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+    const int error = errno;
+    if (ring->cqRing != MAP_FAILED && !singleMap) {
+      munmap(ring->cqRing, ring->cqRingSize);
+    }
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+    return error;
+  }
+  char *sq = ring->sqRing;
+  char *cq = ring->cqRing;
+  ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+  ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+  ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+  ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  return 0;
+}
+
+static void uring_destroy(struct Uring *ring) {
+  munmap(ring->sqes, ring->sqesSize);
+  if (ring->cqRing != ring->sqRing) {
+    munmap(ring->cqRing, ring->cqRingSize);
+  }
+  munmap(ring->sqRing, ring->sqRingSize);
+  close(ring->fd);
+}
+
+static int uring_register(struct Uring *ring, unsigned opcode, const void *arg, unsigned count) {
+  return syscall(__NR_io_uring_register, ring->fd, opcode, arg, count) < 0 ? errno : 0;
+}
+
+// Only this thread writes the tail, and the kernel only the head.
+static struct io_uring_sqe *uring_get_sqe(struct Uring *ring) {
+  const unsigned tail = *ring->sqTail;
+  const unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+  if (tail - head >= ring->entries) {
+    return NULL;
+  }
+  const unsigned index = tail & *ring->sqMask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sqArray[index] = index;
+  return sqe;
+}
+
+static void uring_commit_sqe(struct Uring *ring) {
+  __atomic_store_n(ring->sqTail, *ring->sqTail + 1, __ATOMIC_RELEASE);
+  ++ring->unsubmitted;
+}
+
+static int uring_submit(struct Uring *ring, unsigned waitFor) {
+  for (;;) {
+    const long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted, waitFor,
+                                   waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (submitted >= 0) {
+      ring->unsubmitted -= (unsigned)submitted;
+      return 0;
+    }
+    if (errno != EINTR) {
+      return errno;
+    }
+  }
+}
+
+static bool uring_pop_cqe(struct Uring *ring, struct io_uring_cqe *cqe) {
+  const unsigned head = *ring->cqHead;
+  if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  *cqe = ring->cqes[head & *ring->cqMask];
+  __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+struct UringFile {
+  int inputFd;
+  int outputFd;
+  int slot;                // its two fixed-file slots are 2 * slot and 2 * slot + 1
+  uint64_t size;
+  size_t chunkCount;
+  size_t chunksRead;       // reads issued
+  size_t nextWriteChunk;   // output must be written in order
+  size_t chunksDone;
+  uint64_t outputOffset;
+};
+
+enum BufferState { BUFFER_FREE, BUFFER_READING, BUFFER_DESPACING, BUFFER_DESPACED, BUFFER_WRITING };
+
+struct UringBuffer {
+  char *data;
+  unsigned index;
+  enum BufferState state;
+  struct UringFile *file;
+  size_t chunk;
+  uint64_t inputOffset;
+  size_t length;   // bytes to read
+  size_t filled;   // bytes read so far
+  size_t kept;     // bytes after despacing
+  size_t written;  // bytes written so far
+  uint64_t outputOffset;
+};
+
+struct UringWorker {
+  pthread_t thread;
+  struct SpscRing input;
+  struct SpscRing output;
+};
+
+// Sent to each worker to stop it.
+static struct UringBuffer stopWorker;
+
+static void *run_uring_worker(void *context) {
+  struct UringWorker *worker = context;
+  for (;;) {
+    struct UringBuffer *buffer = spsc_ring_pop(&worker->input);
+    if (buffer == &stopWorker) {
+      return NULL;
+    }
+    buffer->kept = despace_best(buffer->data, buffer->filled);
+    spsc_ring_push(&worker->output, buffer);
+  }
+}
+
+struct UringEngine {
+  const struct DespaceUringOptions *options;
+  struct DespaceUringStats *stats;
+  struct Uring ring;
+  const char *const *inputs;
+  const char *const *outputs;
+  size_t fileCount;
+  struct UringFile *files;
+  size_t filesOpened;
+  size_t filesDone;
+  size_t readingFile;      // the file whose chunks are being read, or fileCount
+  int *freeSlots;
+  size_t freeSlotCount;
+  struct UringBuffer *buffers;
+  struct UringWorker *workers;
+  size_t nextWorker;
+  size_t despacing;        // buffers with the workers
+  size_t inFlight;         // reads and writes the kernel has
+  int error;
+};
+
+static void set_error(struct UringEngine *engine, int error) {
+  if (engine->error == 0) {
+    engine->error = error;
+  }
+}
+
+static void update_slots(struct UringEngine *engine, struct UringFile *file, int inputFd, int outputFd) {
+  if (!engine->stats->fixedFiles) {
+    return;
+  }
+  int fds[2] = { inputFd, outputFd };
+  struct io_uring_files_update update;
+  memset(&update, 0, sizeof(update));
+  update.offset = (unsigned)(2 * file->slot);
+  update.fds = (uint64_t)(uintptr_t)fds;
+  if (uring_register(&engine->ring, IORING_REGISTER_FILES_UPDATE, &update, 2) != 0) {
+    set_error(engine, errno);
+  }
+}
+
+static void close_file(struct UringEngine *engine, struct UringFile *file) {
+  if (file->slot >= 0) {
+    update_slots(engine, file, -1, -1);
+    engine->freeSlots[engine->freeSlotCount++] = file->slot;
+    file->slot = -1;
+  }
+  close(file->inputFd);
+  close(file->outputFd);
+  file->inputFd = file->outputFd = -1;
+  ++engine->filesDone;
+  ++engine->stats->files;
+}
+
+// Opens the next input and its output, and makes it the one being read.
+// Returns false if there is none or there's no slot for it yet.
+static bool open_next_file(struct UringEngine *engine) {
+  while (engine->filesOpened < engine->fileCount && engine->freeSlotCount > 0 && engine->error == 0) {
+    const size_t index = engine->filesOpened++;
+    struct UringFile *file = &engine->files[index];
+    file->slot = -1;
+    file->outputFd = -1;
+    file->inputFd = open(engine->inputs[index], O_RDONLY);
+    if (file->inputFd < 0) {
+      set_error(engine, errno);
+      return false;
+    }
+    struct stat status;
+    if (fstat(file->inputFd, &status) != 0) {
+      set_error(engine, errno);
+      return false;
+    }
+    file->outputFd = open(engine->outputs[index], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (file->outputFd < 0) {
+      set_error(engine, errno);
+      return false;
+    }
+    file->size = (uint64_t)status.st_size;
+    file->chunkCount = (size_t)((file->size + engine->options->bufferSize - 1) / engine->options->bufferSize);
+    if (file->chunkCount == 0) {
+      close_file(engine, file);
+      continue;
+    }
+    file->slot = engine->freeSlots[--engine->freeSlotCount];
+    update_slots(engine, file, file->inputFd, file->outputFd);
+    engine->readingFile = index;
+    return true;
+  }
+  return false;
+}
+
+static void prepare_io(struct UringEngine *engine, struct io_uring_sqe *sqe, struct UringBuffer *buffer,
+                       bool write, int fd, int slot, char *address, size_t length, uint64_t offset) {
+  const bool registered = engine->stats->registeredBuffers;
+  sqe->opcode = write ? (registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE)
+                      : (registered ? IORING_OP_READ_FIXED : IORING_OP_READ);
+  if (engine->stats->fixedFiles) {
+    sqe->fd = slot;
+    sqe->flags = IOSQE_FIXED_FILE;
+  } else {
+    sqe->fd = fd;
+  }
+  sqe->addr = (uint64_t)(uintptr_t)address;
+  sqe->len = (uint32_t)length;
+  sqe->off = offset;
+  sqe->buf_index = (uint16_t)buffer->index;
+  sqe->user_data = buffer->index;
+}
+
+static bool submit_read(struct UringEngine *engine, struct UringBuffer *buffer) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&engine->ring);
+  if (!sqe) {
+    return false;
+  }
+  struct UringFile *file = buffer->file;
+  prepare_io(engine, sqe, buffer, false, file->inputFd, 2 * file->slot, buffer->data + buffer->filled,
+             buffer->length - buffer->filled, buffer->inputOffset + buffer->filled);
+  uring_commit_sqe(&engine->ring);
+  buffer->state = BUFFER_READING;
+  ++engine->inFlight;
+  return true;
+}
+
+static bool submit_write(struct UringEngine *engine, struct UringBuffer *buffer) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&engine->ring);
+  if (!sqe) {
+    return false;
+  }
+  struct UringFile *file = buffer->file;
+  prepare_io(engine, sqe, buffer, true, file->outputFd, 2 * file->slot + 1, buffer->data + buffer->written,
+             buffer->kept - buffer->written, buffer->outputOffset + buffer->written);
+  uring_commit_sqe(&engine->ring);
+  buffer->state = BUFFER_WRITING;
+  ++engine->inFlight;
+  return true;
+}
+
+static void finish_chunk(struct UringEngine *engine, struct UringBuffer *buffer) {
+  struct UringFile *file = buffer->file;
+  buffer->state = BUFFER_FREE;
+  buffer->file = NULL;
+  if (++file->chunksDone == file->chunkCount) {
+    close_file(engine, file);
+  }
+}
+
+// Issues reads into free buffers, opening more files as needed.
+static void start_reads(struct UringEngine *engine) {
+  const size_t bufferSize = engine->options->bufferSize;
+  for (unsigned b = 0; b != engine->options->queueDepth && engine->error == 0; ++b) {
+    struct UringBuffer *buffer = &engine->buffers[b];
+    if (buffer->state != BUFFER_FREE) {
+      continue;
+    }
+    if (engine->readingFile == engine->fileCount
+        || engine->files[engine->readingFile].chunksRead == engine->files[engine->readingFile].chunkCount) {
+      engine->readingFile = engine->fileCount;
+      if (!open_next_file(engine)) {
+        return;
+      }
+    }
+    struct UringFile *file = &engine->files[engine->readingFile];
+    buffer->file = file;
+    buffer->chunk = file->chunksRead;
+    buffer->inputOffset = (uint64_t)buffer->chunk * bufferSize;
+    buffer->length = (size_t)(file->size - buffer->inputOffset < bufferSize ? file->size - buffer->inputOffset
+                                                                            : bufferSize);
+    buffer->filled = 0;
+    if (!submit_read(engine, buffer)) {
+      buffer->file = NULL;
+      return;
+    }
+    ++file->chunksRead;
+  }
+}
+
+// Writes the file's despaced chunks that are next in line.
+static void start_writes(struct UringEngine *engine, struct UringFile *file) {
+  bool progress = true;
+  while (progress && engine->error == 0) {
+    progress = false;
+    for (unsigned b = 0; b != engine->options->queueDepth; ++b) {
+      struct UringBuffer *buffer = &engine->buffers[b];
+      if (buffer->state != BUFFER_DESPACED || buffer->file != file || buffer->chunk != file->nextWriteChunk) {
+        continue;
+      }
+      buffer->outputOffset = file->outputOffset;
+      buffer->written = 0;
+      if (buffer->kept > 0 && !submit_write(engine, buffer)) {
+        return;
+      }
+      file->outputOffset += buffer->kept;
+      ++file->nextWriteChunk;
+      if (buffer->kept == 0) {
+        finish_chunk(engine, buffer);
+      }
+      progress = true;
+      break;
+    }
+  }
+}
+
+static void handle_completion(struct UringEngine *engine, const struct io_uring_cqe *cqe) {
+  struct UringBuffer *buffer = &engine->buffers[cqe->user_data];
+  --engine->inFlight;
+  if (cqe->res < 0) {
+    set_error(engine, -cqe->res);
+  }
+  if (engine->error != 0) {
+    buffer->state = BUFFER_FREE;
+    return;
+  }
+  if (buffer->state == BUFFER_READING) {
+    engine->stats->bytesIn += (uint64_t)cqe->res;
+    buffer->filled += (size_t)cqe->res;
+    // Short reads only happen if the file shrank under us, or for files
+    // that aren't regular; carry on with what there is at the end.
+    if (cqe->res > 0 && buffer->filled < buffer->length) {
+      if (!submit_read(engine, buffer)) {
+        set_error(engine, EBUSY);
+      }
+      return;
+    }
+    buffer->state = BUFFER_DESPACING;
+    ++engine->despacing;
+    spsc_ring_push(&engine->workers[engine->nextWorker].input, buffer);
+    engine->nextWorker = (engine->nextWorker + 1) % engine->options->workerCount;
+  } else {
+    engine->stats->bytesOut += (uint64_t)cqe->res;
+    buffer->written += (size_t)cqe->res;
+    if (buffer->written < buffer->kept) {
+      if (cqe->res == 0 || !submit_write(engine, buffer)) {
+        set_error(engine, EIO);
+      }
+      return;
+    }
+    finish_chunk(engine, buffer);
+  }
+}
+
+static void collect_despaced(struct UringEngine *engine) {
+  for (size_t w = 0; w != engine->options->workerCount; ++w) {
+    struct UringBuffer *buffer;
+    while ((buffer = spsc_ring_try_pop(&engine->workers[w].output)) != NULL) {
+      --engine->despacing;
+      if (engine->error != 0) {
+        buffer->state = BUFFER_FREE;
+        continue;
+      }
+      buffer->state = BUFFER_DESPACED;
+      start_writes(engine, buffer->file);
+    }
+  }
+}
+
+static void run_engine(struct UringEngine *engine) {
+  unsigned spins = 0;
+  while ((engine->filesDone < engine->fileCount && engine->error == 0)
+         || engine->inFlight > 0 || engine->despacing > 0) {
+    if (engine->error == 0) {
+      start_reads(engine);
+    }
+    collect_despaced(engine);
+    // Block for the kernel only when the workers have nothing for us.
+    const unsigned waitFor = engine->inFlight > 0 && engine->despacing == 0 ? 1 : 0;
+    if (engine->ring.unsubmitted > 0 || waitFor > 0) {
+      const int error = uring_submit(&engine->ring, waitFor);
+      if (error != 0) {
+        set_error(engine, error);
+        if (engine->ring.unsubmitted > 0) {
+          // Nothing will complete what couldn't be submitted.
+          engine->inFlight -= engine->ring.unsubmitted;
+          engine->ring.unsubmitted = 0;
+        }
+      }
+    }
+    struct io_uring_cqe cqe;
+    bool completed = false;
+    while (uring_pop_cqe(&engine->ring, &cqe)) {
+      handle_completion(engine, &cqe);
+      completed = true;
+    }
+    if (completed || waitFor > 0) {
+      spins = 0;
+    } else if (engine->despacing > 0) {
+      spsc_ring_wait(&spins);
+    }
+  }
+  // Files left open by an error.
+  for (size_t f = 0; f != engine->filesOpened; ++f) {
+    struct UringFile *file = &engine->files[f];
+    if (file->inputFd >= 0) {
+      close(file->inputFd);
+    }
+    if (file->outputFd >= 0) {
+      close(file->outputFd);
+    }
+  }
+}
+
+int despace_files_uring(const char *const *inputs, const char *const *outputs, size_t count,
+                        const struct DespaceUringOptions *requested, struct DespaceUringStats *stats) {
+  struct DespaceUringOptions options = *requested;
+  options.bufferSize -= options.bufferSize % blockSize;
+  if (options.bufferSize < pageSize) {
+    options.bufferSize = pageSize;
+  }
+  if (options.queueDepth == 0) {
+    options.queueDepth = 1;
+  }
+  if (options.workerCount == 0) {
+    options.workerCount = 1;
+  }
+  memset(stats, 0, sizeof(*stats));
+
+  struct UringEngine engine;
+  memset(&engine, 0, sizeof(engine));
+  engine.options = &options;
+  engine.stats = stats;
+  engine.inputs = inputs;
+  engine.outputs = outputs;
+  engine.fileCount = count;
+  engine.readingFile = count;
+
+  int result = uring_setup(&engine.ring, 2 * options.queueDepth);
+  if (result != 0) {
+    return result;
+  }
+  // A file can hold at most every buffer, so this many files can be open.
+  const size_t slotCount = options.queueDepth;
+  char *arena = NULL;
+  size_t startedWorkers = 0;
+  int *slotFds = NULL;
+  result = ENOMEM;
+  engine.files = calloc(count > 0 ? count : 1, sizeof(struct UringFile));
+  engine.freeSlots = calloc(slotCount, sizeof(int));
+  engine.buffers = calloc(options.queueDepth, sizeof(struct UringBuffer));
+  engine.workers = calloc(options.workerCount, sizeof(struct UringWorker));
+  struct iovec *iovecs = calloc(options.queueDepth, sizeof(struct iovec));
+  slotFds = malloc(2 * slotCount * sizeof(int));
+  if (!engine.files || !engine.freeSlots || !engine.buffers || !engine.workers || !iovecs || !slotFds
+      || posix_memalign((void **)&arena, pageSize, options.queueDepth * options.bufferSize) != 0) {
+    goto done;
+  }
+  for (unsigned b = 0; b != options.queueDepth; ++b) {
+    engine.buffers[b].data = arena + (size_t)b * options.bufferSize;
+    engine.buffers[b].index = b;
+    iovecs[b].iov_base = engine.buffers[b].data;
+    iovecs[b].iov_len = options.bufferSize;
+  }
+  for (size_t s = 0; s != slotCount; ++s) {
+    engine.freeSlots[engine.freeSlotCount++] = (int)(slotCount - 1 - s);
+  }
+  for (size_t s = 0; s != 2 * slotCount; ++s) {
+    slotFds[s] = -1;
+  }
+  // Both are optimizations; without them the kernel maps the buffers and
+  // looks up the files on every operation.
+  stats->registeredBuffers = uring_register(&engine.ring, IORING_REGISTER_BUFFERS, iovecs, options.queueDepth) == 0;
+  stats->fixedFiles = uring_register(&engine.ring, IORING_REGISTER_FILES, slotFds, (unsigned)(2 * slotCount)) == 0;
+
+  for (; startedWorkers != options.workerCount; ++startedWorkers) {
+    struct UringWorker *worker = &engine.workers[startedWorkers];
+    if (!spsc_ring_init(&worker->input, options.queueDepth + 1)
+        || !spsc_ring_init(&worker->output, options.queueDepth + 1)) {
+      goto done;
+    }
+    if (pthread_create(&worker->thread, NULL, &run_uring_worker, worker) != 0) {
+      result = EAGAIN;
+      goto done;
+    }
+  }
+
+  run_engine(&engine);
+  result = engine.error;
+
+done:
+  for (size_t w = 0; w != startedWorkers; ++w) {
+    spsc_ring_push(&engine.workers[w].input, &stopWorker);
+    pthread_join(engine.workers[w].thread, NULL);
+  }
+  if (engine.workers) {
+    for (size_t w = 0; w != options.workerCount; ++w) {
+      spsc_ring_destroy(&engine.workers[w].input);
+      spsc_ring_destroy(&engine.workers[w].output);
+    }
+  }
+  uring_destroy(&engine.ring);
+  free(arena);
+  free(slotFds);
+  free(iovecs);
+  free(engine.workers);
+  free(engine.buffers);
+  free(engine.freeSlots);
+  free(engine.files);
+  return result;
+}
+
+#else
+
+int despace_files_uring(const char *const *inputs, const char *const *outputs, size_t count,
+                        const struct DespaceUringOptions *options, struct DespaceUringStats *stats) {
+  (void)inputs;
+  (void)outputs;
+  (void)count;
+  (void)options;
+  memset(stats, 0, sizeof(*stats));
+  return ENOSYS;
+}
+
+#endif // DESPACE_HAS_URING
@@ -0,0 +1,44 @@
+//
+//  despace_uring.h
+//  SpacePruner
+//
+
+#ifndef despace_uring_h
+#define despace_uring_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct DespaceUringOptions {
+  size_t bufferSize;    // bytes per read, rounded down to a multiple of 64
+  unsigned queueDepth;  // buffers, and so reads and writes, in flight
+  size_t workerCount;   // despacing threads
+};
+
+struct DespaceUringStats {
+  uint64_t bytesIn;
+  uint64_t bytesOut;
+  uint64_t files;
+  bool registeredBuffers;  // the kernel took the buffers ahead of time
+  bool fixedFiles;         // and the file table; otherwise plain reads and writes were used
+};
+
+void despace_uring_default_options(struct DespaceUringOptions *options);
+
+/*
+ Despaces inputs[i] into outputs[i] for every i, with io_uring: up to
+ queueDepth chunks of the inputs, from as many files as needed, are being
+ read at once, worker threads despace each chunk as its read completes, and
+ the compacted chunks are written back in order through the same ring.
+ Reads and writes use buffers and files registered with the kernel, when it
+ allows that.
+
+ Talks to the kernel with raw system calls, so there is no dependency on
+ liburing. Returns 0, or the first errno value met, or ENOSYS where
+ io_uring isn't available.
+ */
+int despace_files_uring(const char *const *inputs, const char *const *outputs, size_t count,
+                        const struct DespaceUringOptions *options, struct DespaceUringStats *stats);
+
+#endif /* despace_uring_h */
@@ -0,0 +1,152 @@
+//
+//  despace_vector.h
+//  SpacePruner
+//
+
+// 16-byte compaction shared by the kernels that run on both arm64 and x86.
+
+#ifndef despace_vector_h
+#define despace_vector_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bigtable.h"
+#include "despacer.h"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define DESPACE_VECTOR 1
+
+typedef uint8x16_t despace_vector;
+
+static inline despace_vector load_vector(const uint8_t *p) {
+  return vld1q_u8(p);
+}
+
+static inline void store_vector(uint8_t *p, despace_vector v) {
+  vst1q_u8(p, v);
+}
+
+// Moves the kept bytes of v to the front and counts them.
+static inline despace_vector compact_vector(despace_vector v, size_t *kept) {
+  const uint8x16_t w = is_nonwhite(v);
+  *kept = bytepopcount(w);
+  return vqtbl1q_u8(v, vld1q_u8(shufmask + 16 * neonmovemask_addv(w)));
+}
+
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define DESPACE_VECTOR 1
+
+typedef __m128i despace_vector;
+
+static inline despace_vector load_vector(const uint8_t *p) {
+  return _mm_loadu_si128((const __m128i *)p);
+}
+
+static inline void store_vector(uint8_t *p, despace_vector v) {
+  _mm_storeu_si128((__m128i *)p, v);
+}
+
+static inline despace_vector compact_vector(despace_vector v, size_t *kept) {
+  const __m128i nonwhite = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(' ' + 1)), v);
+  // shufmask is indexed the way neonmovemask_addv numbers the bytes: even
+  // bytes in the low 8 bits, odd bytes in the high 8 bits.
+  const __m128i evenThenOdd = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+  const unsigned mask = (unsigned)_mm_movemask_epi8(_mm_shuffle_epi8(nonwhite, evenThenOdd));
+  *kept = (size_t)__builtin_popcount(mask);
+  return _mm_shuffle_epi8(v, _mm_load_si128((const __m128i *)(shufmask + 16 * mask)));
+}
+
+#endif
+
+// Reorders a mask with bit j for byte j the way shufmask is indexed: even
+// bytes in the low 8 bits, odd bytes in the high 8 bits.
+static inline unsigned even_then_odd(unsigned mask) {
+  unsigned even = mask & 0x5555;
+  unsigned odd = (mask >> 1) & 0x5555;
+  even = (even | even >> 1) & 0x3333;
+  odd = (odd | odd >> 1) & 0x3333;
+  even = (even | even >> 2) & 0x0F0F;
+  odd = (odd | odd >> 2) & 0x0F0F;
+  even = (even | even >> 4) & 0x00FF;
+  odd = (odd | odd >> 4) & 0x00FF;
+  return even | odd << 8;
+}
+
+#if DESPACE_VECTOR
+// Moves the bytes of v whose bits are set in keep (bit j for byte j) to the
+// front, for kernels that decide what to keep on more than whitespace.
+static inline despace_vector compact_vector_by_mask(despace_vector v, unsigned keep) {
+#if defined(__aarch64__)
+  return vqtbl1q_u8(v, vld1q_u8(shufmask + 16 * even_then_odd(keep)));
+#else
+  return _mm_shuffle_epi8(v, _mm_load_si128((const __m128i *)(shufmask + 16 * even_then_odd(keep))));
+#endif
+}
+#endif
+
+/*
+ 64-byte blocks as bitmasks, bit j for byte j, for the kernels that work out
+ what to keep a block at a time.
+ */
+#if defined(__aarch64__)
+
+// Gathers four compare results (0xFF or 0 per byte) into a block mask: each
+// byte keeps the bit for its place in its 8, and three rounds of pairwise
+// adds sum each 8 bytes into one.
+static inline uint64_t block_mask(uint8x16_t m0, uint8x16_t m1, uint8x16_t m2, uint8x16_t m3) {
+  const uint8x16_t bits = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+  uint8x16_t sum = vpaddq_u8(vpaddq_u8(vandq_u8(m0, bits), vandq_u8(m1, bits)),
+                             vpaddq_u8(vandq_u8(m2, bits), vandq_u8(m3, bits)));
+  sum = vpaddq_u8(sum, sum);
+  return vgetq_lane_u64(vreinterpretq_u64_u8(sum), 0);
+}
+
+// Bit j is set if p[j] is whitespace.
+static inline uint64_t white_block_mask(const uint8_t *p) {
+  return block_mask(is_white(vld1q_u8(p)), is_white(vld1q_u8(p + 16)), is_white(vld1q_u8(p + 32)),
+                    is_white(vld1q_u8(p + 48)));
+}
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+static inline uint64_t white_block_mask(const uint8_t *p) {
+  // Signed compares, so flip the sign bits: c <= ' ' as unsigned.
+  const __m128i flip = _mm_set1_epi8((char)0x80);
+  const __m128i limit = _mm_set1_epi8((char)(' ' + 1 - 128));
+  uint64_t mask = 0;
+  for (int k = 0; k != 4; ++k) {
+    const __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + 16 * k)), flip);
+    mask |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmplt_epi8(v, limit)) << (16 * k);
+  }
+  return mask;
+}
+
+#else
+
+static inline uint64_t white_block_mask(const uint8_t *p) {
+  uint64_t mask = 0;
+  for (int j = 0; j != 64; ++j) {
+    mask |= (uint64_t)(p[j] <= ' ') << j;
+  }
+  return mask;
+}
+
+#endif
+
+// Bits a to b - 1.
+static inline uint64_t bit_range(unsigned a, unsigned b) {
+  const uint64_t below = b == 64 ? ~UINT64_C(0) : (UINT64_C(1) << b) - 1;
+  return below & (~UINT64_C(0) << a);
+}
+
+// Copies one byte to dest[pos] and returns the position after it if it's kept.
+static inline size_t despace_byte_to(char *dest, size_t pos, unsigned char c) {
+  dest[pos] = (char)c;
+  return pos + ((c > 32) ? 1 : 0);
+}
+
+#endif /* despace_vector_h */
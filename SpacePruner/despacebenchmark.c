@@ -1,73 +1,101 @@
-// gcc -std=c99 -O3 -o despacebenchmark despacebenchmark.c
+// gcc -std=gnu11 -O3 -o despacebenchmark despacebenchmark_main.c despacebenchmark.c benchmark_baseline.c perf_counters.c benchmark_timing.c cache_pollution.c bigtable.c adaptive_despacer.c despace_counter.c nontemporal_despacer.c reversible_despacer.c byte_expander.c staged_despacer.c interleaved_despacer.c unzipping_despacer.c -lm -lpthread
 // Originally written by Daniel Lemire.
 
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
-#include <sys/time.h>
 #include <string.h>
-#include <time.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include "benchmark_baseline.h"
+#include "benchmark_timing.h"
+#include "byte_expander.h"
+#include "adaptive_despacer.h"
+#include "cache_pollution.h"
+#include "despace_counter.h"
+#include "despacebenchmark.h"
 #include "despacer.h"
 #include "interleaved_despacer.h"
+#include "nontemporal_despacer.h"
+#include "perf_counters.h"
+#include "reversible_despacer.h"
+#include "staged_despacer.h"
 #include "unzipping_despacer.h"
 
-static inline uint64_t time_in_ns() {
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
-  return (uint64_t)tv.tv_sec * 1000000000 + (uint32_t)tv.tv_usec * 1000;
-}
-
-static const int functionNameLength = 30;
-
-#define BEST_TIME(test)                                                        \
-  do {                                                                         \
-    uint64_t min_diff = (uint64_t)-1;                                          \
-    for (int i = 0; i < repeat; i++) {                                         \
-      fillwithtext(buffer, N);                                                 \
-                                                                               \
-      __asm volatile("" ::: /* pretend to clobber */ "memory");                \
-      const uint64_t cycles_start = time_in_ns();                              \
-      test(buffer, N);                                                         \
-      const uint64_t cycles_final = time_in_ns();                              \
-                                                                               \
-      const uint64_t cycles_diff = (cycles_final - cycles_start);              \
-      if (cycles_diff < min_diff)                                              \
-        min_diff = cycles_diff;                                                \
-    }                                                                          \
-    float cycle_per_op = (float)min_diff / (float)N;                           \
-    fprintf(stream, "%-*s: %.2f\n", functionNameLength, #test, cycle_per_op);  \
-    fflush(stream);                                                            \
-  } while (0)
+static const int functionNameLength = 38;
 
-
-// let us estimate that we have a 1% proba of hitting a white space
-size_t fillwithtext(char *buffer, size_t size) {
+// Each byte is whitespace with probability `density`, split evenly between
+// spaces, line feeds and carriage returns. The rest are any byte above 32,
+// including those from 0x80 up, which a signed char would take for whitespace.
+size_t fillwithtext_density(char *buffer, size_t size, double density) {
   size_t howmany = 0;
   for (size_t i = 0; i < size; ++i) {
     double r = ((double)rand() / (RAND_MAX));
-    if (r < 0.01) {
+    if (r < density / 3) {
       buffer[i] = ' ';
       howmany++;
-    } else if (r < 0.02) {
+    } else if (r < 2 * density / 3) {
       buffer[i] = '\n';
       howmany++;
-    } else if (r < 0.03) {
+    } else if (r < density) {
       buffer[i] = '\r';
       howmany++;
     } else {
       do {
         buffer[i] = (char)rand();
-      } while (buffer[i] <= 32);
+      } while ((unsigned char)buffer[i] <= 32);
     }
   }
   return howmany;
 }
 
+// let us estimate that we have a 1% proba of hitting a white space
+size_t fillwithtext(char *buffer, size_t size) {
+  return fillwithtext_density(buffer, size, 0.03);
+}
+
+// Alternates between runs of 0.1% and 20% whitespace, each 1 to 16 KiB long,
+// like source code with long comment-free stretches followed by indented tables.
+size_t fillwithtext_mixed(char *buffer, size_t size) {
+  size_t howmany = 0;
+  bool dense = false;
+  for (size_t i = 0; i < size; dense = !dense) {
+    size_t run = 1024 * (1 + (size_t)rand() % 16);
+    if (run > size - i) {
+      run = size - i;
+    }
+    howmany += fillwithtext_density(buffer + i, run, dense ? 0.2 : 0.001);
+    i += run;
+  }
+  return howmany;
+}
+
+// The input for one of the benchmark's densities.
+static size_t fillwithtext_for_density(char *buffer, size_t size, double density) {
+  if (density < 0) {
+    return fillwithtext_mixed(buffer, size);
+  }
+  return fillwithtext_density(buffer, size, density);
+}
+
 typedef size_t (*despace_function_ptr)(char *bytes, size_t howmany);
 
 #define FUNCTION_AND_NAME(func) { &func, #func }
 
+// Times the side channel too; it goes to a buffer kept between calls.
+static size_t despace_reversible_scratch(char *bytes, size_t howmany) {
+  static uint8_t *side = NULL;
+  static size_t sideCapacity = 0;
+  const size_t bound = despace_side_channel_bound(howmany);
+  if (bound > sideCapacity) {
+    free(side);
+    side = malloc(bound);
+    sideCapacity = bound;
+  }
+  size_t sideLength;
+  return despace_reversible(bytes, howmany, side, &sideLength);
+}
+
 struct FunctionAndName {
   despace_function_ptr ptr;
   const char* name;
@@ -76,86 +104,860 @@ struct FunctionAndName {
 const struct FunctionAndName functionsToTest[] = {
   FUNCTION_AND_NAME(despace),
 #if __ARM_NEON
-  //FUNCTION_AND_NAME(neon_despace),
+  FUNCTION_AND_NAME(neon_despace),
   //FUNCTION_AND_NAME(neon_despace_branchless),
 #if defined(__aarch64__)
   FUNCTION_AND_NAME(neontbl_despace),
+  FUNCTION_AND_NAME(neon_adaptive_despace),
 #endif
   FUNCTION_AND_NAME(neon_interleaved_despace),
   FUNCTION_AND_NAME(neon_unzipping_despace),
 #endif
+#if defined(__aarch64__) || defined(__SSSE3__)
+  FUNCTION_AND_NAME(staged_despace),
+#endif
+#if defined(__aarch64__)
+  FUNCTION_AND_NAME(neon_register_staged_despace),
+#endif
+  FUNCTION_AND_NAME(despace_reversible_scratch),
 };
 const size_t functionsToTestCount = sizeof(functionsToTest) / sizeof(functionsToTest[0]);
 
-void despace_benchmark(FILE* stream) {
-  const int N = 1024 * 32;
-  const int repeat = 100;
-  const int alignoffset = 0;
+typedef size_t (*aligning_despace_function_ptr)(char *bytes, size_t howmany, size_t alignment);
 
-  // Add one in case we want to null-terminate.
-  char *origbuffer = malloc(N + alignoffset + 1);
-  char *origtmpbuffer = malloc(N + alignoffset + 1);
-  char *buffer = origbuffer + alignoffset;
-  char *tmpbuffer = origtmpbuffer + alignoffset;
-  char *correctbuffer = malloc(N + 1);
-  fprintf(stream, "pointer alignment = %d bytes\n", 1 << __builtin_ctzll((uintptr_t)(const void *)(buffer)));
+struct AligningFunctionAndName {
+  aligning_despace_function_ptr ptr;
+  const char* name;
+};
+
+const struct AligningFunctionAndName aligningFunctionsToTest[] = {
+#if __ARM_NEON
+#if defined(__aarch64__)
+  FUNCTION_AND_NAME(neontbl_despace_aligning),
+#endif
+  FUNCTION_AND_NAME(neon_interleaved_despace_aligning),
+  FUNCTION_AND_NAME(neon_unzipping_despace_aligning),
+#endif
+};
+const size_t aligningFunctionsToTestCount = sizeof(aligningFunctionsToTest) / sizeof(aligningFunctionsToTest[0]);
+
+typedef size_t (*despace_count_function_ptr)(const char *bytes, size_t howmany);
+
+struct CountFunctionAndName {
+  despace_count_function_ptr ptr;
+  const char* name;
+};
+
+// Its threads inherit the benchmark's pinning, so time it with --no-pin.
+static size_t despace_count_parallel_all_cpus(const char *bytes, size_t howmany) {
+  return despace_count_parallel(bytes, howmany, 0);
+}
+
+static size_t despace_count_streaming_4k(const char *bytes, size_t howmany) {
+  struct DespaceCounter counter;
+  despace_counter_init(&counter);
+  for (size_t i = 0; i < howmany; i += 4096) {
+    despace_counter_update(&counter, bytes + i, howmany - i < 4096 ? howmany - i : 4096);
+  }
+  return (size_t)despace_counter_result(&counter);
+}
+
+// These only count the bytes that the kernels would keep.
+const struct CountFunctionAndName countFunctionsToTest[] = {
+  FUNCTION_AND_NAME(despace_count),
+  FUNCTION_AND_NAME(despace_count_parallel_all_cpus),
+  FUNCTION_AND_NAME(despace_count_streaming_4k),
+};
+const size_t countFunctionsToTestCount = sizeof(countFunctionsToTest) / sizeof(countFunctionsToTest[0]);
+
+typedef size_t (*despace_copy_function_ptr)(char *dest, const char *source, size_t howmany);
+
+struct CopyFunctionAndName {
+  despace_copy_function_ptr ptr;
+  const char* name;
+};
+
+// These write to a separate buffer.
+const struct CopyFunctionAndName copyFunctionsToTest[] = {
+  FUNCTION_AND_NAME(despace_to_cached),
+  FUNCTION_AND_NAME(despace_to_nontemporal),
+};
+const size_t copyFunctionsToTestCount = sizeof(copyFunctionsToTest) / sizeof(copyFunctionsToTest[0]);
+
+/*
+ Undoing a despace needs more than a buffer: despace_restore takes the kept
+ bytes and the side channel, and the expand kernels take the kept bytes and
+ a mask of where they go, filling the gaps with spaces. These are made once
+ per input, outside the timings.
+ */
+struct PreparedInput {
+  char *kept;
+  size_t keptLength;
+  uint8_t *side;
+  size_t sideLength;
+  uint64_t *keepMask;
+};
+
+typedef void (*prepared_function_ptr)(char *dest, const struct PreparedInput *input, size_t howmany);
+
+struct PreparedFunctionAndName {
+  prepared_function_ptr ptr;
+  const char* name;
+  bool restoresWhitespace;  // or turns it all into spaces
+};
+
+static void despace_restore_prepared(char *dest, const struct PreparedInput *input, size_t howmany) {
+  despace_restore(dest, howmany, input->kept, input->keptLength, input->side, input->sideLength);
+}
+
+#define EXPAND_PREPARED(func) \
+  static void func##_prepared(char *dest, const struct PreparedInput *input, size_t howmany) { \
+    func(dest, howmany, input->keepMask, input->kept, input->keptLength, ' '); \
+  }
+#define PREPARED_EXPAND_AND_NAME(func) { &func##_prepared, #func, false }
+
+EXPAND_PREPARED(expand_bytes_scalar)
+#if defined(__aarch64__)
+EXPAND_PREPARED(neon_expand_bytes)
+#endif
+#if defined(__SSSE3__)
+EXPAND_PREPARED(ssse3_expand_bytes)
+#endif
+#if defined(__AVX2__)
+EXPAND_PREPARED(avx2_expand_bytes)
+#endif
+#if defined(__AVX512VBMI2__) && defined(__AVX512BW__)
+EXPAND_PREPARED(avx512_expand_bytes)
+#endif
+
+const struct PreparedFunctionAndName preparedFunctionsToTest[] = {
+  { &despace_restore_prepared, "despace_restore", true },
+  PREPARED_EXPAND_AND_NAME(expand_bytes_scalar),
+#if defined(__aarch64__)
+  PREPARED_EXPAND_AND_NAME(neon_expand_bytes),
+#endif
+#if defined(__SSSE3__)
+  PREPARED_EXPAND_AND_NAME(ssse3_expand_bytes),
+#endif
+#if defined(__AVX2__)
+  PREPARED_EXPAND_AND_NAME(avx2_expand_bytes),
+#endif
+#if defined(__AVX512VBMI2__) && defined(__AVX512BW__)
+  PREPARED_EXPAND_AND_NAME(avx512_expand_bytes),
+#endif
+};
+const size_t preparedFunctionsToTestCount = sizeof(preparedFunctionsToTest) / sizeof(preparedFunctionsToTest[0]);
+
+static bool prepare_input(struct PreparedInput* input, const char* source, size_t howmany) {
+  input->kept = malloc(howmany > 0 ? howmany : 1);
+  input->side = malloc(despace_side_channel_bound(howmany));
+  input->keepMask = calloc(howmany / 64 + 1, sizeof(uint64_t));
+  if (!input->kept || !input->side || !input->keepMask) {
+    return false;
+  }
+  for (size_t i = 0; i != howmany; ++i) {
+    input->keepMask[i / 64] |= (uint64_t)((unsigned char)source[i] > 32) << (i % 64);
+  }
+  memcpy(input->kept, source, howmany);
+  input->keptLength = despace_reversible(input->kept, howmany, input->side, &input->sideLength);
+  return true;
+}
+
+static void free_prepared_input(struct PreparedInput* input) {
+  free(input->kept);
+  free(input->side);
+  free(input->keepMask);
+}
+
+static const size_t prologueAlignments[] = { 16, 32, 64 };
+static const size_t prologueAlignmentsCount = sizeof(prologueAlignments) / sizeof(prologueAlignments[0]);
+
+// A kernel, possibly with an alignment prologue, an out-of-place kernel, or a counter.
+struct KernelVariant {
+  despace_function_ptr ptr;
+  aligning_despace_function_ptr aligningPtr;
+  despace_copy_function_ptr copyPtr;
+  despace_count_function_ptr countPtr;
+  size_t alignment;
+  const char* name;
+};
+
+// Out-of-place kernels read `source` and write `bytes`; the others only look at `bytes`.
+static inline size_t call_variant(const struct KernelVariant* variant, char* bytes, const char* source,
+                                  size_t howmany) {
+  if (variant->copyPtr) {
+    return (*variant->copyPtr)(bytes, source, howmany);
+  }
+  if (variant->aligningPtr) {
+    return (*variant->aligningPtr)(bytes, howmany, variant->alignment);
+  }
+  if (variant->countPtr) {
+    return (*variant->countPtr)(bytes, howmany);
+  }
+  return (*variant->ptr)(bytes, howmany);
+}
+
+static size_t make_plain_variants(struct KernelVariant* variants) {
+  for (size_t t = 0; t != functionsToTestCount; ++t) {
+    variants[t] = (struct KernelVariant){ functionsToTest[t].ptr, NULL, NULL, NULL, 0, functionsToTest[t].name };
+  }
+  size_t count = functionsToTestCount;
+  for (size_t t = 0; t != copyFunctionsToTestCount; ++t) {
+    variants[count++] = (struct KernelVariant){
+      NULL, NULL, copyFunctionsToTest[t].ptr, NULL, 0, copyFunctionsToTest[t].name };
+  }
+  for (size_t t = 0; t != countFunctionsToTestCount; ++t) {
+    variants[count++] = (struct KernelVariant){
+      NULL, NULL, NULL, countFunctionsToTest[t].ptr, 0, countFunctionsToTest[t].name };
+  }
+  return count;
+}
+
+// The plain kernels followed by every kernel with every prologue.
+static size_t make_all_variants(struct KernelVariant* variants) {
+  size_t count = make_plain_variants(variants);
+  for (size_t t = 0; t != aligningFunctionsToTestCount; ++t) {
+    for (size_t a = 0; a != prologueAlignmentsCount; ++a) {
+      variants[count++] = (struct KernelVariant){
+        NULL, aligningFunctionsToTest[t].ptr, NULL, NULL, prologueAlignments[a], aligningFunctionsToTest[t].name };
+    }
+  }
+  return count;
+}
+
+#define MAX_VARIANT_COUNT (sizeof(functionsToTest) / sizeof(functionsToTest[0]) \
+    + sizeof(copyFunctionsToTest) / sizeof(copyFunctionsToTest[0]) \
+    + sizeof(countFunctionsToTest) / sizeof(countFunctionsToTest[0]) \
+    + sizeof(aligningFunctionsToTest) / sizeof(aligningFunctionsToTest[0]) \
+    * sizeof(prologueAlignments) / sizeof(prologueAlignments[0]))
+
+static void print_variant_name(FILE* stream, const struct KernelVariant* variant) {
+  if (variant->aligningPtr) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s(%zu)", variant->name, variant->alignment);
+    fprintf(stream, "%-*s", functionNameLength, name);
+  } else {
+    fprintf(stream, "%-*s", functionNameLength, variant->name);
+  }
+}
+
+void despace_benchmark_default_options(struct DespaceBenchmarkOptions* options) {
+  options->repeat = 100;
+  options->warmupRepeat = 10;
+  options->inputPoolCount = 16;
+  options->pin = true;
+  options->cpu = -1;
+  options->noisyThreshold = 0.05;
+  options->frequencyThreshold = 0.02;
+  options->alignOffset = 0;
+  options->alignmentSweep = false;
+  options->evictionBytes = 0;
+  options->thrasherBytes = 0;
+
+  static const size_t defaultSizes[] = { 1024 * 32 };
+  static const double defaultDensities[] = { 0.03, DESPACE_MIXED_DENSITY };
+  options->timingSizes = defaultSizes;
+  options->timingSizeCount = sizeof(defaultSizes) / sizeof(defaultSizes[0]);
+  options->densities = defaultDensities;
+  options->densityCount = sizeof(defaultDensities) / sizeof(defaultDensities[0]);
+  options->savePath = NULL;
+  options->comparePath = NULL;
+  options->regressionThreshold = 0.05;
+  options->perfCounters = false;
+  options->perfRawEvents = NULL;
+  options->perfRawEventCount = 0;
+}
+
+struct Measurement {
+  struct BenchmarkStats stats;
+  bool noisy;
+  bool frequencyChanged;
+};
+
+// Everything needed to time a kernel, shared by all the measurements.
+struct TimingContext {
+  const struct DespaceBenchmarkOptions* options;
+  char* const* inputPool;
+  size_t poolCount;
+  size_t N;
+  uint64_t* samples;
+  uint8_t* evictionBuffer;  // NULL for hot-cache timings
+};
+
+static void measure_variant(const struct KernelVariant* variant, char* buffer,
+                            const struct TimingContext* context, struct Measurement* measurement) {
+  const struct DespaceBenchmarkOptions* options = context->options;
+  char* const* inputPool = context->inputPool;
+  const size_t poolCount = context->poolCount;
+  const size_t N = context->N;
+  uint64_t* samples = context->samples;
+
+  // Most kernels work in place, so every call gets a fresh copy of one of the
+  // pre-generated inputs. Copying is cheap and deterministic, unlike rand(),
+  // and it leaves the buffer in the cache the same way every time.
+  // Out-of-place kernels read the pool directly and write the buffer.
+  for (size_t i = 0; i != options->warmupRepeat; ++i) {
+    if (!variant->copyPtr) {
+      memcpy(buffer, inputPool[i % poolCount], N);
+    }
+    call_variant(variant, buffer, inputPool[i % poolCount], N);
+  }
+
+  const uint64_t calibrationBefore = calibration_time_in_ns();
+  for (size_t i = 0; i != options->repeat; ++i) {
+    if (!variant->copyPtr) {
+      memcpy(buffer, inputPool[i % poolCount], N);
+    }
+    if (context->evictionBuffer) {
+      // The input arrives from memory, as it would from a NIC or a disk, and
+      // the kernel's tables have to be fetched again too.
+      evict_caches(context->evictionBuffer, options->evictionBytes);
+    }
+
+    __asm volatile("" ::: /* pretend to clobber */ "memory");
+    const uint64_t start = time_in_ns();
+    call_variant(variant, buffer, inputPool[i % poolCount], N);
+    const uint64_t end = time_in_ns();
+    __asm volatile("" ::: /* pretend to clobber */ "memory");
+
+    samples[i] = end - start;
+  }
+  const uint64_t calibrationAfter = calibration_time_in_ns();
+
+  compute_benchmark_stats(samples, options->repeat, &measurement->stats);
+
+  const double calibrationChange = (double)calibrationAfter / (double)calibrationBefore - 1;
+  measurement->frequencyChanged = calibrationChange > options->frequencyThreshold
+      || calibrationChange < -options->frequencyThreshold;
+  measurement->noisy = benchmark_stats_spread(&measurement->stats) > options->noisyThreshold;
+}
+
+// Like measure_variant, cycling through inputs prepared from the pool.
+static void measure_prepared(const struct PreparedFunctionAndName* function, char* buffer,
+                             const struct TimingContext* context, const struct PreparedInput* prepared,
+                             size_t preparedCount, struct Measurement* measurement) {
+  const struct DespaceBenchmarkOptions* options = context->options;
+  const size_t N = context->N;
+  uint64_t* samples = context->samples;
+
+  for (size_t i = 0; i != options->warmupRepeat; ++i) {
+    (*function->ptr)(buffer, &prepared[i % preparedCount], N);
+  }
+
+  const uint64_t calibrationBefore = calibration_time_in_ns();
+  for (size_t i = 0; i != options->repeat; ++i) {
+    if (context->evictionBuffer) {
+      evict_caches(context->evictionBuffer, options->evictionBytes);
+    }
+
+    __asm volatile("" ::: /* pretend to clobber */ "memory");
+    const uint64_t start = time_in_ns();
+    (*function->ptr)(buffer, &prepared[i % preparedCount], N);
+    const uint64_t end = time_in_ns();
+    __asm volatile("" ::: /* pretend to clobber */ "memory");
 
-  static const size_t testSizes[] = { 0, 1, 2, 3, 4, 7, 8, 9, 13, 16, 17, 61, 64, 67,
-      100, 123, 1000, 10000, N };
-  const size_t testSizesCount = sizeof(testSizes) / sizeof(testSizes[0]);
-  bool failedTests[functionsToTestCount] = {};
+    samples[i] = end - start;
+  }
+  const uint64_t calibrationAfter = calibration_time_in_ns();
+
+  compute_benchmark_stats(samples, options->repeat, &measurement->stats);
 
-  for (size_t i = 0; i != testSizesCount; ++i) {
-    const size_t sourceCount = testSizes[i];
-    assert(sourceCount <= N);
+  const double calibrationChange = (double)calibrationAfter / (double)calibrationBefore - 1;
+  measurement->frequencyChanged = calibrationChange > options->frequencyThreshold
+      || calibrationChange < -options->frequencyThreshold;
+  measurement->noisy = benchmark_stats_spread(&measurement->stats) > options->noisyThreshold;
+}
 
-    const size_t howmanywhite = fillwithtext(buffer, sourceCount);
+static void print_measurement(FILE* stream, const struct KernelVariant* variant,
+                              const struct Measurement* measurement, size_t N) {
+  const struct BenchmarkStats* stats = &measurement->stats;
+  const double perByte = 1.0 / (double)N;
+  print_variant_name(stream, variant);
+  fprintf(stream, ": %6.3f %6.3f %6.3f %6.3f  [%.3f, %.3f]  %6.2f%s%s\n",
+          stats->min * perByte, stats->p10 * perByte, stats->median * perByte, stats->p90 * perByte,
+          stats->medianLow * perByte, stats->medianHigh * perByte,
+          stats->median > 0 ? (double)N / (double)stats->median : 0.0,
+          measurement->noisy ? "  NOISY" : "", measurement->frequencyChanged ? "  FREQUENCY CHANGED" : "");
+  fflush(stream);
+}
+
+// Counts hardware events over as many calls as are timed, leaving out the
+// copying of the input.
+static void count_variant_events(const struct KernelVariant* variant, char* buffer,
+                                 const struct TimingContext* context, struct PerfCounters* counters,
+                                 struct PerfCounterValues* values) {
+  const struct DespaceBenchmarkOptions* options = context->options;
+  char* const* inputPool = context->inputPool;
+  perf_counters_reset(counters);
+  for (size_t i = 0; i != options->repeat; ++i) {
+    if (!variant->copyPtr) {
+      memcpy(buffer, inputPool[i % context->poolCount], context->N);
+    }
+    if (context->evictionBuffer) {
+      evict_caches(context->evictionBuffer, options->evictionBytes);
+    }
+    perf_counters_enable(counters);
+    call_variant(variant, buffer, inputPool[i % context->poolCount], context->N);
+    perf_counters_disable(counters);
+  }
+  perf_counters_read(counters, values);
+}
+
+// Cycles per byte, instructions per cycle, and the other events per KiB of input.
+static void print_event_counts(FILE* stream, const struct KernelVariant* variant,
+                               const struct PerfCounterValues* values, size_t bytes) {
+  print_variant_name(stream, variant);
+  fprintf(stream, ":");
+  const double kibibytes = (double)bytes / 1024;
+  uint64_t cycles = 0;
+  for (size_t e = 0; e != values->count; ++e) {
+    const char* name = values->names[e];
+    const double value = (double)values->values[e];
+    if (strcmp(name, "cycles") == 0) {
+      cycles = values->values[e];
+      fprintf(stream, " cycles/B %.3f", bytes > 0 ? value / (double)bytes : 0.0);
+    } else if (strcmp(name, "instructions") == 0) {
+      fprintf(stream, "  IPC %.2f", cycles > 0 ? value / (double)cycles : 0.0);
+    } else {
+      fprintf(stream, "  %s/KiB %.3f", name, kibibytes > 0 ? value / kibibytes : 0.0);
+    }
+  }
+  fprintf(stream, "\n");
+  fflush(stream);
+}
+
+static const size_t testSizes[] = { 0, 1, 2, 3, 4, 7, 8, 9, 13, 16, 17, 61, 64, 67,
+    100, 123, 1000, 10000, 1024 * 32 };
+static const size_t testSizesCount = sizeof(testSizes) / sizeof(testSizes[0]);
+
+// Marks each variant that gets a wrong answer for some test size.
+static void check_variants(const struct KernelVariant* variants, size_t variantCount,
+                           char* buffer, char* tmpbuffer, char* correctbuffer, bool* failedTests) {
+  for (size_t i = 0; i != 2 * testSizesCount; ++i) {
+    const size_t sourceCount = testSizes[i / 2];
+
+    const size_t howmanywhite = (i % 2) ? fillwithtext_mixed(buffer, sourceCount) : fillwithtext(buffer, sourceCount);
     const size_t correctResultSize = sourceCount - howmanywhite;
 
-    int j = 0;
-    for (int i = 0; i < sourceCount; ++i) {
-      char c = buffer[i];
-      if (c > 32) {
+    size_t j = 0;
+    for (size_t i = 0; i < sourceCount; ++i) {
+      const char c = buffer[i];
+      if ((unsigned char)c > 32) {
         correctbuffer[j++] = c;
       }
     }
     assert(j == correctResultSize);
 
-    for (size_t t = 0; t != functionsToTestCount; ++t) {
+    for (size_t t = 0; t != variantCount; ++t) {
       if (failedTests[t]) {
         continue;
       }
 
       memcpy(tmpbuffer, buffer, sourceCount);
-      size_t resultSize = (*functionsToTest[t].ptr)(tmpbuffer, sourceCount);
+      size_t resultSize = call_variant(&variants[t], tmpbuffer, buffer, sourceCount);
 
+      // Counters must leave the input alone.
       if (resultSize != correctResultSize
-          || memcmp(tmpbuffer, correctbuffer, resultSize) != 0) {
+          || memcmp(tmpbuffer, variants[t].countPtr ? buffer : correctbuffer,
+                    variants[t].countPtr ? sourceCount : resultSize) != 0) {
         failedTests[t] = true;
       }
     }
   }
+}
 
-  for (size_t t = 0; t != functionsToTestCount; ++t) {
-    fprintf(stream, "%-*s: %s\n", functionNameLength, functionsToTest[t].name, failedTests[t] ? "FAILURE" : "OK");
+// Marks each prepared function that doesn't give back the input, or the
+// input with every whitespace byte a space, for some test size.
+static void check_prepared(char* buffer, char* tmpbuffer, char* correctbuffer, bool* failedTests) {
+  for (size_t i = 0; i != 2 * testSizesCount; ++i) {
+    const size_t sourceCount = testSizes[i / 2];
+    if (i % 2) {
+      fillwithtext_mixed(buffer, sourceCount);
+    } else {
+      fillwithtext(buffer, sourceCount);
+    }
+    for (size_t j = 0; j != sourceCount; ++j) {
+      correctbuffer[j] = (unsigned char)buffer[j] > 32 ? buffer[j] : ' ';
+    }
+    struct PreparedInput input;
+    const bool prepared = prepare_input(&input, buffer, sourceCount);
+    for (size_t t = 0; t != preparedFunctionsToTestCount; ++t) {
+      if (!prepared) {
+        failedTests[t] = true;
+        continue;
+      }
+      memset(tmpbuffer, 0, sourceCount);
+      (*preparedFunctionsToTest[t].ptr)(tmpbuffer, &input, sourceCount);
+      const char* expected = preparedFunctionsToTest[t].restoresWhitespace ? buffer : correctbuffer;
+      if (memcmp(tmpbuffer, expected, sourceCount) != 0) {
+        failedTests[t] = true;
+      }
+    }
+    free_prepared_input(&input);
+  }
+}
+
+/*
+ Runs the correctness tests and the timings with the source at every offset
+ from a 64-byte boundary. The in-place kernels' destination always starts at
+ the same offset as the source. The out-of-place kernels are tested with both
+ at each offset, and timed with the destination at each offset.
+ */
+static void alignment_sweep(FILE* stream, const struct TimingContext* context,
+                            char* alignedbuffer, char* alignedtmpbuffer, char* correctbuffer) {
+  enum { offsetCount = 64 };
+  struct KernelVariant variants[MAX_VARIANT_COUNT];
+  const size_t variantCount = make_all_variants(variants);
+
+  fprintf(stream, "\nalignment sweep, correctness at offsets 0-%d:\n", offsetCount - 1);
+  bool failedTests[MAX_VARIANT_COUNT] = { false };
+  int firstFailure[MAX_VARIANT_COUNT] = { 0 };
+  for (int offset = 0; offset != offsetCount; ++offset) {
+    bool failedAtOffset[MAX_VARIANT_COUNT] = { false };
+    check_variants(variants, variantCount, alignedbuffer + offset, alignedtmpbuffer + offset,
+                   correctbuffer, failedAtOffset);
+    for (size_t t = 0; t != variantCount; ++t) {
+      if (failedAtOffset[t] && !failedTests[t]) {
+        failedTests[t] = true;
+        firstFailure[t] = offset;
+      }
+    }
+  }
+  for (size_t t = 0; t != variantCount; ++t) {
+    print_variant_name(stream, &variants[t]);
+    if (failedTests[t]) {
+      fprintf(stream, ": FAILURE at offset %d\n", firstFailure[t]);
+    } else {
+      fprintf(stream, ": OK\n");
+    }
+  }
+
+  if (context->options->repeat == 0) {
+    return;
+  }
+  fprintf(stream, "\nalignment sweep, median ns per byte by source offset"
+          " (destination offset for out-of-place kernels):\n");
+  for (size_t t = 0; t != variantCount; ++t) {
+    double medians[offsetCount];
+    int best = 0, worst = 0;
+    for (int offset = 0; offset != offsetCount; ++offset) {
+      struct Measurement measurement;
+      measure_variant(&variants[t], alignedbuffer + offset, context, &measurement);
+      medians[offset] = (double)measurement.stats.median / (double)context->N;
+      if (medians[offset] < medians[best]) {
+        best = offset;
+      }
+      if (medians[offset] > medians[worst]) {
+        worst = offset;
+      }
+    }
+    print_variant_name(stream, &variants[t]);
+    fprintf(stream, ": best %.3f at %d, worst %.3f at %d (+%.1f%%)\n",
+            medians[best], best, medians[worst], worst, 100 * (medians[worst] / medians[best] - 1));
+    for (int row = 0; row != offsetCount; row += 8) {
+      fprintf(stream, "  %2d:", row);
+      for (int offset = row; offset != row + 8; ++offset) {
+        fprintf(stream, " %.3f", medians[offset]);
+      }
+      fprintf(stream, "\n");
+    }
+    fflush(stream);
+  }
+}
+
+void despace_benchmark(FILE* stream) {
+  struct DespaceBenchmarkOptions options;
+  despace_benchmark_default_options(&options);
+  despace_benchmark_with_options(stream, &options);
+}
+
+static void fill_input_pool(char* const* inputPool, size_t poolCount, size_t size, double density) {
+  for (size_t i = 0; i != poolCount; ++i) {
+    fillwithtext_for_density(inputPool[i], size, density);
+  }
+}
+
+#if defined(__aarch64__)
+/*
+ neon_adaptive_despace should switch strategies where neon_despace stops
+ beating neontbl_despace. For each size, finds the first pair of timed
+ densities between which that happens and interpolates, in the units of
+ ADAPTIVE_DENSE_THRESHOLD and ADAPTIVE_SPARSE_THRESHOLD. Mixed input is
+ left out, since it has no one density.
+ */
+static void report_adaptive_crossover(FILE* stream, const struct DespaceBenchmarkOptions* options,
+                                      const struct BenchmarkResult* results, size_t resultCount) {
+  for (size_t s = 0; s != options->timingSizeCount; ++s) {
+    const size_t size = options->timingSizes[s];
+    double previousDensity = -1;
+    double previousGap = 0;
+    bool found = false;
+    size_t points = 0;
+    // The densities were timed in the order given, so that is the order here.
+    for (size_t d = 0; d != options->densityCount && !found; ++d) {
+      const double density = options->densities[d];
+      if (density < 0) {
+        continue;
+      }
+      uint64_t sparse = 0, table = 0;
+      for (size_t r = 0; r != resultCount; ++r) {
+        if (results[r].size == size && results[r].density == density) {
+          if (strcmp(results[r].kernel, "neon_despace") == 0) {
+            sparse = results[r].stats.median;
+          } else if (strcmp(results[r].kernel, "neontbl_despace") == 0) {
+            table = results[r].stats.median;
+          }
+        }
+      }
+      if (sparse == 0 || table == 0) {
+        continue;
+      }
+      // Positive where neontbl_despace is faster.
+      const double gap = (double)sparse - (double)table;
+      if (points > 0 && density > previousDensity && previousGap <= 0 && gap > 0) {
+        const double crossover = previousDensity + (density - previousDensity) * -previousGap / (gap - previousGap);
+        fprintf(stream, "\n%zu bytes: neontbl_despace overtakes neon_despace at %.2f%% whitespace,\n"
+                "%.0f in neon_adaptive_despace's units (dense %u, sparse %u)\n",
+                size, 100 * crossover, crossover * 64 * 256, ADAPTIVE_DENSE_THRESHOLD, ADAPTIVE_SPARSE_THRESHOLD);
+        found = true;
+      }
+      previousDensity = density;
+      previousGap = gap;
+      ++points;
+    }
+    if (!found && points >= 2) {
+      fprintf(stream, "\n%zu bytes: %s is faster at every density timed\n", size,
+              previousGap <= 0 ? "neon_despace" : "neontbl_despace");
+    }
+  }
+}
+#endif
+
+static int save_and_compare(FILE* stream, const struct DespaceBenchmarkOptions* options,
+                            const struct BenchmarkEnvironment* environment,
+                            const struct BenchmarkResult* results, size_t resultCount) {
+  int status = 0;
+  if (options->comparePath) {
+    struct BenchmarkEnvironment baselineEnvironment;
+    size_t baselineCount = 0;
+    struct BenchmarkResult* baseline = load_benchmark_results(options->comparePath, &baselineEnvironment, &baselineCount);
+    if (!baseline) {
+      fprintf(stream, "\ncan't read baseline %s\n", options->comparePath);
+      status = -1;
+    } else {
+      fprintf(stream, "\ncompared with %s:\n", options->comparePath);
+      if (strcmp(baselineEnvironment.cpu, environment->cpu) != 0
+          || strcmp(baselineEnvironment.compiler, environment->compiler) != 0
+          || strcmp(baselineEnvironment.flags, environment->flags) != 0) {
+        fprintf(stream, "baseline was recorded with a different setup:\n  %s\n  %s\n  %s\n",
+                baselineEnvironment.cpu, baselineEnvironment.compiler, baselineEnvironment.flags);
+      }
+      const size_t regressions = compare_benchmark_results(stream, baseline, baselineCount, results, resultCount,
+                                                           options->regressionThreshold);
+      fprintf(stream, "%zu regression%s beyond %.1f%%\n", regressions, regressions == 1 ? "" : "s",
+              100 * options->regressionThreshold);
+      status = (int)regressions;
+      free(baseline);
+    }
+  }
+  if (options->savePath) {
+    if (save_benchmark_results(options->savePath, environment, results, resultCount)) {
+      fprintf(stream, "\nsaved %zu results to %s\n", resultCount, options->savePath);
+    } else {
+      fprintf(stream, "\ncan't write %s\n", options->savePath);
+      status = status ? status : -1;
+    }
+  }
+  return status;
+}
+
+int despace_benchmark_with_options(FILE* stream, const struct DespaceBenchmarkOptions* options) {
+  size_t N = 1024 * 32;
+  for (size_t i = 0; i != options->timingSizeCount; ++i) {
+    if (options->timingSizes[i] > N) {
+      N = options->timingSizes[i];
+    }
+  }
+  const size_t alignoffset = options->alignOffset % 64;
+
+  // Room for any offset from a cache line boundary.
+  // Add one in case we want to null-terminate.
+  char *origbuffer = NULL;
+  char *origtmpbuffer = NULL;
+  posix_memalign((void **)&origbuffer, 64, N + 64 + 1);
+  posix_memalign((void **)&origtmpbuffer, 64, N + 64 + 1);
+  char *buffer = origbuffer + alignoffset;
+  char *tmpbuffer = origtmpbuffer + alignoffset;
+  char *correctbuffer = malloc(N + 1);
+  fprintf(stream, "pointer alignment = %d bytes\n", 1 << __builtin_ctzll((uintptr_t)(const void *)(buffer)));
+
+  struct KernelVariant variants[MAX_VARIANT_COUNT];
+  const size_t variantCount = make_plain_variants(variants);
+  bool failedTests[MAX_VARIANT_COUNT] = { false };
+  check_variants(variants, variantCount, buffer, tmpbuffer, correctbuffer, failedTests);
+
+  for (size_t t = 0; t != variantCount; ++t) {
+    fprintf(stream, "%-*s: %s\n", functionNameLength, variants[t].name, failedTests[t] ? "FAILURE" : "OK");
+  }
+  bool failedPrepared[sizeof(preparedFunctionsToTest) / sizeof(preparedFunctionsToTest[0])] = { false };
+  check_prepared(buffer, tmpbuffer, correctbuffer, failedPrepared);
+  for (size_t t = 0; t != preparedFunctionsToTestCount; ++t) {
+    fprintf(stream, "%-*s: %s\n", functionNameLength, preparedFunctionsToTest[t].name,
+            failedPrepared[t] ? "FAILURE" : "OK");
   }
   fflush(stream);
 
-  fprintf(stream, "\nns per operation:\n");
-  BEST_TIME(despace);
-#if __ARM_NEON
-  //BEST_TIME(neon_despace);
-  //BEST_TIME(neon_despace_branchless);
+  struct BenchmarkEnvironment environment;
+  describe_benchmark_environment(&environment);
+  fprintf(stream, "\n%s\n%s\n%s\n", environment.cpu, environment.compiler, environment.flags);
+
+  const int pinnedCpu = options->pin ? pin_current_thread_to_cpu(options->cpu) : -1;
+  const char* governor = frequency_governor();
+  if (pinnedCpu >= 0) {
+    fprintf(stream, "pinned to CPU %d", pinnedCpu);
+  } else {
+    fprintf(stream, "not pinned to a CPU");
+  }
+  if (governor) {
+    fprintf(stream, ", frequency governor %s%s", governor,
+            strcmp(governor, "performance") == 0 ? "" : " (results may drift)");
+  }
+  fprintf(stream, "\n");
+
+  // Large inputs come from memory whatever the pool size, so don't let the
+  // pool grow past what the machine can hold.
+  const size_t maxPoolBytes = (size_t)1024 * 1024 * 1024;
+  size_t poolCount = options->inputPoolCount > 0 ? options->inputPoolCount : 1;
+  if (poolCount > 1 && poolCount * N > maxPoolBytes) {
+    poolCount = maxPoolBytes / N > 1 ? maxPoolBytes / N : 1;
+  }
+  char** inputPool = malloc(poolCount * sizeof(char*));
+  for (size_t i = 0; i != poolCount; ++i) {
+    inputPool[i] = malloc(N);
+  }
+  uint64_t* samples = malloc((options->repeat > 0 ? options->repeat : 1) * sizeof(uint64_t));
+  uint8_t* evictionBuffer = NULL;
+  if (options->evictionBytes > 0) {
+    evictionBuffer = malloc(options->evictionBytes);
+    memset(evictionBuffer, 0, options->evictionBytes);
+  }
+  struct TimingContext context = { options, inputPool, poolCount, N, samples, evictionBuffer };
+
+  struct CacheThrasher* thrasher = NULL;
+  if (options->thrasherBytes > 0) {
+    const int thrasherCpu = pinnedCpu >= 0 ? (int)((pinnedCpu + 1) % sysconf(_SC_NPROCESSORS_ONLN)) : -1;
+    thrasher = cache_thrasher_start(options->thrasherBytes, thrasherCpu);
+  }
+
+  fprintf(stream, "%s caches", evictionBuffer ? "cold" : "hot");
+  if (evictionBuffer) {
+    fprintf(stream, " (evicting %zu KiB before each sample)", options->evictionBytes / 1024);
+  }
+  if (thrasher) {
+    fprintf(stream, ", co-runner thrashing %zu KiB", options->thrasherBytes / 1024);
+  }
+  fprintf(stream, "\n");
+
+  struct PerfCounters* counters = NULL;
+  if (options->perfCounters) {
+    counters = perf_counters_open(options->perfRawEvents, options->perfRawEventCount);
+    if (!counters) {
+      fprintf(stream, "hardware event counters unavailable\n");
+    }
+  }
+
+  wait_for_stable_frequency(500 * 1000 * 1000);
+
+  const size_t maxResultCount = options->densityCount * options->timingSizeCount * (variantCount + preparedFunctionsToTestCount);
+  struct BenchmarkResult* results = malloc((maxResultCount > 0 ? maxResultCount : 1) * sizeof(struct BenchmarkResult));
+  size_t resultCount = 0;
+  for (size_t d = 0; d != options->densityCount && options->repeat > 0; ++d) {
+    const double density = options->densities[d];
+    fill_input_pool(inputPool, poolCount, N, density);
+
+    for (size_t s = 0; s != options->timingSizeCount; ++s) {
+      const size_t size = options->timingSizes[s];
+      if (size == 0) {
+        continue;
+      }
+      context.N = size;
+
+      fprintf(stream, "\nns per byte, %zu bytes, ", size);
+      if (density < 0) {
+        fprintf(stream, "mixed whitespace");
+      } else {
+        fprintf(stream, "%.1f%% whitespace", 100 * density);
+      }
+      fprintf(stream, ", %zu samples after %zu warmup calls:\n", options->repeat, options->warmupRepeat);
+      fprintf(stream, "%-*s  %6s %6s %6s %6s  %-16s  %s\n", functionNameLength, "", "min", "p10", "median", "p90", "95% CI of median", "GB/s at median");
+      for (size_t t = 0; t != variantCount; ++t) {
+        struct Measurement measurement;
+        measure_variant(&variants[t], buffer, &context, &measurement);
+        print_measurement(stream, &variants[t], &measurement, size);
+
+        struct BenchmarkResult* result = &results[resultCount++];
+        snprintf(result->kernel, sizeof(result->kernel), "%s", variants[t].name);
+        result->size = size;
+        result->density = density;
+        result->stats = measurement.stats;
+      }
+
+      enum { maxPreparedCount = 8 };
+      struct PreparedInput prepared[maxPreparedCount];
+      const size_t preparedCount = poolCount < maxPreparedCount ? poolCount : maxPreparedCount;
+      for (size_t p = 0; p != preparedCount; ++p) {
+        prepare_input(&prepared[p], inputPool[p], size);
+      }
+      for (size_t t = 0; t != preparedFunctionsToTestCount; ++t) {
+        const struct KernelVariant variant = { NULL, NULL, NULL, NULL, 0, preparedFunctionsToTest[t].name };
+        struct Measurement measurement;
+        measure_prepared(&preparedFunctionsToTest[t], buffer, &context, prepared, preparedCount, &measurement);
+        print_measurement(stream, &variant, &measurement, size);
+
+        struct BenchmarkResult* result = &results[resultCount++];
+        snprintf(result->kernel, sizeof(result->kernel), "%s", preparedFunctionsToTest[t].name);
+        result->size = size;
+        result->density = density;
+        result->stats = measurement.stats;
+      }
+      for (size_t p = 0; p != preparedCount; ++p) {
+        free_prepared_input(&prepared[p]);
+      }
+
+      if (counters) {
+        fprintf(stream, "\nhardware events over %zu calls:\n", options->repeat);
+        for (size_t t = 0; t != variantCount; ++t) {
+          struct PerfCounterValues values;
+          count_variant_events(&variants[t], buffer, &context, counters, &values);
+          print_event_counts(stream, &variants[t], &values, options->repeat * size);
+        }
+      }
+    }
+  }
+
+  if (options->alignmentSweep && options->densityCount > 0 && options->timingSizeCount > 0) {
+    fill_input_pool(inputPool, poolCount, N, options->densities[0]);
+    context.N = options->timingSizes[0];
+    alignment_sweep(stream, &context, origbuffer, origtmpbuffer, correctbuffer);
+  }
+
 #if defined(__aarch64__)
-  BEST_TIME(neontbl_despace);
+  report_adaptive_crossover(stream, options, results, resultCount);
 #endif
-  BEST_TIME(neon_interleaved_despace);
-  BEST_TIME(neon_unzipping_despace);
-#endif // __ARM_NEON
+  const int status = save_and_compare(stream, options, &environment, results, resultCount);
   fprintf(stream, "\n");
 
+  free(results);
+  perf_counters_close(counters);
+  cache_thrasher_stop(thrasher);
+  free(evictionBuffer);
+  free(samples);
+  for (size_t i = 0; i != poolCount; ++i) {
+    free(inputPool[i]);
+  }
+  free(inputPool);
   free(correctbuffer);
   free(origbuffer);
   free(origtmpbuffer);
+  return status;
 }
-
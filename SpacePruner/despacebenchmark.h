@@ -8,8 +8,44 @@
 #ifndef despacebenchmark_h
 #define despacebenchmark_h
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
+// A density that selects input alternating between runs of 0.1% and 20%
+// whitespace, 1 to 16 KiB long.
+#define DESPACE_MIXED_DENSITY (-1.0)
+
+struct DespaceBenchmarkOptions {
+  size_t repeat;          // timed samples per function
+  size_t warmupRepeat;    // untimed calls before the first sample
+  size_t inputPoolCount;  // distinct pre-generated inputs, used round-robin
+  bool pin;               // pin the timing thread; threads it starts inherit the pinning
+  int cpu;                // CPU to pin to; negative means the current one
+  double noisyThreshold;  // flag results whose (p90 - p10) / median exceeds this
+  double frequencyThreshold; // flag results if the calibration time moved by more than this
+  size_t alignOffset;     // offset of the buffer from a 64-byte boundary
+  bool alignmentSweep;    // also test and time every kernel at offsets 0-63, with and without prologues
+  size_t evictionBytes;   // if nonzero, sweep a buffer this large before each sample to time cold caches
+  size_t thrasherBytes;   // if nonzero, a co-runner thread thrashes a buffer this large while timing
+  const size_t* timingSizes;  // input sizes to time
+  size_t timingSizeCount;
+  const double* densities;    // fractions of whitespace bytes to time, or DESPACE_MIXED_DENSITY
+  size_t densityCount;
+  const char* savePath;       // if set, write the results to this JSON baseline file
+  const char* comparePath;    // if set, compare the results with this JSON baseline file
+  double regressionThreshold; // throughput loss, as a fraction, that counts as a regression
+  bool perfCounters;          // also count hardware events for every kernel (Linux only)
+  const uint64_t* perfRawEvents; // CPU-specific events to count as well
+  size_t perfRawEventCount;
+};
+
+void despace_benchmark_default_options(struct DespaceBenchmarkOptions* options);
+
 void despace_benchmark(FILE* stream);
+// Returns the number of significant regressions against the baseline being
+// compared with, if any, or -1 if a baseline file couldn't be read or written.
+int despace_benchmark_with_options(FILE* stream, const struct DespaceBenchmarkOptions* options);
 
 #endif /* despacebenchmark_h */
@@ -0,0 +1,159 @@
+//
+//  despacebenchmark_main.c
+//  SpacePruner
+//
+//  Command-line front end for despace_benchmark_with_options, for running
+//  outside the app; see the top of despacebenchmark.c for how to build it.
+//
+//  Exits with 1 if a comparison with a baseline found regressions, and 2 on
+//  errors.
+//
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "despacebenchmark.h"
+
+static void usage(FILE* stream, const char* program) {
+  fprintf(stream,
+          "usage: %s [options]\n"
+          "  --repeat N         timed samples per kernel (default 100)\n"
+          "  --warmup N         untimed calls before sampling (default 10)\n"
+          "  --pool N           pre-generated inputs to cycle through (default 16)\n"
+          "  --cpu N            CPU to pin to (default: the current one)\n"
+          "  --no-pin           don't pin, e.g. to time the parallel counter\n"
+          "  --offset N         buffer offset from a 64-byte boundary (default 0)\n"
+          "  --sweep            test and time every offset from 0 to 63\n"
+          "  --evict BYTES      evict caches with a buffer this large before each sample\n"
+          "  --thrash BYTES     run a co-runner thrashing a buffer this large\n"
+          "  --sizes A,B,...    input sizes to time (default 32K)\n"
+          "  --densities A,...  whitespace percentages to time, or \"mixed\" (default 3,mixed);\n"
+          "                     0 times an already-clean buffer; on arm64, ascending\n"
+          "                     percentages also give where neon_despace and\n"
+          "                     neontbl_despace cross over\n"
+          "  --save FILE        write the results to a JSON baseline\n"
+          "  --compare FILE     compare the results with a JSON baseline\n"
+          "  --threshold PCT    throughput loss that counts as a regression (default 5)\n"
+          "  --perf             count hardware events for every kernel (Linux)\n"
+          "  --perf-raw E,...   also count these raw event codes, e.g. 0x0203\n"
+          "Sizes accept K, M and G suffixes.\n",
+          program);
+}
+
+static size_t parse_size(const char* text) {
+  char* end;
+  double value = strtod(text, &end);
+  switch (*end) {
+    case 'G': case 'g': value *= 1024;  // fall through
+    case 'M': case 'm': value *= 1024;  // fall through
+    case 'K': case 'k': value *= 1024;
+  }
+  return (size_t)value;
+}
+
+static size_t count_list(const char* text) {
+  size_t count = 1;
+  for (const char* p = text; *p; ++p) {
+    count += *p == ',';
+  }
+  return count;
+}
+
+int main(int argc, char** argv) {
+  struct DespaceBenchmarkOptions options;
+  despace_benchmark_default_options(&options);
+
+  static const struct option longOptions[] = {
+    { "repeat", required_argument, NULL, 'r' },
+    { "warmup", required_argument, NULL, 'w' },
+    { "pool", required_argument, NULL, 'p' },
+    { "cpu", required_argument, NULL, 'c' },
+    { "no-pin", no_argument, NULL, 'P' },
+    { "offset", required_argument, NULL, 'o' },
+    { "sweep", no_argument, NULL, 'a' },
+    { "evict", required_argument, NULL, 'e' },
+    { "thrash", required_argument, NULL, 't' },
+    { "sizes", required_argument, NULL, 's' },
+    { "densities", required_argument, NULL, 'd' },
+    { "save", required_argument, NULL, 'S' },
+    { "compare", required_argument, NULL, 'C' },
+    { "threshold", required_argument, NULL, 'T' },
+    { "perf", no_argument, NULL, 'E' },
+    { "perf-raw", required_argument, NULL, 'R' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+
+  size_t* sizes = NULL;
+  double* densities = NULL;
+  uint64_t* rawEvents = NULL;
+  int option;
+  while ((option = getopt_long(argc, argv, "h", longOptions, NULL)) != -1) {
+    switch (option) {
+      case 'r': options.repeat = parse_size(optarg); break;
+      case 'w': options.warmupRepeat = parse_size(optarg); break;
+      case 'p': options.inputPoolCount = parse_size(optarg); break;
+      case 'c': options.cpu = atoi(optarg); break;
+      case 'P': options.pin = false; break;
+      case 'o': options.alignOffset = parse_size(optarg); break;
+      case 'a': options.alignmentSweep = true; break;
+      case 'e': options.evictionBytes = parse_size(optarg); break;
+      case 't': options.thrasherBytes = parse_size(optarg); break;
+      case 's': {
+        free(sizes);
+        sizes = malloc(count_list(optarg) * sizeof(size_t));
+        size_t count = 0;
+        for (char* item = strtok(optarg, ","); item; item = strtok(NULL, ",")) {
+          sizes[count++] = parse_size(item);
+        }
+        options.timingSizes = sizes;
+        options.timingSizeCount = count;
+        break;
+      }
+      case 'd': {
+        free(densities);
+        densities = malloc(count_list(optarg) * sizeof(double));
+        size_t count = 0;
+        for (char* item = strtok(optarg, ","); item; item = strtok(NULL, ",")) {
+          densities[count++] = strcmp(item, "mixed") == 0 ? DESPACE_MIXED_DENSITY : atof(item) / 100;
+        }
+        options.densities = densities;
+        options.densityCount = count;
+        break;
+      }
+      case 'S': options.savePath = optarg; break;
+      case 'C': options.comparePath = optarg; break;
+      case 'T': options.regressionThreshold = atof(optarg) / 100; break;
+      case 'E': options.perfCounters = true; break;
+      case 'R': {
+        free(rawEvents);
+        rawEvents = malloc(count_list(optarg) * sizeof(uint64_t));
+        size_t count = 0;
+        for (char* item = strtok(optarg, ","); item; item = strtok(NULL, ",")) {
+          rawEvents[count++] = strtoull(item, NULL, 0);
+        }
+        options.perfCounters = true;
+        options.perfRawEvents = rawEvents;
+        options.perfRawEventCount = count;
+        break;
+      }
+      case 'h':
+        usage(stdout, argv[0]);
+        return 0;
+      default:
+        usage(stderr, argv[0]);
+        return 2;
+    }
+  }
+
+  const int status = despace_benchmark_with_options(stdout, &options);
+  free(sizes);
+  free(densities);
+  free(rawEvents);
+  if (status < 0) {
+    return 2;
+  }
+  return status > 0 ? 1 : 0;
+}
@@ -0,0 +1,180 @@
+//
+//  despaced_view.hpp
+//  SpacePruner
+//
+//  A C++20 view of text without its whitespace (every byte up to 32),
+//  despaced a block at a time as it is read, for feeding parsers without
+//  despacing the whole input first.
+//
+
+#ifndef despaced_view_hpp
+#define despaced_view_hpp
+
+#if defined(__has_include)
+#if __has_include(<version>)
+#include <version>
+#endif
+#endif
+#if !defined(__cpp_lib_ranges) || !defined(__cpp_lib_span)
+#error "despaced_view.hpp needs C++20 ranges and std::span"
+#endif
+
+#include <cstddef>
+#include <iterator>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <type_traits>
+
+extern "C" {
+#include "nontemporal_despacer.h"
+}
+
+namespace spacepruner {
+
+/*
+ Iterating despaces BlockSize source bytes at a time into a buffer in the
+ iterator and walks that, so memory use is fixed whatever the length and
+ the source is read once. Blocks of 64 to 256 bytes keep the buffer in L1
+ while amortizing the kernel call.
+
+ Byte-at-a-time iteration costs a compare per byte on top of the parser's
+ own work; for_each_chunk hands out each despaced block as a span instead,
+ so a parser can run its own loops over contiguous bytes, as it would over
+ a despaced buffer.
+
+ The view only refers to the source, which must outlive it and its
+ iterators.
+ */
+template <std::size_t BlockSize = 256>
+class despaced_view : public std::ranges::view_interface<despaced_view<BlockSize>> {
+  static_assert(BlockSize >= 16, "blocks smaller than a vector are all overhead");
+
+ public:
+  class iterator {
+   public:
+    using iterator_concept = std::input_iterator_tag;
+    using value_type = char;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+
+    char operator*() const {
+      return buffer_[pos_];
+    }
+
+    iterator &operator++() {
+      if (++pos_ == count_) {
+        refill();
+      }
+      return *this;
+    }
+
+    void operator++(int) {
+      ++*this;
+    }
+
+    // Past the end only when the buffer is used up, since it is refilled as
+    // soon as it is.
+    friend bool operator==(const iterator &it, std::default_sentinel_t) {
+      return it.pos_ == it.count_;
+    }
+
+   private:
+    friend class despaced_view;
+
+    explicit iterator(std::string_view source) : next_(source.data()), end_(source.data() + source.size()) {
+      refill();
+    }
+
+    // Skips blocks that are all whitespace.
+    void refill() {
+      pos_ = 0;
+      count_ = 0;
+      while (count_ == 0 && next_ != end_) {
+        const std::size_t howmany = static_cast<std::size_t>(end_ - next_) < BlockSize
+                                        ? static_cast<std::size_t>(end_ - next_) : BlockSize;
+        count_ = despace_to_cached(buffer_, next_, howmany);
+        next_ += howmany;
+      }
+    }
+
+    const char *next_ = nullptr;
+    const char *end_ = nullptr;
+    std::size_t pos_ = 0;
+    std::size_t count_ = 0;
+    char buffer_[BlockSize];
+  };
+
+  despaced_view() = default;
+
+  explicit despaced_view(std::string_view source) : source_(source) {}
+
+  iterator begin() const {
+    return iterator(source_);
+  }
+
+  std::default_sentinel_t end() const {
+    return std::default_sentinel;
+  }
+
+  // The despaced bytes of each block that has any, in order, as a
+  // std::span<const char> that is only valid during the call. If f returns
+  // bool, returning false stops early, and for_each_chunk returns whether
+  // it went to the end.
+  template <typename F>
+  bool for_each_chunk(F &&f) const {
+    char buffer[BlockSize];
+    const char *next = source_.data();
+    std::size_t left = source_.size();
+    while (left != 0) {
+      const std::size_t howmany = left < BlockSize ? left : BlockSize;
+      const std::size_t kept = despace_to_cached(buffer, next, howmany);
+      next += howmany;
+      left -= howmany;
+      if (kept == 0) {
+        continue;
+      }
+      const std::span<const char> chunk(buffer, kept);
+      if constexpr (std::is_same_v<std::invoke_result_t<F &, std::span<const char>>, bool>) {
+        if (!f(chunk)) {
+          return false;
+        }
+      } else {
+        f(chunk);
+      }
+    }
+    return true;
+  }
+
+ private:
+  std::string_view source_;
+};
+
+namespace views {
+
+// text | spacepruner::views::despaced, or spacepruner::views::despaced(text),
+// for anything a std::string_view can be made from.
+struct despaced_fn {
+  despaced_view<> operator()(std::string_view source) const {
+    return despaced_view<>(source);
+  }
+
+  friend despaced_view<> operator|(std::string_view source, const despaced_fn &) {
+    return despaced_view<>(source);
+  }
+};
+
+inline constexpr despaced_fn despaced;
+
+}  // namespace views
+
+}  // namespace spacepruner
+
+// Iterators don't point into the view, so they may outlive it.
+namespace std::ranges {
+template <std::size_t BlockSize>
+inline constexpr bool enable_borrowed_range<spacepruner::despaced_view<BlockSize>> = true;
+}
+
+#endif /* despaced_view_hpp */
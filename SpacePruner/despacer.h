@@ -9,13 +9,21 @@
 static inline size_t despace(char *bytes, size_t howmany) {
   size_t i = 0, pos = 0;
   while (i < howmany) {
-    const char c = bytes[i++];
-    bytes[pos] = c;
+    const unsigned char c = (unsigned char)bytes[i++];
+    bytes[pos] = (char)c;
     pos += (c > 32 ? 1 : 0);
   }
   return pos;
 }
 
+// The number of leading bytes that a kernel should handle one at a time so
+// that its vector loads start on an `alignment`-byte boundary (a power of two).
+static inline size_t despace_prologue_length(const char *bytes, size_t howmany, size_t alignment) {
+  const size_t misalignment = (uintptr_t)bytes & (alignment - 1);
+  const size_t length = misalignment ? alignment - misalignment : 0;
+  return length < howmany ? length : howmany;
+}
+
 #if __ARM_NEON
 // let us go neon
 #include <arm_neon.h>
@@ -52,9 +60,31 @@ static inline uint64_t is_not_zero(uint8x16_t v) {
  * credit: Cyril Lashkevich
  */
 
+// The offset of the first byte that despacing would remove, or howmany if
+// there is none. It only reads, so a kernel that starts compacting from there
+// doesn't store a clean prefix back onto itself: a buffer without whitespace
+// costs a pure read and dirties no cache lines.
+static inline size_t despace_clean_prefix_length(const char *bytes, size_t howmany) {
+  size_t i = 0;
+  const size_t chunk_size = 16 * 4;
+  for (; i + chunk_size <= howmany; i += chunk_size) {
+    uint8x16_t w0 = is_white(vld1q_u8((const uint8_t *)bytes + i));
+    uint8x16_t w1 = is_white(vld1q_u8((const uint8_t *)bytes + i + 16));
+    uint8x16_t w2 = is_white(vld1q_u8((const uint8_t *)bytes + i + 32));
+    uint8x16_t w3 = is_white(vld1q_u8((const uint8_t *)bytes + i + 48));
+    if (is_not_zero(vorrq_u8(vorrq_u8(w0, w1), vorrq_u8(w2, w3)))) {
+      break;
+    }
+  }
+  while (i < howmany && (unsigned char)bytes[i] > 32) {
+    ++i;
+  }
+  return i;
+}
+
 
 static inline size_t neon_despace(char *bytes, size_t howmany) {
-  size_t i = 0, pos = 0;
+  size_t i = despace_clean_prefix_length(bytes, howmany), pos = i;
   const size_t chunk_size = 16 * 4 * 1;
   uint8x16_t justone = vdupq_n_u8(1);
   for (; i + chunk_size <= howmany; /*i += chunk_size*/) {
@@ -252,9 +282,15 @@ static inline uint8_t bytepopcount(uint8x16_t v) {
 #include "bigtable.h"
 
 
-static inline size_t neontbl_despace(char *bytes, size_t howmany) {
-  size_t i = 0, pos = 0;
+static inline size_t neontbl_despace_aligning(char *bytes, size_t howmany, size_t alignment) {
+  size_t i = despace_clean_prefix_length(bytes, howmany), pos = i;
   const size_t chunk_size = 16 * 4 * 1;
+  const size_t prologue = i + despace_prologue_length(bytes + i, howmany - i, alignment);
+  while (i < prologue) {
+    const unsigned char c = bytes[i++];
+    bytes[pos] = c;
+    pos += (c > 32) ? 1 : 0;
+  }
   for (; i + chunk_size <= howmany; i += chunk_size) {
     uint8x16_t vecbytes0 = vld1q_u8((uint8_t *)bytes + i);
     uint8x16_t vecbytes1 = vld1q_u8((uint8_t *)bytes + i + 16);
@@ -298,9 +334,42 @@ static inline size_t neontbl_despace(char *bytes, size_t howmany) {
   }
   return pos;
 }
+
+static inline size_t neontbl_despace(char *bytes, size_t howmany) {
+  return neontbl_despace_aligning(bytes, howmany, 1);
+}
 #endif // defined(__aarch64__)
 
 
+#else // __ARM_NEON
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The same scan as above, for the kernels that also build for x86.
+static inline size_t despace_clean_prefix_length(const char *bytes, size_t howmany) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const size_t chunk_size = 16 * 4;
+  const __m128i nonwhite = _mm_set1_epi8(' ' + 1);
+  for (; i + chunk_size <= howmany; i += chunk_size) {
+    // The minimum is at least 33 exactly when no byte is whitespace.
+    __m128i least = _mm_min_epu8(_mm_loadu_si128((const __m128i *)(bytes + i)),
+                                 _mm_loadu_si128((const __m128i *)(bytes + i + 16)));
+    least = _mm_min_epu8(least, _mm_loadu_si128((const __m128i *)(bytes + i + 32)));
+    least = _mm_min_epu8(least, _mm_loadu_si128((const __m128i *)(bytes + i + 48)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(least, nonwhite), least)) != 0xFFFF) {
+      break;
+    }
+  }
+#endif
+  while (i < howmany && (unsigned char)bytes[i] > 32) {
+    ++i;
+  }
+  return i;
+}
+
 #endif // __ARM_NEON
 
 #endif // end of file
@@ -0,0 +1,156 @@
+//
+//  hex_decoder.c
+//  SpacePruner
+//
+
+#include "hex_decoder.h"
+
+#include <stdbool.h>
+
+#include "despace_vector.h"
+
+enum { HEX_WHITE = 16, HEX_INVALID = 255 };
+
+static uint8_t hex_value(unsigned char c) {
+  if (c <= ' ') {
+    return HEX_WHITE;
+  }
+  if (c >= '0' && c <= '9') {
+    return (uint8_t)(c - '0');
+  }
+  c |= 0x20;
+  if (c >= 'a' && c <= 'f') {
+    return (uint8_t)(c - 'a' + 10);
+  }
+  return HEX_INVALID;
+}
+
+struct HexState {
+  uint8_t *dest;
+  size_t pos;
+  uint8_t high;
+  bool pending;  // high holds a nibble
+};
+
+// Returns the index in chars of the first one that doesn't fit, or howmany.
+static size_t hex_feed(struct HexState *state, const char *chars, size_t howmany) {
+  for (size_t i = 0; i != howmany; ++i) {
+    const uint8_t value = hex_value((unsigned char)chars[i]);
+    if (value < 16) {
+      if (state->pending) {
+        state->dest[state->pos++] = (uint8_t)(state->high << 4 | value);
+      } else {
+        state->high = value;
+      }
+      state->pending = !state->pending;
+    } else if (value != HEX_WHITE) {
+      return i;
+    }
+  }
+  return howmany;
+}
+
+size_t hex_decode_despacing_scalar(uint8_t *dest, const char *source, size_t howmany, size_t *errorOffset) {
+  struct HexState state = { dest, 0, 0, false };
+  const size_t stop = hex_feed(&state, source, howmany);
+  if (stop != howmany || state.pending) {
+    *errorOffset = stop;
+    return SIZE_MAX;
+  }
+  return state.pos;
+}
+
+#if DESPACE_VECTOR
+
+#if defined(__aarch64__)
+
+static inline uint8x16_t in_range(uint8x16_t v, uint8_t low, uint8_t high) {
+  return vandq_u8(vcgeq_u8(v, vdupq_n_u8(low)), vcleq_u8(v, vdupq_n_u8(high)));
+}
+
+// Decodes 16 digits into 8 bytes. Returns false if any of them isn't one.
+static inline bool decode16(const uint8_t *chars, uint8_t *out) {
+  const uint8x16_t v = vld1q_u8(chars);
+  const uint8x16_t digit = in_range(v, '0', '9');
+  const uint8x16_t lowered = vorrq_u8(v, vdupq_n_u8(0x20));
+  const uint8x16_t letter = in_range(lowered, 'a', 'f');
+  if (vminvq_u8(vorrq_u8(digit, letter)) == 0) {
+    return false;
+  }
+  const uint8x16_t nibbles = vorrq_u8(vandq_u8(digit, vsubq_u8(v, vdupq_n_u8('0'))),
+                                      vandq_u8(letter, vsubq_u8(lowered, vdupq_n_u8('a' - 10))));
+  // The first digit of each pair is the low byte of a 16-bit lane.
+  const uint16x8_t pairs = vreinterpretq_u16_u8(nibbles);
+  const uint16x8_t packed = vorrq_u16(vshlq_n_u16(pairs, 4), vshrq_n_u16(pairs, 8));
+  vst1_u8(out, vmovn_u16(packed));
+  return true;
+}
+
+#else  // SSSE3
+
+static inline __m128i in_range(__m128i v, char low, char high) {
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((char)(low - 1))),
+                       _mm_cmplt_epi8(v, _mm_set1_epi8((char)(high + 1))));
+}
+
+static inline bool decode16(const uint8_t *chars, uint8_t *out) {
+  // Bytes from 128 up are negative, so they're in neither range.
+  const __m128i v = _mm_loadu_si128((const __m128i *)chars);
+  const __m128i digit = in_range(v, '0', '9');
+  const __m128i lowered = _mm_or_si128(v, _mm_set1_epi8(0x20));
+  const __m128i letter = in_range(lowered, 'a', 'f');
+  if (_mm_movemask_epi8(_mm_or_si128(digit, letter)) != 0xFFFF) {
+    return false;
+  }
+  const __m128i nibbles = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+                                       _mm_and_si128(letter, _mm_sub_epi8(lowered, _mm_set1_epi8('a' - 10))));
+  // high * 16 + low in every 16 bits, then narrowed to bytes.
+  const __m128i packed = _mm_maddubs_epi16(nibbles, _mm_set1_epi16(0x0110));
+  _mm_storel_epi64((__m128i *)out, _mm_packus_epi16(packed, packed));
+  return true;
+}
+
+#endif
+
+size_t hex_decode_despacing(uint8_t *dest, const char *source, size_t howmany, size_t *errorOffset) {
+  const size_t vectorEnd = howmany - howmany % 16;
+
+  // As in base64_decode_despacing, blocks are compacted a batch at a time so
+  // the loads don't wait on the stores just made.
+  enum { batchLength = 256 };
+  uint8_t stage[batchLength + 32];
+  size_t staged = 0;
+  size_t pos = 0;
+  size_t i = 0;
+  while (i != vectorEnd) {
+    const size_t batchEnd = vectorEnd - i > batchLength ? i + batchLength : vectorEnd;
+    for (; i != batchEnd; i += 16) {
+      size_t kept;
+      store_vector(stage + staged, compact_vector(load_vector((const uint8_t *)source + i), &kept));
+      staged += kept;
+    }
+    size_t done = 0;
+    for (; done + 16 <= staged; done += 16, pos += 8) {
+      if (!decode16(stage + done, dest + pos)) {
+        return hex_decode_despacing_scalar(dest, source, howmany, errorOffset);
+      }
+    }
+    staged -= done;
+    store_vector(stage, load_vector(stage + done));
+  }
+
+  struct HexState state = { dest, pos, 0, false };
+  if (hex_feed(&state, (const char *)stage, staged) != staged
+      || hex_feed(&state, source + i, howmany - i) != howmany - i || state.pending) {
+    return hex_decode_despacing_scalar(dest, source, howmany, errorOffset);
+  }
+  return state.pos;
+}
+
+#else
+
+size_t hex_decode_despacing(uint8_t *dest, const char *source, size_t howmany, size_t *errorOffset) {
+  return hex_decode_despacing_scalar(dest, source, howmany, errorOffset);
+}
+
+#endif // DESPACE_VECTOR
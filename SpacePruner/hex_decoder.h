@@ -0,0 +1,36 @@
+//
+//  hex_decoder.h
+//  SpacePruner
+//
+
+#ifndef hex_decoder_h
+#define hex_decoder_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Room dest needs for decoding howmany characters; the vector kernel may
+// store a few bytes past the end of the result.
+static inline size_t hex_decoded_bound(size_t howmany) {
+  return howmany / 2 + 8;
+}
+
+/*
+ Decodes hexadecimal digits, in either case, from source into dest, two to
+ a byte, high nibble first, skipping whitespace (every byte up to 32)
+ wherever it is, as in "de ad be ef\n" dumps.
+
+ Returns the number of bytes decoded, or SIZE_MAX if the input isn't valid,
+ in which case errorOffset is the offset in source of the first character
+ that isn't a digit or whitespace, or howmany if there's an odd number of
+ digits.
+ */
+size_t hex_decode_despacing_scalar(uint8_t *dest, const char *source, size_t howmany, size_t *errorOffset);
+
+// The same in one pass with vectors: each 16 bytes of input are compacted
+// like despacing does, and every 16 staged digits are checked and packed
+// into 8 bytes. Invalid input is decoded again one character at a time to
+// say where.
+size_t hex_decode_despacing(uint8_t *dest, const char *source, size_t howmany, size_t *errorOffset);
+
+#endif /* hex_decoder_h */
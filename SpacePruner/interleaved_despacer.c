@@ -7,6 +7,7 @@
 
 #include "interleaved_despacer.h"
 
+#include "despacer.h"
 #include <ConditionalMacros.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -17,13 +18,22 @@
 
 #define PRINT_8x8(var) ((void)printf("%s = %02X %02X %02X %02X  %02X %02X %02X %02X\n", #var, var[0], var[1], var[2], var[3], var[4], var[5], var[6], var[7]))
 
-size_t neon_interleaved_despace(char *bytes, size_t howmany) {
+size_t neon_interleaved_despace_aligning(char *bytes, size_t howmany, size_t alignment) {
   const size_t blockSize = 8 * 16;
   const uint8_t space = 32;
 
-  uint8_t* dest = (uint8_t*)bytes;
-  const uint8_t* source = (uint8_t*)bytes;
-  const uint8_t* sourceEnd = source + howmany;
+  const size_t cleanPrefix = despace_clean_prefix_length(bytes, howmany);
+  uint8_t* dest = (uint8_t*)bytes + cleanPrefix;
+  const uint8_t* source = (uint8_t*)bytes + cleanPrefix;
+  const uint8_t* sourceEnd = (uint8_t*)bytes + howmany;
+
+  const uint8_t* prologueEnd = source + despace_prologue_length((const char*)source, howmany - cleanPrefix, alignment);
+  while (source < prologueEnd) {
+    const uint8_t c = *source++;
+    if (c > space) {
+      *dest++ = c;
+    }
+  }
 
   while (sourceEnd - source >= blockSize) {
     /*
@@ -148,7 +158,7 @@ size_t neon_interleaved_despace(char *bytes, size_t howmany) {
     source += blockSize;
   }
   while (source < sourceEnd) {
-    const char c = *source++;
+    const uint8_t c = *source++;
     if (c > space) {
       *dest++ = c;
     }
@@ -156,4 +166,8 @@ size_t neon_interleaved_despace(char *bytes, size_t howmany) {
   return (char*)dest - bytes;
 }
 
+size_t neon_interleaved_despace(char *bytes, size_t howmany) {
+  return neon_interleaved_despace_aligning(bytes, howmany, 1);
+}
+
 #endif
@@ -13,6 +13,10 @@
 
 #if __ARM_NEON
 size_t neon_interleaved_despace(char *bytes, size_t howmany);
+
+// Handles leading bytes one at a time until the source is aligned to
+// `alignment` bytes (a power of two) before entering the vector loop.
+size_t neon_interleaved_despace_aligning(char *bytes, size_t howmany, size_t alignment);
 #endif
 
 #endif /* interleaved_despacer_h */
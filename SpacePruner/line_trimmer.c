@@ -0,0 +1,193 @@
+//
+//  line_trimmer.c
+//  SpacePruner
+//
+
+#include "line_trimmer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "despace_vector.h"
+
+#if !defined(__aarch64__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static inline bool is_blank(unsigned char c) {
+  return c == ' ' || c == '\t';
+}
+
+static inline bool is_line_end(unsigned char c) {
+  return c == '\n' || c == '\r';
+}
+
+size_t trim_line_ends_scalar(char *bytes, size_t howmany) {
+  size_t pos = 0;
+  size_t blanks = 0;  // kept back until we know what follows them
+  for (size_t i = 0; i != howmany; ++i) {
+    const unsigned char c = (unsigned char)bytes[i];
+    if (is_blank(c)) {
+      ++blanks;
+      continue;
+    }
+    if (!is_line_end(c)) {
+      memmove(bytes + pos, bytes + i - blanks, blanks);
+      pos += blanks;
+    }
+    blanks = 0;
+    bytes[pos++] = (char)c;
+  }
+  return pos;
+}
+
+// Bit j of a mask is for byte j of a 64-byte block.
+#if defined(__aarch64__)
+
+static inline uint8x16_t either(uint8x16_t v, uint8_t a, uint8_t b) {
+  return vorrq_u8(vceqq_u8(v, vdupq_n_u8(a)), vceqq_u8(v, vdupq_n_u8(b)));
+}
+
+static inline void classify_block(const uint8_t *p, uint64_t *blank, uint64_t *lineEnd) {
+  const uint8x16_t v0 = vld1q_u8(p), v1 = vld1q_u8(p + 16), v2 = vld1q_u8(p + 32), v3 = vld1q_u8(p + 48);
+  *blank = block_mask(either(v0, ' ', '\t'), either(v1, ' ', '\t'), either(v2, ' ', '\t'), either(v3, ' ', '\t'));
+  *lineEnd = block_mask(either(v0, '\n', '\r'), either(v1, '\n', '\r'), either(v2, '\n', '\r'),
+                        either(v3, '\n', '\r'));
+}
+
+#elif defined(__SSE2__)
+
+static inline void classify_block(const uint8_t *p, uint64_t *blank, uint64_t *lineEnd) {
+  *blank = 0;
+  *lineEnd = 0;
+  for (int k = 0; k != 4; ++k) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+    const __m128i b = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+    const __m128i e = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+    *blank |= (uint64_t)(unsigned)_mm_movemask_epi8(b) << (16 * k);
+    *lineEnd |= (uint64_t)(unsigned)_mm_movemask_epi8(e) << (16 * k);
+  }
+}
+
+#else
+
+static inline void classify_block(const uint8_t *p, uint64_t *blank, uint64_t *lineEnd) {
+  *blank = 0;
+  *lineEnd = 0;
+  for (int j = 0; j != 64; ++j) {
+    *blank |= (uint64_t)is_blank(p[j]) << j;
+    *lineEnd |= (uint64_t)is_line_end(p[j]) << j;
+  }
+}
+
+#endif
+
+// The position of the first byte from `from` on that isn't a space or tab,
+// or howmany.
+static size_t next_nonblank(const uint8_t *data, size_t from, size_t howmany) {
+  for (; from + 64 <= howmany; from += 64) {
+    uint64_t blank, lineEnd;
+    classify_block(data + from, &blank, &lineEnd);
+    if (~blank != 0) {
+      return from + (size_t)__builtin_ctzll(~blank);
+    }
+  }
+  while (from < howmany && is_blank(data[from])) {
+    ++from;
+  }
+  return from;
+}
+
+/*
+ A run of blanks goes if the byte after it ends a line. Adding the lowest bit
+ of every run to the blank mask carries each run up to the bit just above
+ it, so the runs to remove are those whose carry lands on a line end. Only
+ they are visited, which is once per trimmed line.
+
+ A run that reaches the top of the block is settled by looking ahead for the
+ end of it. What's found is kept in the state so that the blocks the run
+ goes on through don't look again.
+ */
+struct TrimState {
+  size_t runEnd;      // end of the last run looked ahead for
+  bool runTrailing;   // and whether it ends a line
+};
+
+static uint64_t remove_mask(struct TrimState *state, const uint8_t *data, size_t i, size_t howmany,
+                            uint64_t blank, uint64_t lineEnd) {
+  uint64_t remove = 0;
+  if (i < state->runEnd) {
+    const size_t covered = state->runEnd - i < 64 ? state->runEnd - i : 64;
+    const uint64_t run = bit_range(0, (unsigned)covered);
+    if (state->runTrailing) {
+      remove = run;
+    }
+    blank &= ~run;
+  }
+  const uint64_t starts = blank & ~(blank << 1);
+  uint64_t landed = (blank + starts) & lineEnd;
+  while (landed != 0) {
+    const unsigned end = (unsigned)__builtin_ctzll(landed);
+    const unsigned start = 63 - (unsigned)__builtin_clzll(starts & ((UINT64_C(1) << end) - 1));
+    remove |= bit_range(start, end);
+    landed &= landed - 1;
+  }
+  if (blank >> 63) {
+    const unsigned start = 63 - (unsigned)__builtin_clzll(starts);
+    state->runEnd = next_nonblank(data, i + 64, howmany);
+    state->runTrailing = state->runEnd == howmany || is_line_end(data[state->runEnd]);
+    if (state->runTrailing) {
+      remove |= bit_range(start, 64);
+    }
+  }
+  return remove;
+}
+
+size_t trim_line_ends(char *bytes, size_t howmany) {
+  uint8_t *data = (uint8_t *)bytes;
+  struct TrimState state = { 0, false };
+  size_t pos = 0;
+  size_t i = 0;
+  for (; i + 64 <= howmany; i += 64) {
+    uint64_t blank, lineEnd;
+    classify_block(data + i, &blank, &lineEnd);
+    const uint64_t remove = blank != 0 || i < state.runEnd
+        ? remove_mask(&state, data, i, howmany, blank, lineEnd) : 0;
+    if (remove == 0) {
+      if (pos != i) {
+        memmove(data + pos, data + i, 64);
+      }
+      pos += 64;
+      continue;
+    }
+#if DESPACE_VECTOR
+    for (int k = 0; k != 4; ++k) {
+      const unsigned keep16 = (unsigned)(~remove >> (16 * k)) & 0xFFFF;
+      store_vector(data + pos, compact_vector_by_mask(load_vector(data + i + 16 * k), keep16));
+      pos += (size_t)__builtin_popcount(keep16);
+    }
+#else
+    for (size_t j = 0; j != 64; ++j) {
+      data[pos] = data[i + j];
+      pos += (~remove >> j) & 1;
+    }
+#endif
+  }
+  if (i < howmany) {
+    // The last block, padded with line ends, since the input's end is one;
+    // so no run reaches its top and nothing is looked ahead for.
+    uint8_t last[64];
+    const size_t count = howmany - i;
+    memcpy(last, data + i, count);
+    memset(last + count, '\n', 64 - count);
+    uint64_t blank, lineEnd;
+    classify_block(last, &blank, &lineEnd);
+    const uint64_t remove = remove_mask(&state, data, i, howmany, blank, lineEnd);
+    for (size_t j = 0; j != count; ++j) {
+      data[pos] = last[j];
+      pos += (~remove >> j) & 1;
+    }
+  }
+  return pos;
+}
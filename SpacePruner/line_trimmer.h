@@ -0,0 +1,23 @@
+//
+//  line_trimmer.h
+//  SpacePruner
+//
+
+#ifndef line_trimmer_h
+#define line_trimmer_h
+
+#include <stddef.h>
+
+/*
+ Removes the spaces and tabs at the end of every line, in place, leaving
+ line feeds and the spacing inside lines alone, like editors and git do
+ for trailing whitespace. A line ends at '\n', at '\r' (so "\r\n" endings
+ lose the blanks before the '\r') or at the end of the input. Returns the
+ new length.
+ */
+size_t trim_line_ends(char *bytes, size_t howmany);
+
+// One byte at a time, for reference.
+size_t trim_line_ends_scalar(char *bytes, size_t howmany);
+
+#endif /* line_trimmer_h */
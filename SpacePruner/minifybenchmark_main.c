@@ -0,0 +1,268 @@
+// gcc -std=gnu11 -O3 -o minifybenchmark minifybenchmark_main.c comment_despacer.c line_trimmer.c whitespace_tokenizer.c best_despacer.c adaptive_despacer.c staged_despacer.c interleaved_despacer.c nontemporal_despacer.c bigtable.c benchmark_timing.c -lm -lpthread
+//
+//  minifybenchmark_main.c
+//  SpacePruner
+//
+//  Times stripping comments along with whitespace, trimming line ends and
+//  splitting on whitespace against plain despacing of the same text, on
+//  generated C-like sources and config files.
+//
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark_timing.h"
+#include "best_despacer.h"
+#include "comment_despacer.h"
+#include "despacer.h"
+#include "line_trimmer.h"
+#include "whitespace_tokenizer.h"
+
+typedef size_t (*minify_function_ptr)(char *bytes, size_t howmany, int syntax);
+
+static size_t despace_best_ignoring_syntax(char *bytes, size_t howmany, int syntax) {
+  (void)syntax;
+  return despace_best(bytes, howmany);
+}
+
+#if defined(__aarch64__)
+static size_t neontbl_despace_ignoring_syntax(char *bytes, size_t howmany, int syntax) {
+  (void)syntax;
+  return neontbl_despace(bytes, howmany);
+}
+#endif
+
+static size_t trim_line_ends_ignoring_syntax(char *bytes, size_t howmany, int syntax) {
+  (void)syntax;
+  return trim_line_ends(bytes, howmany);
+}
+
+static size_t trim_line_ends_scalar_ignoring_syntax(char *bytes, size_t howmany, int syntax) {
+  (void)syntax;
+  return trim_line_ends_scalar(bytes, howmany);
+}
+
+// Where the tokenizers write their offsets, sized for the current input.
+static uint32_t *tokenOffsets;
+static uint32_t *referenceTokenOffsets;
+
+// The tokenizers leave the text alone and return the number of tokens.
+static size_t tokenize_whitespace_ignoring_syntax(char *bytes, size_t howmany, int syntax) {
+  (void)syntax;
+  return tokenize_whitespace(bytes, howmany, tokenOffsets);
+}
+
+static size_t tokenize_whitespace_scalar_ignoring_syntax(char *bytes, size_t howmany, int syntax) {
+  (void)syntax;
+  return tokenize_whitespace_scalar(bytes, howmany, referenceTokenOffsets);
+}
+
+struct MinifierAndName {
+  minify_function_ptr ptr;
+  const char *name;
+  minify_function_ptr reference;  // what its results are checked against, if anything
+};
+
+// The first is what the others are compared with.
+static const struct MinifierAndName minifiers[] = {
+  { despace_best_ignoring_syntax, "despace_best", NULL },
+#if defined(__aarch64__)
+  { neontbl_despace_ignoring_syntax, "neontbl_despace", NULL },
+#endif
+  { comment_despace, "comment_despace", comment_despace_scalar },
+  { comment_despace_scalar, "comment_despace_scalar", NULL },
+  { trim_line_ends_ignoring_syntax, "trim_line_ends", trim_line_ends_scalar_ignoring_syntax },
+  { trim_line_ends_scalar_ignoring_syntax, "trim_line_ends_scalar", NULL },
+  { tokenize_whitespace_ignoring_syntax, "tokenize_whitespace", tokenize_whitespace_scalar_ignoring_syntax },
+  { tokenize_whitespace_scalar_ignoring_syntax, "tokenize_whitespace_scalar", NULL },
+};
+
+static const char *const words[] = {
+  "size_t", "count", "buffer", "return", "if", "(pos", "!=", "i)", "{", "}", "=", "+=", "1;", "mask", "state->mode",
+};
+
+static void append(char *text, size_t *length, size_t capacity, const char *piece) {
+  const size_t pieceLength = strlen(piece);
+  const size_t room = capacity - *length;
+  const size_t copied = pieceLength < room ? pieceLength : room;
+  memcpy(text + *length, piece, copied);
+  *length += copied;
+}
+
+// Indented lines of words, with a string on one line in four, a line
+// comment on one in five and a block comment every twenty lines.
+static void fill_c_source(char *text, size_t size) {
+  size_t length = 0;
+  for (unsigned line = 0; length < size; ++line) {
+    static const char *const indents[] = { "", "  ", "    " };
+    append(text, &length, size, indents[rand() % 3]);
+    if (line % 20 == 0) {
+      append(text, &length, size, "/*\n     * What the next lines do, at some length.\n     */\n    ");
+    }
+    const int wordCount = 2 + rand() % 6;
+    for (int w = 0; w != wordCount; ++w) {
+      append(text, &length, size, words[rand() % (sizeof(words) / sizeof(words[0]))]);
+      append(text, &length, size, " ");
+    }
+    if (line % 4 == 1) {
+      append(text, &length, size, "\"a string // with a slash\" ");
+    }
+    if (line % 5 == 2) {
+      append(text, &length, size, "// why this is so");
+    }
+    append(text, &length, size, "\n");
+  }
+}
+
+// key = value lines, with a comment on one line in three and a quoted value
+// on one in four.
+static void fill_config(char *text, size_t size) {
+  size_t length = 0;
+  for (unsigned line = 0; length < size; ++line) {
+    if (line % 3 == 0) {
+      append(text, &length, size, "# what the next setting is for\n");
+    }
+    append(text, &length, size, words[rand() % (sizeof(words) / sizeof(words[0]))]);
+    append(text, &length, size, line % 4 == 0 ? " = \"a # quoted value\"\n" : " = 42\n");
+  }
+}
+
+struct Input {
+  const char *name;
+  int syntax;
+  void (*fill)(char *text, size_t size);
+};
+
+static size_t parse_size(const char *text) {
+  char *end;
+  double value = strtod(text, &end);
+  switch (*end) {
+    case 'G': case 'g': value *= 1024;  // fall through
+    case 'M': case 'm': value *= 1024;  // fall through
+    case 'K': case 'k': value *= 1024;
+  }
+  return (size_t)value;
+}
+
+// Times minifier on fresh copies of text, returning the median.
+static uint64_t time_minifier(const struct MinifierAndName *minifier, const char *text, char *buffer, size_t size,
+                              int syntax, size_t repeat, uint64_t *samples, double *spread) {
+  for (size_t r = 0; r != repeat; ++r) {
+    memcpy(buffer, text, size);
+    __asm volatile("" ::: "memory");
+    const uint64_t start = time_in_ns();
+    minifier->ptr(buffer, size, syntax);
+    samples[r] = time_in_ns() - start;
+    __asm volatile("" ::: "memory");
+  }
+  struct BenchmarkStats stats;
+  compute_benchmark_stats(samples, repeat, &stats);
+  *spread = benchmark_stats_spread(&stats);
+  return stats.median;
+}
+
+static void usage(FILE *stream, const char *program) {
+  fprintf(stream,
+          "usage: %s [options]\n"
+          "  --repeat N         timed samples per kernel (default 100)\n"
+          "  --sizes A,B,...    input sizes to time (default 32K,1M)\n"
+          "Sizes accept K, M and G suffixes.\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  static const struct option longOptions[] = {
+    { "repeat", required_argument, NULL, 'r' },
+    { "sizes", required_argument, NULL, 's' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  size_t repeat = 100;
+  size_t sizes[16] = { 32 * 1024, 1 << 20 };
+  size_t sizeCount = 2;
+  int option;
+  while ((option = getopt_long(argc, argv, "h", longOptions, NULL)) != -1) {
+    switch (option) {
+      case 'r': repeat = parse_size(optarg); break;
+      case 's':
+        sizeCount = 0;
+        for (char *item = strtok(optarg, ","); item && sizeCount != 16; item = strtok(NULL, ",")) {
+          sizes[sizeCount++] = parse_size(item);
+        }
+        break;
+      case 'h':
+        usage(stdout, argv[0]);
+        return 0;
+      default:
+        usage(stderr, argv[0]);
+        return 2;
+    }
+  }
+  if (repeat == 0) {
+    usage(stderr, argv[0]);
+    return 2;
+  }
+
+  pin_current_thread_to_cpu(-1);
+  wait_for_stable_frequency(500 * 1000 * 1000);
+  const struct Input inputs[] = {
+    { "C source", DESPACE_COMMENTS_C, fill_c_source },
+    { "config", DESPACE_COMMENTS_HASH, fill_config },
+  };
+  uint64_t *samples = malloc(repeat * sizeof(uint64_t));
+  bool ok = samples != NULL;
+  srand(1234);
+  for (size_t n = 0; n != sizeof(inputs) / sizeof(inputs[0]) && ok; ++n) {
+    for (size_t s = 0; s != sizeCount && ok; ++s) {
+      const size_t size = sizes[s];
+      char *text = malloc(size + 1);
+      char *buffer = malloc(size + 1);
+      char *expected = malloc(size + 1);
+      tokenOffsets = malloc(whitespace_token_capacity(size) * sizeof(uint32_t));
+      referenceTokenOffsets = malloc(whitespace_token_capacity(size) * sizeof(uint32_t));
+      if (text == NULL || buffer == NULL || expected == NULL || tokenOffsets == NULL
+          || referenceTokenOffsets == NULL) {
+        ok = false;
+      } else {
+        inputs[n].fill(text, size);
+        printf("\n%s, %zu bytes\n", inputs[n].name, size);
+        uint64_t baseline = 0;
+        for (size_t m = 0; m != sizeof(minifiers) / sizeof(minifiers[0]); ++m) {
+          const struct MinifierAndName *minifier = &minifiers[m];
+          if (minifier->reference != NULL) {
+            memcpy(expected, text, size);
+            const size_t expectedLength = minifier->reference(expected, size, inputs[n].syntax);
+            memcpy(buffer, text, size);
+            const size_t length = minifier->ptr(buffer, size, inputs[n].syntax);
+            // Tokens are two offsets each.
+            if (length != expectedLength || memcmp(buffer, expected, length) != 0
+                || (minifier->ptr == tokenize_whitespace_ignoring_syntax
+                    && memcmp(tokenOffsets, referenceTokenOffsets, 2 * length * sizeof(uint32_t)) != 0)) {
+              printf("%s: wrong result\n", minifier->name);
+              ok = false;
+              continue;
+            }
+          }
+          double spread;
+          const uint64_t median = time_minifier(minifier, text, buffer, size, inputs[n].syntax, repeat, samples,
+                                                &spread);
+          if (m == 0) {
+            baseline = median;
+          }
+          printf("%-28s %8.3f ns/byte %8.2f GB/s %6.2fx  spread %5.1f%%\n", minifier->name,
+                 (double)median / (double)size, (double)size / (double)median, (double)median / (double)baseline,
+                 100 * spread);
+        }
+      }
+      free(text);
+      free(buffer);
+      free(expected);
+      free(tokenOffsets);
+      free(referenceTokenOffsets);
+    }
+  }
+  free(samples);
+  return ok ? 0 : 2;
+}
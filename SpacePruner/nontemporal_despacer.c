@@ -0,0 +1,145 @@
+//
+//  nontemporal_despacer.c
+//  SpacePruner
+//
+
+#include "nontemporal_despacer.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "despace_vector.h"
+
+#ifndef __has_builtin
+#define __has_builtin(x) 0
+#endif
+
+#if defined(__aarch64__)
+static inline void stream_vector(uint8_t *p, despace_vector v) {
+#if __has_builtin(__builtin_nontemporal_store)
+  // clang pairs these into stnp.
+  __builtin_nontemporal_store(v, (despace_vector *)p);
+#else
+  __asm volatile("stnp %d0, %d1, [%2]" :: "w"(vget_low_u8(v)), "w"(vget_high_u8(v)), "r"(p) : "memory");
+#endif
+}
+
+static inline void finish_streaming(void) {
+  __asm volatile("dmb ishst" ::: "memory");
+}
+
+#elif defined(__SSSE3__)
+static inline void stream_vector(uint8_t *p, despace_vector v) {
+  _mm_stream_si128((__m128i *)p, v);
+}
+
+static inline void finish_streaming(void) {
+  _mm_sfence();
+}
+
+#endif
+
+#if DESPACE_VECTOR
+
+size_t despace_to_cached(char *dest, const char *source, size_t howmany) {
+  const uint8_t *input = (const uint8_t *)source;
+  uint8_t *output = (uint8_t *)dest;
+  const size_t chunk_size = 16 * 4;
+  size_t i = 0, pos = 0;
+  for (; i + chunk_size <= howmany; i += chunk_size) {
+    size_t kept0, kept1, kept2, kept3;
+    const despace_vector reshuf0 = compact_vector(load_vector(input + i), &kept0);
+    const despace_vector reshuf1 = compact_vector(load_vector(input + i + 16), &kept1);
+    const despace_vector reshuf2 = compact_vector(load_vector(input + i + 32), &kept2);
+    const despace_vector reshuf3 = compact_vector(load_vector(input + i + 48), &kept3);
+    store_vector(output + pos, reshuf0);
+    pos += kept0;
+    store_vector(output + pos, reshuf1);
+    pos += kept1;
+    store_vector(output + pos, reshuf2);
+    pos += kept2;
+    store_vector(output + pos, reshuf3);
+    pos += kept3;
+  }
+  while (i < howmany) {
+    pos = despace_byte_to(dest, pos, input[i++]);
+  }
+  return pos;
+}
+
+size_t despace_to_nontemporal(char *dest, const char *source, size_t howmany) {
+  const uint8_t *input = (const uint8_t *)source;
+  uint8_t *output = (uint8_t *)dest;
+  const size_t chunk_size = 16 * 4;
+  const size_t lineSize = 64;
+  size_t i = 0, pos = 0;
+
+  // Regular stores until the output reaches a cache line boundary.
+  while (i < howmany && ((uintptr_t)(output + pos) & (lineSize - 1)) != 0) {
+    pos = despace_byte_to(dest, pos, input[i++]);
+  }
+
+  // Fewer than 64 bytes are staged between chunks, and a chunk adds at most
+  // 64, so two lines are enough.
+  uint8_t __attribute__((aligned(64))) stage[2 * 64];
+  size_t staged = 0;
+  for (; i + chunk_size <= howmany; i += chunk_size) {
+    size_t kept0, kept1, kept2, kept3;
+    const despace_vector reshuf0 = compact_vector(load_vector(input + i), &kept0);
+    const despace_vector reshuf1 = compact_vector(load_vector(input + i + 16), &kept1);
+    const despace_vector reshuf2 = compact_vector(load_vector(input + i + 32), &kept2);
+    const despace_vector reshuf3 = compact_vector(load_vector(input + i + 48), &kept3);
+    store_vector(stage + staged, reshuf0);
+    staged += kept0;
+    store_vector(stage + staged, reshuf1);
+    staged += kept1;
+    store_vector(stage + staged, reshuf2);
+    staged += kept2;
+    store_vector(stage + staged, reshuf3);
+    staged += kept3;
+
+    if (staged >= lineSize) {
+      stream_vector(output + pos, load_vector(stage));
+      stream_vector(output + pos + 16, load_vector(stage + 16));
+      stream_vector(output + pos + 32, load_vector(stage + 32));
+      stream_vector(output + pos + 48, load_vector(stage + 48));
+      pos += lineSize;
+      staged -= lineSize;
+      store_vector(stage, load_vector(stage + 64));
+      store_vector(stage + 16, load_vector(stage + 80));
+      store_vector(stage + 32, load_vector(stage + 96));
+      store_vector(stage + 48, load_vector(stage + 112));
+    }
+  }
+  finish_streaming();
+
+  memcpy(output + pos, stage, staged);
+  pos += staged;
+  while (i < howmany) {
+    pos = despace_byte_to(dest, pos, input[i++]);
+  }
+  return pos;
+}
+
+#else
+
+size_t despace_to_cached(char *dest, const char *source, size_t howmany) {
+  size_t pos = 0;
+  for (size_t i = 0; i < howmany; ++i) {
+    pos = despace_byte_to(dest, pos, (unsigned char)source[i]);
+  }
+  return pos;
+}
+
+size_t despace_to_nontemporal(char *dest, const char *source, size_t howmany) {
+  return despace_to_cached(dest, source, howmany);
+}
+
+#endif // DESPACE_VECTOR
+
+size_t despace_to(char *dest, const char *source, size_t howmany) {
+  if (howmany >= DESPACE_NONTEMPORAL_THRESHOLD) {
+    return despace_to_nontemporal(dest, source, howmany);
+  }
+  return despace_to_cached(dest, source, howmany);
+}
@@ -0,0 +1,37 @@
+//
+//  nontemporal_despacer.h
+//  SpacePruner
+//
+
+#ifndef nontemporal_despacer_h
+#define nontemporal_despacer_h
+
+#include <stddef.h>
+
+// Outputs at least this large are assumed not to be read again before they
+// would be evicted anyway, so despace_to writes them with non-temporal stores.
+#ifndef DESPACE_NONTEMPORAL_THRESHOLD
+#define DESPACE_NONTEMPORAL_THRESHOLD (16 * 1024 * 1024)
+#endif
+
+// These copy the bytes of source that despacing keeps to dest, which must not
+// overlap it and must have room for howmany bytes. They return the number of
+// bytes kept.
+//
+// Stores go at most DESPACE_TO_SLACK bytes past the last one kept, so a
+// caller that has counted those (despace_count) can size dest to fit.
+#define DESPACE_TO_SLACK 16
+
+// Regular stores, which keep the output in the cache.
+size_t despace_to_cached(char *dest, const char *source, size_t howmany);
+
+// Collects the output in a 64-byte-aligned staging buffer and writes whole
+// cache lines with non-temporal stores (stnp on arm64, movntdq on x86), which
+// avoid reading the destination lines for ownership and don't evict anything.
+// Falls back to despace_to_cached where there is no vector code.
+size_t despace_to_nontemporal(char *dest, const char *source, size_t howmany);
+
+// Picks one of the above by size.
+size_t despace_to(char *dest, const char *source, size_t howmany);
+
+#endif /* nontemporal_despacer_h */
@@ -0,0 +1,254 @@
+//
+//  parallel_despacer.c
+//  SpacePruner
+//
+
+#include "parallel_despacer.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "best_despacer.h"
+#include "despace_counter.h"
+#include "nontemporal_despacer.h"
+
+// Below this, a thread costs more to start than it saves.
+static const size_t minBytesPerThread = 4 * 1024 * 1024;
+enum { maxThreadCount = 64 };
+
+struct DespaceSlice {
+  char *dest;
+  const char *source;
+  size_t howmany;
+  size_t kept;
+  bool nontemporal;
+};
+
+// Runs work on each of count items of itemSize bytes, the first on the
+// calling thread, and the others on threads of their own when those can be
+// started.
+static void run_in_threads(void *(*work)(void *), void *items, size_t itemSize, size_t count) {
+  pthread_t threads[maxThreadCount];
+  bool started[maxThreadCount];
+  for (size_t t = 1; t != count; ++t) {
+    started[t] = pthread_create(&threads[t], NULL, work, (char *)items + t * itemSize) == 0;
+  }
+  work(items);
+  for (size_t t = 1; t != count; ++t) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    } else {
+      work((char *)items + t * itemSize);
+    }
+  }
+}
+
+static size_t choose_thread_count(size_t howmany, size_t threadCount) {
+  if (threadCount == 0) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threadCount = cpus > 0 ? (size_t)cpus : 1;
+  }
+  if (threadCount > howmany / minBytesPerThread) {
+    threadCount = howmany / minBytesPerThread;
+  }
+  if (threadCount > maxThreadCount) {
+    threadCount = maxThreadCount;
+  }
+  return threadCount > 0 ? threadCount : 1;
+}
+
+static void split_into_slices(struct DespaceSlice *slices, char *dest, const char *source, size_t howmany,
+                              size_t threadCount) {
+  const size_t sliceSize = howmany / threadCount;
+  for (size_t t = 0; t != threadCount; ++t) {
+    slices[t].dest = dest + t * sliceSize;
+    slices[t].source = source + t * sliceSize;
+    slices[t].howmany = (t + 1 == threadCount) ? howmany - t * sliceSize : sliceSize;
+    // The output as a whole decides, since it is what won't be read again
+    // before it would be evicted.
+    slices[t].nontemporal = howmany >= DESPACE_NONTEMPORAL_THRESHOLD;
+  }
+}
+
+static void *count_slice(void *context) {
+  struct DespaceSlice *slice = context;
+  slice->kept = despace_count(slice->source, slice->howmany);
+  return NULL;
+}
+
+/*
+ Writes exactly the slice's kept bytes at dest, which it shares with the
+ slices on either side: the kernels store up to DESPACE_TO_SLACK bytes past
+ the last byte kept, so the bytes that make up the last DESPACE_TO_SLACK of
+ the output are copied one at a time after the rest, over what the kernel
+ left there.
+ */
+static void *despace_slice_to(void *context) {
+  struct DespaceSlice *slice = context;
+  const unsigned char *source = (const unsigned char *)slice->source;
+  size_t tail = slice->howmany;
+  for (size_t kept = 0; tail != 0 && kept != DESPACE_TO_SLACK; --tail) {
+    kept += source[tail - 1] > 32;
+  }
+  size_t pos = 0;
+  if (tail != 0) {
+    pos = slice->nontemporal ? despace_to_nontemporal(slice->dest, slice->source, tail)
+                             : despace_to_cached(slice->dest, slice->source, tail);
+  }
+  for (size_t i = tail; i != slice->howmany; ++i) {
+    if (source[i] > 32) {
+      slice->dest[pos++] = (char)source[i];
+    }
+  }
+  return NULL;
+}
+
+static void *despace_slice_in_place(void *context) {
+  struct DespaceSlice *slice = context;
+  slice->kept = despace_best(slice->dest, slice->howmany);
+  return NULL;
+}
+
+/*
+ In place, each slice is despaced where it is and the slices are then moved
+ down together. The output is split into one range per thread, and each
+ thread fills its range from whichever slices' bytes belong there. Bytes
+ only ever move down, so a thread's range is only overwritten by itself and
+ by threads before it, which are done reading it; what a thread reads from
+ the ranges after its own, it copies aside first, and all threads do that
+ before any starts moving.
+ */
+struct MoveRange {
+  const struct DespaceSlice *slices;
+  size_t sliceCount;
+  char *bytes;
+  size_t from;
+  size_t to;
+  size_t savedFrom;   // output from here on is copied to saved first
+  char *saved;
+};
+
+// Where slice t's kept bytes go, as a position in the output.
+static size_t output_start(const struct MoveRange *range, size_t t) {
+  return (size_t)(range->slices[t].dest - range->bytes);
+}
+
+// Copies output positions [from, to) from the despaced slices to into.
+static void copy_output(const struct MoveRange *range, size_t from, size_t to, char *into) {
+  for (size_t t = 0; t != range->sliceCount; ++t) {
+    const size_t start = output_start(range, t);
+    const size_t lo = from > start ? from : start;
+    const size_t end = start + range->slices[t].kept;
+    const size_t hi = to < end ? to : end;
+    if (lo >= hi) {
+      continue;
+    }
+    const char *source = range->slices[t].source + (lo - start);
+    if (into + (lo - from) != source) {
+      memmove(into + (lo - from), source, hi - lo);
+    }
+  }
+}
+
+// The first output position in the range whose byte lies past the range, in
+// another thread's part of the output.
+static size_t first_from_later_range(const struct MoveRange *range) {
+  for (size_t t = 0; t != range->sliceCount; ++t) {
+    const size_t start = output_start(range, t);
+    const size_t lo = range->from > start ? range->from : start;
+    const size_t end = start + range->slices[t].kept;
+    const size_t hi = range->to < end ? range->to : end;
+    if (lo >= hi) {
+      continue;
+    }
+    // Output position p of this slice comes from p + shift.
+    const size_t shift = (size_t)(range->slices[t].source - range->bytes) - start;
+    const size_t first = range->to > shift && range->to - shift > lo ? range->to - shift : lo;
+    if (first < hi) {
+      return first;
+    }
+  }
+  return range->to;
+}
+
+static void *save_range(void *context) {
+  struct MoveRange *range = context;
+  if (range->savedFrom != range->to) {
+    copy_output(range, range->savedFrom, range->to, range->saved);
+  }
+  return NULL;
+}
+
+static void *move_range(void *context) {
+  struct MoveRange *range = context;
+  copy_output(range, range->from, range->savedFrom, range->bytes + range->from);
+  if (range->savedFrom != range->to) {
+    memcpy(range->bytes + range->savedFrom, range->saved, range->to - range->savedFrom);
+  }
+  return NULL;
+}
+
+static size_t move_together(char *bytes, const struct DespaceSlice *slices, size_t threadCount, size_t total) {
+  struct MoveRange ranges[maxThreadCount];
+  bool ok = true;
+  for (size_t t = 0; t != threadCount; ++t) {
+    ranges[t].slices = slices;
+    ranges[t].sliceCount = threadCount;
+    ranges[t].bytes = bytes;
+    ranges[t].from = total / threadCount * t;
+    ranges[t].to = (t + 1 == threadCount) ? total : total / threadCount * (t + 1);
+    ranges[t].savedFrom = first_from_later_range(&ranges[t]);
+    ranges[t].saved = NULL;
+    if (ok && ranges[t].savedFrom != ranges[t].to) {
+      ranges[t].saved = malloc(ranges[t].to - ranges[t].savedFrom);
+      ok = ranges[t].saved != NULL;
+    }
+  }
+  if (ok) {
+    run_in_threads(&save_range, ranges, sizeof(ranges[0]), threadCount);
+    run_in_threads(&move_range, ranges, sizeof(ranges[0]), threadCount);
+  } else {
+    // Without memory to copy aside, one slice after another.
+    copy_output(&ranges[0], 0, total, bytes);
+  }
+  for (size_t t = 0; t != threadCount; ++t) {
+    free(ranges[t].saved);
+  }
+  return total;
+}
+
+size_t despace_parallel(char *bytes, size_t howmany, size_t threadCount) {
+  threadCount = choose_thread_count(howmany, threadCount);
+  if (threadCount == 1) {
+    return despace_best(bytes, howmany);
+  }
+  struct DespaceSlice slices[maxThreadCount];
+  split_into_slices(slices, bytes, bytes, howmany, threadCount);
+  run_in_threads(&despace_slice_in_place, slices, sizeof(slices[0]), threadCount);
+  size_t total = 0;
+  for (size_t t = 0; t != threadCount; ++t) {
+    slices[t].dest = bytes + total;
+    total += slices[t].kept;
+  }
+  return move_together(bytes, slices, threadCount, total);
+}
+
+size_t despace_to_parallel(char *dest, const char *source, size_t howmany, size_t threadCount) {
+  threadCount = choose_thread_count(howmany, threadCount);
+  if (threadCount == 1) {
+    return despace_to(dest, source, howmany);
+  }
+  struct DespaceSlice slices[maxThreadCount];
+  split_into_slices(slices, dest, source, howmany, threadCount);
+  run_in_threads(&count_slice, slices, sizeof(slices[0]), threadCount);
+  size_t total = 0;
+  for (size_t t = 0; t != threadCount; ++t) {
+    slices[t].dest = dest + total;
+    total += slices[t].kept;
+  }
+  run_in_threads(&despace_slice_to, slices, sizeof(slices[0]), threadCount);
+  return total;
+}
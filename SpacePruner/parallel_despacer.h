@@ -0,0 +1,27 @@
+//
+//  parallel_despacer.h
+//  SpacePruner
+//
+
+#ifndef parallel_despacer_h
+#define parallel_despacer_h
+
+#include <stddef.h>
+
+/*
+ These split the input among threadCount threads, or one per online CPU if
+ threadCount is 0, and use fewer for inputs too small to be worth it.
+ */
+
+// In place. Each thread despaces its own slice with the best kernel, and the
+// threads then move the slices together, each filling its share of the
+// output.
+size_t despace_parallel(char *bytes, size_t howmany, size_t threadCount);
+
+// Into dest, which must not overlap source and must have room for howmany
+// bytes. Each thread counts its slice, then despaces it straight to where it
+// goes in dest, with non-temporal stores if the input is at least
+// DESPACE_NONTEMPORAL_THRESHOLD. Nothing is stored past the last byte kept.
+size_t despace_to_parallel(char *dest, const char *source, size_t howmany, size_t threadCount);
+
+#endif /* parallel_despacer_h */
@@ -0,0 +1,142 @@
+//
+//  perf_counters.c
+//  SpacePruner
+//
+
+#include "perf_counters.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct PerfCounters {
+  size_t count;
+  int fds[PERF_COUNTER_MAX];
+  char names[PERF_COUNTER_MAX][32];
+};
+
+static int open_event(uint32_t type, uint64_t config, int groupFd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = groupFd < 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+static void add_event(struct PerfCounters *counters, uint32_t type, uint64_t config, const char *name) {
+  if (counters->count == PERF_COUNTER_MAX) {
+    return;
+  }
+  // The first event leads the group, so that they are all scheduled together.
+  const int fd = open_event(type, config, counters->count > 0 ? counters->fds[0] : -1);
+  if (fd < 0) {
+    return;
+  }
+  counters->fds[counters->count] = fd;
+  snprintf(counters->names[counters->count], sizeof(counters->names[0]), "%s", name);
+  ++counters->count;
+}
+
+struct PerfCounters *perf_counters_open(const uint64_t *rawEvents, size_t rawEventCount) {
+  struct PerfCounters *counters = calloc(1, sizeof(*counters));
+  if (!counters) {
+    return NULL;
+  }
+  add_event(counters, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles");
+  if (counters->count == 0) {
+    free(counters);
+    return NULL;
+  }
+  add_event(counters, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions");
+  add_event(counters, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses");
+  add_event(counters, PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            "L1d-misses");
+  for (size_t i = 0; i != rawEventCount; ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "raw 0x%llx", (unsigned long long)rawEvents[i]);
+    add_event(counters, PERF_TYPE_RAW, rawEvents[i], name);
+  }
+  return counters;
+}
+
+void perf_counters_enable(struct PerfCounters *counters) {
+  ioctl(counters->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void perf_counters_disable(struct PerfCounters *counters) {
+  ioctl(counters->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void perf_counters_reset(struct PerfCounters *counters) {
+  ioctl(counters->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+}
+
+void perf_counters_read(const struct PerfCounters *counters, struct PerfCounterValues *values) {
+  // With PERF_FORMAT_GROUP, the leader reads the number of events and then
+  // every value, in the order they were opened.
+  uint64_t buffer[1 + PERF_COUNTER_MAX];
+  memset(values, 0, sizeof(*values));
+  const ssize_t length = read(counters->fds[0], buffer, sizeof(buffer));
+  if (length < (ssize_t)sizeof(uint64_t)) {
+    return;
+  }
+  const size_t count = buffer[0] < counters->count ? (size_t)buffer[0] : counters->count;
+  for (size_t i = 0; i != count; ++i) {
+    values->names[i] = counters->names[i];
+    values->values[i] = buffer[1 + i];
+  }
+  values->count = count;
+}
+
+void perf_counters_close(struct PerfCounters *counters) {
+  if (!counters) {
+    return;
+  }
+  for (size_t i = counters->count; i != 0; --i) {
+    close(counters->fds[i - 1]);
+  }
+  free(counters);
+}
+
+#else
+
+struct PerfCounters *perf_counters_open(const uint64_t *rawEvents, size_t rawEventCount) {
+  (void)rawEvents;
+  (void)rawEventCount;
+  return NULL;
+}
+
+void perf_counters_enable(struct PerfCounters *counters) {
+  (void)counters;
+}
+
+void perf_counters_disable(struct PerfCounters *counters) {
+  (void)counters;
+}
+
+void perf_counters_reset(struct PerfCounters *counters) {
+  (void)counters;
+}
+
+void perf_counters_read(const struct PerfCounters *counters, struct PerfCounterValues *values) {
+  (void)counters;
+  memset(values, 0, sizeof(*values));
+}
+
+void perf_counters_close(struct PerfCounters *counters) {
+  (void)counters;
+}
+
+#endif // defined(__linux__)
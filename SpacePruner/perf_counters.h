@@ -0,0 +1,40 @@
+//
+//  perf_counters.h
+//  SpacePruner
+//
+
+#ifndef perf_counters_h
+#define perf_counters_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hardware event counts for the calling thread, via perf_event_open on Linux.
+struct PerfCounters;
+
+enum { PERF_COUNTER_MAX = 8 };
+
+struct PerfCounterValues {
+  size_t count;
+  const char *names[PERF_COUNTER_MAX];
+  uint64_t values[PERF_COUNTER_MAX];
+};
+
+/*
+ Counts cycles, instructions, branch misses and L1 data cache read misses,
+ plus any raw, CPU-specific event codes: for instance 0x0203
+ (ld_blocks.store_forward) or 0x0241 (mem_inst_retired.split_stores) on recent
+ Intel cores, or 0x24 (stall_backend) on arm64. Events the CPU doesn't have
+ are left out. Returns NULL if there are no counters at all, e.g. on other
+ platforms or when perf_event_paranoid forbids them. The counters start
+ disabled.
+ */
+struct PerfCounters *perf_counters_open(const uint64_t *rawEvents, size_t rawEventCount);
+
+void perf_counters_enable(struct PerfCounters *counters);
+void perf_counters_disable(struct PerfCounters *counters);
+void perf_counters_reset(struct PerfCounters *counters);
+void perf_counters_read(const struct PerfCounters *counters, struct PerfCounterValues *values);
+void perf_counters_close(struct PerfCounters *counters);
+
+#endif /* perf_counters_h */
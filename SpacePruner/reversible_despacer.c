@@ -0,0 +1,275 @@
+//
+//  reversible_despacer.c
+//  SpacePruner
+//
+
+#include "reversible_despacer.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "despace_vector.h"
+
+enum { maxVarintLength = 10 };
+
+static inline size_t put_varint(uint8_t *out, uint64_t value) {
+  size_t length = 0;
+  while (value >= 0x80) {
+    out[length++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[length++] = (uint8_t)value;
+  return length;
+}
+
+size_t despace_side_channel_bound(size_t howmany) {
+  // The worst case is a lone whitespace byte after every kept byte: three
+  // bytes of side channel for every two of input.
+  return howmany + howmany / 2 + 2 * maxVarintLength + 2;
+}
+
+/*
+ A run is classified as its bytes go by, since despacing in place may store
+ over them before the run ends. Only when it stops being repetitive are its
+ bytes written out, to a payload area that leaves room for the header in
+ front of it.
+ */
+struct RunEncoder {
+  uint8_t *side;
+  size_t sideLength;
+  size_t lastRunEnd;  // input position after the previous run
+  bool inRun;
+  size_t length;
+  int kind;
+  uint8_t value;
+  size_t headerAt;    // where the header goes, after the gap
+};
+
+static void begin_run(struct RunEncoder *encoder, size_t start) {
+  encoder->inRun = true;
+  encoder->length = 0;
+  encoder->headerAt = encoder->sideLength + put_varint(encoder->side + encoder->sideLength,
+                                                       start - encoder->lastRunEnd);
+}
+
+static inline uint8_t *run_payload(struct RunEncoder *encoder) {
+  return encoder->side + encoder->headerAt + maxVarintLength;
+}
+
+static void extend_run(struct RunEncoder *encoder, const uint8_t *bytes, size_t count) {
+  size_t k = 0;
+  if (encoder->length == 0) {
+    encoder->value = bytes[0];
+    encoder->kind = DESPACE_RUN_REPEATED;
+    encoder->length = 1;
+    k = 1;
+  }
+  for (; k < count && encoder->kind != DESPACE_RUN_RAW; ++k) {
+    const uint8_t c = bytes[k];
+    if (c == encoder->value) {
+      ++encoder->length;
+    } else if (encoder->length == 1 && encoder->value == '\n') {
+      encoder->kind = DESPACE_RUN_INDENTATION;
+      encoder->value = c;
+      ++encoder->length;
+    } else {
+      uint8_t *payload = run_payload(encoder);
+      size_t filled = 0;
+      if (encoder->kind == DESPACE_RUN_INDENTATION) {
+        payload[filled++] = '\n';
+      }
+      memset(payload + filled, encoder->value, encoder->length - filled);
+      encoder->kind = DESPACE_RUN_RAW;
+      break;
+    }
+  }
+  if (encoder->kind == DESPACE_RUN_RAW) {
+    memcpy(run_payload(encoder) + encoder->length, bytes + k, count - k);
+    encoder->length += count - k;
+  }
+}
+
+static void end_run(struct RunEncoder *encoder, size_t end) {
+  uint8_t *header = encoder->side + encoder->headerAt;
+  const size_t headerLength = put_varint(header, ((uint64_t)encoder->length << 2) | (uint64_t)encoder->kind);
+  if (encoder->kind == DESPACE_RUN_RAW) {
+    memmove(header + headerLength, run_payload(encoder), encoder->length);
+    encoder->sideLength = encoder->headerAt + headerLength + encoder->length;
+  } else {
+    header[headerLength] = encoder->value;
+    encoder->sideLength = encoder->headerAt + headerLength + 1;
+  }
+  encoder->inRun = false;
+  encoder->lastRunEnd = end;
+}
+
+// Feeds the runs in the count bytes at offset, whose whitespace is mask,
+// to the encoder. They're read before the block is compacted.
+static void encode_block(struct RunEncoder *encoder, const uint8_t *block, size_t offset, uint64_t mask,
+                         size_t count) {
+  size_t bit = 0;
+  while (bit < count) {
+    if (encoder->inRun) {
+      const uint64_t rest = ~mask >> bit;
+      const size_t end = rest == 0 ? 64 : bit + (size_t)__builtin_ctzll(rest);
+      const size_t stop = end < count ? end : count;
+      if (stop > bit) {
+        extend_run(encoder, block + bit, stop - bit);
+      }
+      if (stop == count) {
+        return;
+      }
+      end_run(encoder, offset + stop);
+      bit = stop;
+    } else {
+      const uint64_t rest = mask >> bit;
+      if (rest == 0) {
+        return;
+      }
+      bit += (size_t)__builtin_ctzll(rest);
+      begin_run(encoder, offset + bit);
+    }
+  }
+}
+
+size_t despace_reversible(char *bytes, size_t howmany, uint8_t *side, size_t *sideLength) {
+  uint8_t *data = (uint8_t *)bytes;
+  struct RunEncoder encoder = { side, 0, 0, false, 0, DESPACE_RUN_REPEATED, 0, 0 };
+  size_t pos = 0;
+  size_t i = 0;
+  for (; i + 64 <= howmany; i += 64) {
+    const uint64_t mask = white_block_mask(data + i);
+    if (mask == 0) {
+      if (encoder.inRun) {
+        end_run(&encoder, i);
+      }
+      if (pos != i) {
+        memmove(data + pos, data + i, 64);
+      }
+      pos += 64;
+      continue;
+    }
+    encode_block(&encoder, data + i, i, mask, 64);
+#if DESPACE_VECTOR
+    size_t kept0, kept1, kept2, kept3;
+    const despace_vector reshuf0 = compact_vector(load_vector(data + i), &kept0);
+    const despace_vector reshuf1 = compact_vector(load_vector(data + i + 16), &kept1);
+    const despace_vector reshuf2 = compact_vector(load_vector(data + i + 32), &kept2);
+    const despace_vector reshuf3 = compact_vector(load_vector(data + i + 48), &kept3);
+    store_vector(data + pos, reshuf0);
+    pos += kept0;
+    store_vector(data + pos, reshuf1);
+    pos += kept1;
+    store_vector(data + pos, reshuf2);
+    pos += kept2;
+    store_vector(data + pos, reshuf3);
+    pos += kept3;
+#else
+    for (size_t j = 0; j != 64; ++j) {
+      pos = despace_byte_to(bytes, pos, data[i + j]);
+    }
+#endif
+  }
+  if (i < howmany) {
+    const size_t count = howmany - i;
+    uint64_t mask = 0;
+    for (size_t j = 0; j != count; ++j) {
+      mask |= (uint64_t)(data[i + j] <= ' ') << j;
+    }
+    encode_block(&encoder, data + i, i, mask, count);
+    for (; i < howmany; ++i) {
+      pos = despace_byte_to(bytes, pos, data[i]);
+    }
+  }
+  if (encoder.inRun) {
+    end_run(&encoder, howmany);
+  }
+  *sideLength = encoder.sideLength;
+  return pos;
+}
+
+static inline bool get_varint(const uint8_t *side, size_t sideLength, size_t *at, uint64_t *value) {
+  uint64_t result = 0;
+  for (unsigned shift = 0; shift < 64 && *at < sideLength; shift += 7) {
+    const uint8_t byte = side[(*at)++];
+    result |= (uint64_t)(byte & 0x7F) << shift;
+    if (byte < 0x80) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ Most gaps and runs are short, so where there's room past both ends they're
+ copied or filled 16 bytes at a time, which compiles to single vector loads
+ and stores, rather than through memcpy and memset with their length
+ dispatch. The bytes past the end are overwritten by what comes next.
+ */
+static inline void copy_bytes(char *dest, size_t destRoom, const char *source, size_t sourceRoom, size_t count) {
+  if (count <= 256 && destRoom >= count + 16 && sourceRoom >= count + 16) {
+    for (size_t k = 0; k < count; k += 16) {
+      memcpy(dest + k, source + k, 16);
+    }
+  } else {
+    memcpy(dest, source, count);
+  }
+}
+
+static inline void fill_bytes(char *dest, size_t destRoom, uint8_t value, size_t count) {
+  if (count <= 16 && destRoom >= 16) {
+    memset(dest, value, 16);
+  } else {
+    memset(dest, value, count);
+  }
+}
+
+size_t despace_restore(char *dest, size_t capacity, const char *kept, size_t keptLength,
+                       const uint8_t *side, size_t sideLength) {
+  size_t pos = 0;   // in dest
+  size_t from = 0;  // in kept
+  size_t at = 0;    // in side
+  while (at < sideLength) {
+    uint64_t gap, header;
+    // Short gaps and runs have one-byte varints.
+    if (at + 2 < sideLength && (side[at] | side[at + 1]) < 0x80) {
+      gap = side[at];
+      header = side[at + 1];
+      at += 2;
+    } else if (!get_varint(side, sideLength, &at, &gap) || !get_varint(side, sideLength, &at, &header)) {
+      return SIZE_MAX;
+    }
+    const uint64_t length = header >> 2;
+    const unsigned kind = (unsigned)(header & 3);
+    if (gap > keptLength - from || gap > capacity - pos || length > capacity - pos - gap || length == 0
+        || at == sideLength) {
+      return SIZE_MAX;
+    }
+    copy_bytes(dest + pos, capacity - pos, kept + from, keptLength - from, (size_t)gap);
+    pos += (size_t)gap;
+    from += (size_t)gap;
+
+    if (kind == DESPACE_RUN_RAW) {
+      if (length > sideLength - at) {
+        return SIZE_MAX;
+      }
+      copy_bytes(dest + pos, capacity - pos, (const char *)side + at, sideLength - at, (size_t)length);
+      at += (size_t)length;
+    } else if (kind == DESPACE_RUN_INDENTATION) {
+      dest[pos] = '\n';
+      fill_bytes(dest + pos + 1, capacity - pos - 1, side[at++], (size_t)length - 1);
+    } else if (kind == DESPACE_RUN_REPEATED) {
+      fill_bytes(dest + pos, capacity - pos, side[at++], (size_t)length);
+    } else {
+      return SIZE_MAX;
+    }
+    pos += (size_t)length;
+  }
+  const size_t rest = keptLength - from;
+  if (rest > capacity - pos) {
+    return SIZE_MAX;
+  }
+  memcpy(dest + pos, kept + from, rest);
+  return pos + rest;
+}
@@ -0,0 +1,46 @@
+//
+//  reversible_despacer.h
+//  SpacePruner
+//
+
+#ifndef reversible_despacer_h
+#define reversible_despacer_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ Despacing that can be undone. Alongside the kept bytes, a side channel
+ records every run of whitespace as
+
+   varint(gap) varint(length << 2 | kind) payload
+
+ where gap counts the kept bytes since the previous run, varints are LEB128,
+ and kind says what the payload is:
+
+   0  the run is one byte repeated: that byte
+   1  the run is a line feed then one byte repeated (indentation): that byte
+   2  anything else: the run's bytes
+
+ so typical source text costs two or three bytes of side channel per run.
+ */
+
+enum { DESPACE_RUN_REPEATED = 0, DESPACE_RUN_INDENTATION = 1, DESPACE_RUN_RAW = 2 };
+
+// Room the side channel may need for howmany input bytes.
+size_t despace_side_channel_bound(size_t howmany);
+
+// Despaces bytes in place like despace, writing the side channel to side,
+// which must have room for despace_side_channel_bound(howmany) bytes.
+// The runs are found from a 64-bit whitespace mask per 64-byte block, so
+// blocks without whitespace cost one compare.
+size_t despace_reversible(char *bytes, size_t howmany, uint8_t *side, size_t *sideLength);
+
+// Rebuilds the original from the kept bytes and the side channel into dest,
+// which must not overlap them. Bytes of dest past the original, up to
+// capacity, may be overwritten. Returns the original length, or SIZE_MAX if
+// the side channel is malformed or the original wouldn't fit in capacity.
+size_t despace_restore(char *dest, size_t capacity, const char *kept, size_t keptLength,
+                       const uint8_t *side, size_t sideLength);
+
+#endif /* reversible_despacer_h */
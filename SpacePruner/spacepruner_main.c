@@ -0,0 +1,480 @@
+// gcc -std=gnu11 -O3 -o spacepruner spacepruner_main.c despace_pipeline.c despace_tree.c despace_uring.c parallel_despacer.c despace_counter.c best_despacer.c nontemporal_despacer.c staged_despacer.c adaptive_despacer.c interleaved_despacer.c bigtable.c benchmark_timing.c -lpthread -lm
+//
+//  spacepruner_main.c
+//  SpacePruner
+//
+//  Removes whitespace (every byte up to 32) from a file, in place through a
+//  shared mapping, or into another file, or filters stdin to stdout, or
+//  copies many files into a directory, or does a whole directory tree.
+//
+//  Exits with 2 on errors.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "benchmark_timing.h"
+#include "best_despacer.h"
+#include "despace_pipeline.h"
+#include "despace_tree.h"
+#include "despace_uring.h"
+#include "parallel_despacer.h"
+
+static void usage(FILE* stream, const char* program) {
+  fprintf(stream,
+          "usage: %s [options] [FILE]\n"
+          "       %s [options] --into DIR FILE...\n"
+          "       %s [options] -r [--into DIR] ROOT\n"
+          "Removes whitespace from FILE in place, or copies stdin to stdout without it\n"
+          "if FILE is - or missing, or copies each FILE into DIR without it, or does\n"
+          "every file under ROOT, in place or into a copy of the tree at DIR.\n"
+          "  -o, --output FILE   write the result to FILE instead and leave the input alone\n"
+          "  -d, --into DIR      write each FILE to DIR under its own name\n"
+          "      --engine NAME   how to copy into DIR: threads (default), uring,\n"
+          "                      or compare to time both\n"
+          "      --queue N       buffers in flight for --engine uring (default 16)\n"
+          "  -r, --recursive     despace the tree under ROOT\n"
+          "      --piece SIZE    split files under ROOT into pieces this large (default 8M)\n"
+          "      --budget SIZE   bytes of files under ROOT in flight at once (default 256M)\n"
+          "      --per-file      report the time each file under ROOT took\n"
+          "  -j, --threads N     threads for large files (default: one per CPU),\n"
+          "                      or despacing threads for stdin (default 1)\n"
+          "      --buffer SIZE   buffer size for stdin and DIR (default 1M)\n"
+          "      --buffers N     buffers in flight for stdin and --engine threads (default 8)\n"
+          "      --splice        gift output to a pipe with vmsplice rather than write() it\n"
+          "      --no-hugepages  don't ask for transparent huge pages\n"
+          "  -v, --verbose       report the sizes and throughput on stderr\n"
+          "Sizes accept K and M suffixes.\n",
+          program, program, program);
+}
+
+enum PrunerEngine { ENGINE_THREADS, ENGINE_URING, ENGINE_COMPARE };
+
+struct PrunerOptions {
+  const char* outputPath;
+  const char* directory;
+  enum PrunerEngine engine;
+  size_t threadCount;
+  struct DespacePipelineOptions pipeline;
+  struct DespaceUringOptions uring;
+  struct DespaceTreeOptions tree;
+  bool recursive;
+  bool perFile;
+  bool hugePages;
+  bool verbose;
+};
+
+// Both are only hints, so failures don't matter.
+static void advise(void* address, size_t length, const struct PrunerOptions* options) {
+  madvise(address, length, MADV_SEQUENTIAL);
+#if defined(MADV_HUGEPAGE)
+  if (options->hugePages) {
+    madvise(address, length, MADV_HUGEPAGE);
+  }
+#else
+  (void)options;
+#endif
+}
+
+static int fail(const char* what, const char* path) {
+  fprintf(stderr, "spacepruner: %s %s: %s\n", what, path, strerror(errno));
+  return 2;
+}
+
+// Whether path names the file described by status, perhaps through a link.
+static bool is_same_file(const char* path, const struct stat* status) {
+  struct stat other;
+  return stat(path, &other) == 0 && other.st_dev == status->st_dev && other.st_ino == status->st_ino;
+}
+
+static int prune_in_place(const char* path, const struct PrunerOptions* options, size_t* before, size_t* after) {
+  const int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    return fail("can't open", path);
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    close(fd);
+    return fail("can't stat", path);
+  }
+  const size_t length = (size_t)status.st_size;
+  *before = *after = length;
+  if (length == 0) {
+    close(fd);
+    return 0;
+  }
+
+  char* bytes = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (bytes == MAP_FAILED) {
+    close(fd);
+    return fail("can't map", path);
+  }
+  advise(bytes, length, options);
+  *after = despace_parallel(bytes, length, options->threadCount);
+  munmap(bytes, length);
+
+  // Unmapping writes the pages back; truncating drops what's past the result.
+  if (ftruncate(fd, (off_t)*after) != 0) {
+    close(fd);
+    return fail("can't truncate", path);
+  }
+  close(fd);
+  return 0;
+}
+
+static int prune_to_file(const char* path, const struct PrunerOptions* options, size_t* before, size_t* after) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return fail("can't open", path);
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    close(fd);
+    return fail("can't stat", path);
+  }
+  // Opening the output would truncate the input before it was read.
+  if (is_same_file(options->outputPath, &status)) {
+    close(fd);
+    return prune_in_place(path, options, before, after);
+  }
+  const size_t length = (size_t)status.st_size;
+  *before = *after = 0;
+
+  const int outputFd = open(options->outputPath, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (outputFd < 0) {
+    close(fd);
+    return fail("can't create", options->outputPath);
+  }
+  *before = length;
+  if (length == 0) {
+    close(outputFd);
+    close(fd);
+    return 0;
+  }
+
+  // The output can't be longer than the input, so map that much and cut it
+  // down afterwards.
+  int result = 0;
+  const char* source = MAP_FAILED;
+  char* dest = MAP_FAILED;
+  if (ftruncate(outputFd, (off_t)length) != 0) {
+    result = fail("can't resize", options->outputPath);
+    goto done;
+  }
+  source = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (source == MAP_FAILED) {
+    result = fail("can't map", path);
+    goto done;
+  }
+  dest = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, outputFd, 0);
+  if (dest == MAP_FAILED) {
+    result = fail("can't map", options->outputPath);
+    goto done;
+  }
+  advise((void*)source, length, options);
+  advise(dest, length, options);
+  *after = despace_to_parallel(dest, source, length, options->threadCount);
+  if (ftruncate(outputFd, (off_t)*after) != 0) {
+    result = fail("can't truncate", options->outputPath);
+  }
+
+done:
+  if (dest != MAP_FAILED) {
+    munmap(dest, length);
+  }
+  if (source != MAP_FAILED) {
+    munmap((void*)source, length);
+  }
+  close(outputFd);
+  close(fd);
+  return result;
+}
+
+static size_t parse_size(const char* text) {
+  char* end;
+  size_t value = (size_t)strtoull(text, &end, 10);
+  switch (*end) {
+    case 'M': case 'm': value *= 1024;  // fall through
+    case 'K': case 'k': value *= 1024;
+  }
+  return value;
+}
+
+static int prune_stream(const struct PrunerOptions* options, size_t* before, size_t* after) {
+  struct DespacePipelineOptions pipelineOptions = options->pipeline;
+  if (options->threadCount > 0) {
+    pipelineOptions.workerCount = options->threadCount;
+  }
+  struct DespacePipelineStats stats;
+  const int error = despace_pipeline(STDIN_FILENO, STDOUT_FILENO, &pipelineOptions, &stats);
+  *before = (size_t)stats.bytesIn;
+  *after = (size_t)stats.bytesOut;
+  if (error != 0) {
+    errno = error;
+    return fail("can't filter", "stdin");
+  }
+  return 0;
+}
+
+// Where --into puts the copy of path.
+static char* path_into(const char* directory, const char* path) {
+  const char* slash = strrchr(path, '/');
+  const char* name = slash ? slash + 1 : path;
+  const size_t length = strlen(directory) + 1 + strlen(name) + 1;
+  char* result = malloc(length);
+  if (result) {
+    snprintf(result, length, "%s/%s", directory, name);
+  }
+  return result;
+}
+
+// One file at a time, each through the reading, despacing and writing threads.
+static int prune_files_threads(char* const* paths, char* const* outputs, size_t count,
+                               const struct PrunerOptions* options, size_t* before, size_t* after) {
+  struct DespacePipelineOptions pipelineOptions = options->pipeline;
+  if (options->threadCount > 0) {
+    pipelineOptions.workerCount = options->threadCount;
+  }
+  for (size_t i = 0; i != count; ++i) {
+    const int fd = open(paths[i], O_RDONLY);
+    if (fd < 0) {
+      return fail("can't open", paths[i]);
+    }
+    const int outputFd = open(outputs[i], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (outputFd < 0) {
+      close(fd);
+      return fail("can't create", outputs[i]);
+    }
+    struct DespacePipelineStats stats;
+    const int error = despace_pipeline(fd, outputFd, &pipelineOptions, &stats);
+    close(outputFd);
+    close(fd);
+    *before += (size_t)stats.bytesIn;
+    *after += (size_t)stats.bytesOut;
+    if (error != 0) {
+      errno = error;
+      return fail("can't copy", paths[i]);
+    }
+  }
+  return 0;
+}
+
+static int prune_files_uring(char* const* paths, char* const* outputs, size_t count,
+                             const struct PrunerOptions* options, size_t* before, size_t* after) {
+  struct DespaceUringOptions uringOptions = options->uring;
+  if (options->threadCount > 0) {
+    uringOptions.workerCount = options->threadCount;
+  }
+  struct DespaceUringStats stats;
+  const int error = despace_files_uring((const char* const*)paths, (const char* const*)outputs, count,
+                                        &uringOptions, &stats);
+  *before += (size_t)stats.bytesIn;
+  *after += (size_t)stats.bytesOut;
+  if (error != 0) {
+    errno = error;
+    return fail("can't copy into", options->directory);
+  }
+  if (options->verbose) {
+    fprintf(stderr, "io_uring: %s buffers, %s files\n", stats.registeredBuffers ? "registered" : "plain",
+            stats.fixedFiles ? "fixed" : "plain");
+  }
+  return 0;
+}
+
+static void report(const char* what, size_t before, size_t after, uint64_t elapsed) {
+  const double seconds = (double)elapsed / 1e9;
+  fprintf(stderr, "%s: %zu -> %zu bytes (%.1f%% removed) in %.3f s, %.2f GB/s with %s\n",
+          what, before, after, before > 0 ? 100.0 * (double)(before - after) / (double)before : 0.0,
+          seconds, elapsed > 0 ? (double)before / (double)elapsed : 0.0, despace_best_name());
+}
+
+static int prune_into(char* const* paths, size_t count, const struct PrunerOptions* options) {
+  char** outputs = calloc(count, sizeof(char*));
+  int status = 0;
+  for (size_t i = 0; i != count && outputs; ++i) {
+    outputs[i] = path_into(options->directory, paths[i]);
+    if (!outputs[i]) {
+      status = fail("can't name the copy of", paths[i]);
+      break;
+    }
+  }
+  if (!outputs) {
+    status = fail("can't copy into", options->directory);
+  }
+  // A file's copy in its own directory would be truncated before it was read.
+  for (size_t i = 0; i != count && status == 0; ++i) {
+    struct stat input;
+    if (stat(paths[i], &input) == 0 && is_same_file(outputs[i], &input)) {
+      fprintf(stderr, "spacepruner: %s would be its own copy in %s\n", paths[i], options->directory);
+      status = 2;
+    }
+  }
+
+  static const char* const engineNames[] = { "threads", "io_uring" };
+  for (int engine = ENGINE_THREADS; engine <= ENGINE_URING && status == 0; ++engine) {
+    if (options->engine != ENGINE_COMPARE && options->engine != (enum PrunerEngine)engine) {
+      continue;
+    }
+    size_t before = 0, after = 0;
+    const uint64_t start = time_in_ns();
+    status = engine == ENGINE_THREADS ? prune_files_threads(paths, outputs, count, options, &before, &after)
+                                      : prune_files_uring(paths, outputs, count, options, &before, &after);
+    const uint64_t elapsed = time_in_ns() - start;
+    if (status == 0 && (options->verbose || options->engine == ENGINE_COMPARE)) {
+      report(engineNames[engine], before, after, elapsed);
+    }
+  }
+
+  for (size_t i = 0; i != count && outputs; ++i) {
+    free(outputs[i]);
+  }
+  free(outputs);
+  return status;
+}
+
+static void report_file(const char* path, uint64_t before, uint64_t after, uint64_t nanoseconds, void* context) {
+  (void)context;
+  fprintf(stderr, "%s: %llu -> %llu bytes in %.3f ms\n", path, (unsigned long long)before,
+          (unsigned long long)after, (double)nanoseconds / 1e6);
+}
+
+static int prune_tree(const char* root, const struct PrunerOptions* options) {
+  struct DespaceTreeOptions treeOptions = options->tree;
+  treeOptions.outputRoot = options->directory;
+  treeOptions.threadCount = options->threadCount;
+  if (options->perFile) {
+    treeOptions.fileDone = &report_file;
+  }
+  struct DespaceTreeStats stats;
+  const uint64_t start = time_in_ns();
+  const int error = despace_tree(root, &treeOptions, &stats);
+  const uint64_t elapsed = time_in_ns() - start;
+  if (error == EINVAL && options->directory && strcmp(stats.failedPath, options->directory) == 0) {
+    fprintf(stderr, "spacepruner: %s is %s or inside it\n", options->directory, root);
+    return 2;
+  }
+  if (error != 0) {
+    errno = error;
+    return fail("can't despace", stats.failedPath[0] ? stats.failedPath : root);
+  }
+  if (options->verbose) {
+    char what[64];
+    snprintf(what, sizeof(what), "%llu files", (unsigned long long)stats.files);
+    report(what, (size_t)stats.bytesIn, (size_t)stats.bytesOut, elapsed);
+    fprintf(stderr, "per file: %.3f ms median, %.3f ms p99, %.3f ms max\n", (double)stats.medianLatency / 1e6,
+            (double)stats.p99Latency / 1e6, (double)stats.maxLatency / 1e6);
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  struct PrunerOptions options = { NULL, NULL, ENGINE_THREADS, 0, { 0, 0, 0, false }, { 0, 0, 0 }, { NULL, 0, 0, 0, NULL, NULL }, false, false, true, false };
+  despace_pipeline_default_options(&options.pipeline);
+  despace_uring_default_options(&options.uring);
+  despace_tree_default_options(&options.tree);
+
+  static const struct option longOptions[] = {
+    { "output", required_argument, NULL, 'o' },
+    { "into", required_argument, NULL, 'd' },
+    { "engine", required_argument, NULL, 'e' },
+    { "queue", required_argument, NULL, 'q' },
+    { "recursive", no_argument, NULL, 'r' },
+    { "piece", required_argument, NULL, 'P' },
+    { "budget", required_argument, NULL, 'B' },
+    { "per-file", no_argument, NULL, 'F' },
+    { "threads", required_argument, NULL, 'j' },
+    { "buffer", required_argument, NULL, 'b' },
+    { "buffers", required_argument, NULL, 'n' },
+    { "splice", no_argument, NULL, 'N' },
+    { "no-hugepages", no_argument, NULL, 'H' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+
+  int option;
+  while ((option = getopt_long(argc, argv, "o:d:j:rvh", longOptions, NULL)) != -1) {
+    switch (option) {
+      case 'o': options.outputPath = optarg; break;
+      case 'd': options.directory = optarg; break;
+      case 'e':
+        if (strcmp(optarg, "threads") == 0) {
+          options.engine = ENGINE_THREADS;
+        } else if (strcmp(optarg, "uring") == 0) {
+          options.engine = ENGINE_URING;
+        } else if (strcmp(optarg, "compare") == 0) {
+          options.engine = ENGINE_COMPARE;
+        } else {
+          usage(stderr, argv[0]);
+          return 2;
+        }
+        break;
+      case 'q': options.uring.queueDepth = (unsigned)strtoul(optarg, NULL, 10); break;
+      case 'r': options.recursive = true; break;
+      case 'P': options.tree.pieceSize = parse_size(optarg); break;
+      case 'B': options.tree.byteBudget = parse_size(optarg); break;
+      case 'F': options.perFile = true; break;
+      case 'j': options.threadCount = (size_t)strtoul(optarg, NULL, 10); break;
+      case 'b': options.pipeline.bufferSize = options.uring.bufferSize = parse_size(optarg); break;
+      case 'n': options.pipeline.bufferCount = parse_size(optarg); break;
+      case 'N': options.pipeline.spliceOutput = true; break;
+      case 'H': options.hugePages = false; break;
+      case 'v': options.verbose = true; break;
+      case 'h':
+        usage(stdout, argv[0]);
+        return 0;
+      default:
+        usage(stderr, argv[0]);
+        return 2;
+    }
+  }
+  if (options.recursive) {
+    if (optind + 1 != argc || options.outputPath) {
+      usage(stderr, argv[0]);
+      return 2;
+    }
+    return prune_tree(argv[optind], &options);
+  }
+  if (options.directory) {
+    if (optind == argc || options.outputPath) {
+      usage(stderr, argv[0]);
+      return 2;
+    }
+    return prune_into(argv + optind, (size_t)(argc - optind), &options);
+  }
+  if (optind + 1 < argc) {
+    usage(stderr, argv[0]);
+    return 2;
+  }
+  const char* path = optind < argc ? argv[optind] : "-";
+  const bool filter = strcmp(path, "-") == 0;
+  if (filter && options.outputPath) {
+    usage(stderr, argv[0]);
+    return 2;
+  }
+
+  size_t before = 0, after = 0;
+  const uint64_t start = time_in_ns();
+  int status;
+  if (filter) {
+    status = prune_stream(&options, &before, &after);
+  } else if (options.outputPath) {
+    status = prune_to_file(path, &options, &before, &after);
+  } else {
+    status = prune_in_place(path, &options, &before, &after);
+  }
+  const uint64_t elapsed = time_in_ns() - start;
+
+  if (status == 0 && options.verbose) {
+    report(path, before, after, elapsed);
+  }
+  return status;
+}
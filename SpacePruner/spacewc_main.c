@@ -0,0 +1,174 @@
+// gcc -std=gnu11 -O3 -o spacewc spacewc_main.c despace_counter.c -lpthread
+//
+//  spacewc_main.c
+//  SpacePruner
+//
+//  Counts lines, words and bytes like wc, and what despacing would keep,
+//  without changing anything. Words are runs of bytes above 32.
+//
+//  Exits with 2 on errors.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "despace_counter.h"
+
+static void usage(FILE* stream, const char* program) {
+  fprintf(stream,
+          "usage: %s [options] [FILE...]\n"
+          "Counts each FILE, or stdin if FILE is - or missing, and prints the counts\n"
+          "in the order below, then the totals if there are several files.\n"
+          "  -l, --lines         count line feeds\n"
+          "  -w, --words         count runs of bytes above 32\n"
+          "  -k, --kept          count the bytes despacing would keep\n"
+          "  -c, --bytes         count all bytes\n"
+          "  -j, --threads N     threads per file (default: one per CPU)\n"
+          "Without -l, -w, -k or -c, prints lines, words and bytes.\n",
+          program);
+}
+
+enum { SHOW_LINES = 1, SHOW_WORDS = 2, SHOW_KEPT = 4, SHOW_BYTES = 8 };
+
+static int fail(const char* what, const char* path) {
+  fprintf(stderr, "spacewc: %s %s: %s\n", what, path, strerror(errno));
+  return 2;
+}
+
+static void print_counts(const struct TextCounts* counts, int show, const char* name) {
+  const uint64_t values[] = { counts->lines, counts->words, counts->kept, counts->bytes };
+  for (int k = 0; k != 4; ++k) {
+    if (show & (1 << k)) {
+      printf(" %7llu", (unsigned long long)values[k]);
+    }
+  }
+  printf(name != NULL ? " %s\n" : "\n", name);
+}
+
+static int count_stream(int fd, const char* name, struct TextCounts* counts) {
+  enum { bufferSize = 1 << 20 };
+  char* buffer = malloc(bufferSize);
+  if (buffer == NULL) {
+    return fail("no memory for", name);
+  }
+  struct TextCounter counter;
+  text_counter_init(&counter);
+  int result = 0;
+  for (;;) {
+    const ssize_t got = read(fd, buffer, bufferSize);
+    if (got == 0) {
+      break;
+    }
+    if (got < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      result = fail("can't read", name);
+      break;
+    }
+    text_counter_update(&counter, buffer, (size_t)got);
+  }
+  free(buffer);
+  *counts = counter.counts;
+  return result;
+}
+
+// Maps regular files and reads anything else.
+static int count_file(const char* path, size_t threadCount, struct TextCounts* counts) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return fail("can't open", path);
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    close(fd);
+    return fail("can't stat", path);
+  }
+  const size_t length = (size_t)status.st_size;
+  if (!S_ISREG(status.st_mode) || length == 0) {
+    const int result = count_stream(fd, path, counts);
+    close(fd);
+    return result;
+  }
+  const char* bytes = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (bytes == MAP_FAILED) {
+    close(fd);
+    return fail("can't map", path);
+  }
+  // Only a hint, so failure doesn't matter.
+  madvise((void*)bytes, length, MADV_SEQUENTIAL);
+  count_text_parallel(bytes, length, threadCount, counts);
+  munmap((void*)bytes, length);
+  close(fd);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  static const struct option longOptions[] = {
+    { "lines", no_argument, NULL, 'l' },
+    { "words", no_argument, NULL, 'w' },
+    { "kept", no_argument, NULL, 'k' },
+    { "bytes", no_argument, NULL, 'c' },
+    { "threads", required_argument, NULL, 'j' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  int show = 0;
+  size_t threadCount = 0;
+  int option;
+  while ((option = getopt_long(argc, argv, "lwkcj:h", longOptions, NULL)) != -1) {
+    switch (option) {
+      case 'l': show |= SHOW_LINES; break;
+      case 'w': show |= SHOW_WORDS; break;
+      case 'k': show |= SHOW_KEPT; break;
+      case 'c': show |= SHOW_BYTES; break;
+      case 'j': threadCount = (size_t)strtoul(optarg, NULL, 10); break;
+      case 'h':
+        usage(stdout, argv[0]);
+        return 0;
+      default:
+        usage(stderr, argv[0]);
+        return 2;
+    }
+  }
+  if (show == 0) {
+    show = SHOW_LINES | SHOW_WORDS | SHOW_BYTES;
+  }
+
+  if (optind == argc) {
+    struct TextCounts counts;
+    const int result = count_stream(STDIN_FILENO, "stdin", &counts);
+    if (result == 0) {
+      print_counts(&counts, show, NULL);
+    }
+    return result;
+  }
+  int result = 0;
+  struct TextCounts total = { 0, 0, 0, 0 };
+  for (int i = optind; i != argc; ++i) {
+    struct TextCounts counts;
+    const int fileResult = strcmp(argv[i], "-") == 0 ? count_stream(STDIN_FILENO, "stdin", &counts)
+                                                     : count_file(argv[i], threadCount, &counts);
+    if (fileResult != 0) {
+      result = fileResult;
+      continue;
+    }
+    print_counts(&counts, show, argv[i]);
+    total.lines += counts.lines;
+    total.words += counts.words;
+    total.kept += counts.kept;
+    total.bytes += counts.bytes;
+  }
+  if (argc - optind > 1) {
+    print_counts(&total, show, "total");
+  }
+  return result;
+}
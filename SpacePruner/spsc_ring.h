@@ -0,0 +1,151 @@
+//
+//  spsc_ring.h
+//  SpacePruner
+//
+
+#ifndef spsc_ring_h
+#define spsc_ring_h
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/*
+ A bounded queue of pointers with exactly one producer thread and one
+ consumer thread, and no locks on the way through: each side only writes its
+ own index, and publishes it with release ordering after touching the slot.
+
+ A side that has waited a while sleeps on a condition variable instead, and
+ the other side only takes the lock to wake it when sleepers says someone
+ is there. The sleeper counts itself before checking the indices again and
+ the other side fences between moving its index and reading sleepers, so
+ one of the two always sees the other.
+ */
+struct SpscRing {
+  void **slots;
+  size_t mask;  // capacity - 1, capacity being a power of two
+  // On separate cache lines, so that the two threads don't fight over them.
+  _Alignas(64) atomic_size_t head;  // next slot to read, written by the consumer
+  _Alignas(64) atomic_size_t tail;  // next slot to write, written by the producer
+  _Alignas(64) atomic_uint sleepers;
+  pthread_mutex_t lock;
+  pthread_cond_t moved;  // head or tail moved
+};
+
+// Room for at least minCapacity pointers. Returns false if out of memory.
+static inline bool spsc_ring_init(struct SpscRing *ring, size_t minCapacity) {
+  size_t capacity = 1;
+  while (capacity < minCapacity) {
+    capacity *= 2;
+  }
+  ring->slots = calloc(capacity, sizeof(void *));
+  ring->mask = capacity - 1;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->sleepers, 0);
+  pthread_mutex_init(&ring->lock, NULL);
+  pthread_cond_init(&ring->moved, NULL);
+  return ring->slots != NULL;
+}
+
+static inline void spsc_ring_destroy(struct SpscRing *ring) {
+  free(ring->slots);
+  ring->slots = NULL;
+  pthread_mutex_destroy(&ring->lock);
+  pthread_cond_destroy(&ring->moved);
+}
+
+// Called after moving head or tail.
+static inline void spsc_ring_wake(struct SpscRing *ring) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&ring->sleepers, memory_order_relaxed) != 0) {
+    pthread_mutex_lock(&ring->lock);
+    pthread_cond_broadcast(&ring->moved);
+    pthread_mutex_unlock(&ring->lock);
+  }
+}
+
+static inline bool spsc_ring_try_push(struct SpscRing *ring, void *item) {
+  const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  const size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (tail - head > ring->mask) {
+    return false;
+  }
+  ring->slots[tail & ring->mask] = item;
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  spsc_ring_wake(ring);
+  return true;
+}
+
+static inline void *spsc_ring_try_pop(struct SpscRing *ring) {
+  const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  const size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head == tail) {
+    return NULL;
+  }
+  void *item = ring->slots[head & ring->mask];
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  spsc_ring_wake(ring);
+  return item;
+}
+
+// Waiting spins briefly, for the common case where the other side is about
+// to catch up, and then yields the CPU, for when it's busy despacing.
+static inline void spsc_ring_wait(unsigned *spins) {
+  if (++*spins < 64) {
+    return;
+  }
+  sched_yield();
+}
+
+// After this many waits the other side is most likely blocked on I/O, and
+// push and pop sleep until it moves.
+enum { spscRingWaitsBeforeSleeping = 128 };
+
+static inline bool spsc_ring_has_room(struct SpscRing *ring) {
+  return atomic_load(&ring->tail) - atomic_load(&ring->head) <= ring->mask;
+}
+
+static inline bool spsc_ring_has_items(struct SpscRing *ring) {
+  return atomic_load(&ring->tail) != atomic_load(&ring->head);
+}
+
+static inline void spsc_ring_sleep(struct SpscRing *ring, bool (*ready)(struct SpscRing *)) {
+  pthread_mutex_lock(&ring->lock);
+  atomic_fetch_add(&ring->sleepers, 1);
+  while (!ready(ring)) {
+    pthread_cond_wait(&ring->moved, &ring->lock);
+  }
+  atomic_fetch_sub(&ring->sleepers, 1);
+  pthread_mutex_unlock(&ring->lock);
+}
+
+static inline void spsc_ring_push(struct SpscRing *ring, void *item) {
+  unsigned spins = 0;
+  while (!spsc_ring_try_push(ring, item)) {
+    if (spins < spscRingWaitsBeforeSleeping) {
+      spsc_ring_wait(&spins);
+    } else {
+      spsc_ring_sleep(ring, &spsc_ring_has_room);
+    }
+  }
+}
+
+// Items must not be NULL, which means empty.
+static inline void *spsc_ring_pop(struct SpscRing *ring) {
+  unsigned spins = 0;
+  void *item;
+  while ((item = spsc_ring_try_pop(ring)) == NULL) {
+    if (spins < spscRingWaitsBeforeSleeping) {
+      spsc_ring_wait(&spins);
+    } else {
+      spsc_ring_sleep(ring, &spsc_ring_has_items);
+    }
+  }
+  return item;
+}
+
+#endif /* spsc_ring_h */
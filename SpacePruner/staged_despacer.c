@@ -0,0 +1,123 @@
+//
+//  staged_despacer.c
+//  SpacePruner
+//
+
+#include "staged_despacer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "despace_vector.h"
+
+#if DESPACE_VECTOR
+
+size_t staged_despace(char *bytes, size_t howmany) {
+  uint8_t *data = (uint8_t *)bytes;
+  const size_t chunk_size = 16 * 4;
+  const size_t lineSize = 64;
+  size_t i = despace_clean_prefix_length(bytes, howmany), pos = i;
+
+  while (i < howmany && ((uintptr_t)(data + pos) & (lineSize - 1)) != 0) {
+    pos = despace_byte_to(bytes, pos, data[i++]);
+  }
+
+  // Fewer than 64 bytes are staged between chunks, and a chunk adds at most
+  // 64, so two lines are enough. The staged bytes have all been read from
+  // the input already, so a line can be stored over it.
+  uint8_t __attribute__((aligned(64))) stage[2 * 64];
+  size_t staged = 0;
+  for (; i + chunk_size <= howmany; i += chunk_size) {
+    size_t kept0, kept1, kept2, kept3;
+    const despace_vector reshuf0 = compact_vector(load_vector(data + i), &kept0);
+    const despace_vector reshuf1 = compact_vector(load_vector(data + i + 16), &kept1);
+    const despace_vector reshuf2 = compact_vector(load_vector(data + i + 32), &kept2);
+    const despace_vector reshuf3 = compact_vector(load_vector(data + i + 48), &kept3);
+    store_vector(stage + staged, reshuf0);
+    staged += kept0;
+    store_vector(stage + staged, reshuf1);
+    staged += kept1;
+    store_vector(stage + staged, reshuf2);
+    staged += kept2;
+    store_vector(stage + staged, reshuf3);
+    staged += kept3;
+
+    if (staged >= lineSize) {
+      store_vector(data + pos, load_vector(stage));
+      store_vector(data + pos + 16, load_vector(stage + 16));
+      store_vector(data + pos + 32, load_vector(stage + 32));
+      store_vector(data + pos + 48, load_vector(stage + 48));
+      pos += lineSize;
+      staged -= lineSize;
+      store_vector(stage, load_vector(stage + 64));
+      store_vector(stage + 16, load_vector(stage + 80));
+      store_vector(stage + 32, load_vector(stage + 96));
+      store_vector(stage + 48, load_vector(stage + 112));
+    }
+  }
+
+  memcpy(data + pos, stage, staged);
+  pos += staged;
+  while (i < howmany) {
+    pos = despace_byte_to(bytes, pos, data[i++]);
+  }
+  return pos;
+}
+
+#endif // DESPACE_VECTOR
+
+#if defined(__aarch64__)
+
+size_t neon_register_staged_despace(char *bytes, size_t howmany) {
+  uint8_t *data = (uint8_t *)bytes;
+  const size_t chunk_size = 16 * 4;
+  size_t i = despace_clean_prefix_length(bytes, howmany), pos = i;
+
+  while (i < howmany && ((uintptr_t)(data + pos) & 15) != 0) {
+    pos = despace_byte_to(bytes, pos, data[i++]);
+  }
+
+  const uint8x16_t iota = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+  // The first `pending` bytes of `partial` are output that hasn't been
+  // stored yet; data + pos stays aligned.
+  uint8x16_t partial = vdupq_n_u8(0);
+  unsigned pending = 0;
+  for (; i + chunk_size <= howmany; i += chunk_size) {
+    uint8x16_t blocks[4] = {
+      vld1q_u8(data + i), vld1q_u8(data + i + 16), vld1q_u8(data + i + 32), vld1q_u8(data + i + 48) };
+    for (int b = 0; b != 4; ++b) {
+      size_t kept;
+      const uint8x16_t reshuf = compact_vector(blocks[b], &kept);
+      // Bytes 0..pending-1 come from partial, the rest from the start of
+      // reshuf, which is index 16 in the pair.
+      const uint8x16_t pendingCount = vdupq_n_u8((uint8_t)pending);
+      const uint8x16_t combineIndex = vaddq_u8(
+          iota, vandq_u8(vcgeq_u8(iota, pendingCount), vdupq_n_u8((uint8_t)(16 - pending))));
+      const uint8x16x2_t pair = { { partial, reshuf } };
+      const uint8x16_t combined = vqtbl2q_u8(pair, combineIndex);
+      // What's left of reshuf once combined is full. Indexes past 15 give 0.
+      const uint8x16_t rest = vqtbl1q_u8(reshuf, vaddq_u8(iota, vdupq_n_u8((uint8_t)(16 - pending))));
+
+      // Storing combined when it isn't full is harmless: the bytes it
+      // covers have been loaded, and the full vector will overwrite them.
+      vst1q_u8(data + pos, combined);
+      const unsigned total = pending + (unsigned)kept;
+      const bool full = total >= 16;
+      pos += full ? 16 : 0;
+      partial = vbslq_u8(vdupq_n_u8(full ? 0xFF : 0), rest, combined);
+      pending = total & 15;
+    }
+  }
+
+  uint8_t tail[16];
+  vst1q_u8(tail, partial);
+  memcpy(data + pos, tail, pending);
+  pos += pending;
+  while (i < howmany) {
+    pos = despace_byte_to(bytes, pos, data[i++]);
+  }
+  return pos;
+}
+
+#endif // defined(__aarch64__)
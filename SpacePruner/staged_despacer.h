@@ -0,0 +1,32 @@
+//
+//  staged_despacer.h
+//  SpacePruner
+//
+
+#ifndef staged_despacer_h
+#define staged_despacer_h
+
+#include <stddef.h>
+
+/*
+ The other in-place kernels store 16 bytes at whatever position the output
+ has reached, so most stores are unaligned, some straddle two cache lines,
+ and the next chunk's load may overlap a store that is still in flight.
+ These only ever store aligned vectors, after handling bytes one at a time
+ until the output is aligned.
+ */
+
+#if defined(__aarch64__) || defined(__SSSE3__)
+// Collects the output in a 64-byte staging buffer in L1 and stores whole,
+// aligned cache lines.
+size_t staged_despace(char *bytes, size_t howmany);
+#endif
+
+#if defined(__aarch64__)
+// Keeps the incomplete output vector in a register, fills it from the next
+// compacted block with a two-register table lookup, and stores it, aligned,
+// once it is full. There are no branches on the data.
+size_t neon_register_staged_despace(char *bytes, size_t howmany);
+#endif
+
+#endif /* staged_despacer_h */
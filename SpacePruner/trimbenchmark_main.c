@@ -0,0 +1,203 @@
+// gcc -std=gnu11 -O3 -o trimbenchmark trimbenchmark_main.c whitespace_trimmer.c best_despacer.c adaptive_despacer.c staged_despacer.c interleaved_despacer.c nontemporal_despacer.c bigtable.c benchmark_timing.c -lm -lpthread
+//
+//  trimbenchmark_main.c
+//  SpacePruner
+//
+//  Times trimming whitespace from both ends of strings against doing it a
+//  byte at a time and against despacing the whole string, which is what
+//  callers that only need the ends trimmed otherwise do.
+//
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark_timing.h"
+#include "best_despacer.h"
+#include "whitespace_trimmer.h"
+
+/*
+ Short strings take a few nanoseconds, so each sample times a batch of
+ calls on batch copies of the string, and the copies are refreshed before
+ the sample for the kernels that write.
+ */
+struct Batch {
+  char *copies;
+  size_t size;
+  size_t count;
+};
+
+typedef size_t (*trim_function_ptr)(struct Batch *batch);
+
+static size_t sink;
+
+static size_t run_trim(struct Batch *batch) {
+  size_t total = 0;
+  for (size_t c = 0; c != batch->count; ++c) {
+    total += trim(batch->copies + c * batch->size, batch->size).howmany;
+  }
+  return total;
+}
+
+static size_t run_trim_scalar(struct Batch *batch) {
+  size_t total = 0;
+  for (size_t c = 0; c != batch->count; ++c) {
+    total += trim_scalar(batch->copies + c * batch->size, batch->size).howmany;
+  }
+  return total;
+}
+
+static size_t run_despace_best(struct Batch *batch) {
+  size_t total = 0;
+  for (size_t c = 0; c != batch->count; ++c) {
+    total += despace_best(batch->copies + c * batch->size, batch->size);
+  }
+  return total;
+}
+
+struct TrimmerAndName {
+  trim_function_ptr ptr;
+  const char *name;
+  bool writes;
+};
+
+// The first is what the others are compared with.
+static const struct TrimmerAndName trimmers[] = {
+  { run_trim, "trim", false },
+  { run_trim_scalar, "trim_scalar", false },
+  { run_despace_best, "despace_best", true },
+};
+
+// Words with single spaces between them, padded on each side with pad
+// bytes of spaces, tabs and line ends.
+static void fill_padded(char *text, size_t size, size_t pad) {
+  static const char blanks[] = " \t\r\n";
+  for (size_t i = 0; i != size; ++i) {
+    if (i < pad || i >= size - pad) {
+      text[i] = blanks[rand() % 4];
+    } else {
+      text[i] = rand() % 6 == 0 ? ' ' : (char)('a' + rand() % 26);
+    }
+  }
+}
+
+static size_t parse_size(const char *text) {
+  char *end;
+  double value = strtod(text, &end);
+  switch (*end) {
+    case 'G': case 'g': value *= 1024;  // fall through
+    case 'M': case 'm': value *= 1024;  // fall through
+    case 'K': case 'k': value *= 1024;
+  }
+  return (size_t)value;
+}
+
+// Returns the median time per call.
+static double time_trimmer(const struct TrimmerAndName *trimmer, const char *text, struct Batch *batch,
+                           size_t repeat, uint64_t *samples, double *spread) {
+  for (size_t r = 0; r != repeat; ++r) {
+    if (trimmer->writes || r == 0) {
+      for (size_t c = 0; c != batch->count; ++c) {
+        memcpy(batch->copies + c * batch->size, text, batch->size);
+      }
+    }
+    __asm volatile("" ::: "memory");
+    const uint64_t start = time_in_ns();
+    sink += trimmer->ptr(batch);
+    samples[r] = time_in_ns() - start;
+    __asm volatile("" ::: "memory");
+  }
+  struct BenchmarkStats stats;
+  compute_benchmark_stats(samples, repeat, &stats);
+  *spread = benchmark_stats_spread(&stats);
+  return (double)stats.median / (double)batch->count;
+}
+
+static void usage(FILE *stream, const char *program) {
+  fprintf(stream,
+          "usage: %s [options]\n"
+          "  --repeat N         timed samples per kernel (default 100)\n"
+          "  --sizes A,B,...    string sizes to time (default 16,64,256,4K,64K,1M)\n"
+          "  --pad PERCENT      whitespace on each end, as a share of the size (default 10)\n"
+          "Sizes accept K, M and G suffixes.\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  static const struct option longOptions[] = {
+    { "repeat", required_argument, NULL, 'r' },
+    { "sizes", required_argument, NULL, 's' },
+    { "pad", required_argument, NULL, 'p' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  size_t repeat = 100;
+  size_t padPercent = 10;
+  size_t sizes[16] = { 16, 64, 256, 4096, 65536, 1 << 20 };
+  size_t sizeCount = 6;
+  int option;
+  while ((option = getopt_long(argc, argv, "h", longOptions, NULL)) != -1) {
+    switch (option) {
+      case 'r': repeat = parse_size(optarg); break;
+      case 'p': padPercent = parse_size(optarg); break;
+      case 's':
+        sizeCount = 0;
+        for (char *item = strtok(optarg, ","); item && sizeCount != 16; item = strtok(NULL, ",")) {
+          sizes[sizeCount++] = parse_size(item);
+        }
+        break;
+      case 'h':
+        usage(stdout, argv[0]);
+        return 0;
+      default:
+        usage(stderr, argv[0]);
+        return 2;
+    }
+  }
+  if (repeat == 0 || padPercent > 50) {
+    usage(stderr, argv[0]);
+    return 2;
+  }
+
+  pin_current_thread_to_cpu(-1);
+  wait_for_stable_frequency(500 * 1000 * 1000);
+  printf("full despacing with %s\n", despace_best_name());
+  uint64_t *samples = malloc(repeat * sizeof(uint64_t));
+  bool ok = samples != NULL;
+  srand(1234);
+  for (size_t s = 0; s != sizeCount && ok; ++s) {
+    const size_t size = sizes[s];
+    const size_t pad = size * padPercent / 100 > 0 ? size * padPercent / 100 : 1;
+    // Enough copies for about 64 KB a sample.
+    struct Batch batch = { NULL, size, size < 65536 ? 65536 / size : 1 };
+    char *text = malloc(size);
+    batch.copies = malloc(batch.count * size);
+    if (size < 2 * pad || text == NULL || batch.copies == NULL) {
+      ok = false;
+    } else {
+      fill_padded(text, size, pad);
+      const struct TrimmedText expected = trim_scalar(text, size);
+      const struct TrimmedText trimmed = trim(text, size);
+      if (trimmed.bytes != expected.bytes || trimmed.howmany != expected.howmany) {
+        printf("trim: wrong result\n");
+        ok = false;
+      }
+      printf("\n%zu bytes, %zu of whitespace on each end\n", size, pad);
+      double baseline = 0;
+      for (size_t t = 0; t != sizeof(trimmers) / sizeof(trimmers[0]) && ok; ++t) {
+        double spread;
+        const double perCall = time_trimmer(&trimmers[t], text, &batch, repeat, samples, &spread);
+        if (t == 0) {
+          baseline = perCall;
+        }
+        printf("%-16s %12.1f ns/call %8.2f GB/s %8.2fx  spread %5.1f%%\n", trimmers[t].name, perCall,
+               (double)size / perCall, perCall / baseline, 100 * spread);
+      }
+    }
+    free(text);
+    free(batch.copies);
+  }
+  free(samples);
+  return ok ? 0 : 2;
+}
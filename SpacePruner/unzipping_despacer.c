@@ -7,17 +7,28 @@
 
 #include "unzipping_despacer.h"
 
+#include "despacer.h"
+
 #ifdef __ARM_NEON
 #include <arm_neon.h>
 
-size_t neon_unzipping_despace(char *bytes, size_t howmany) {
+size_t neon_unzipping_despace_aligning(char *bytes, size_t howmany, size_t alignment) {
   const size_t blockCount = 2;
   const size_t blockSize = 8 * 16;
   const uint8_t space = 32;
 
-  uint8_t* dest = (uint8_t*)bytes;
-  const uint8_t* source = (uint8_t*)bytes;
-  const uint8_t* sourceEnd = source + howmany;
+  const size_t cleanPrefix = despace_clean_prefix_length(bytes, howmany);
+  uint8_t* dest = (uint8_t*)bytes + cleanPrefix;
+  const uint8_t* source = (uint8_t*)bytes + cleanPrefix;
+  const uint8_t* sourceEnd = (uint8_t*)bytes + howmany;
+
+  const uint8_t* prologueEnd = source + despace_prologue_length((const char*)source, howmany - cleanPrefix, alignment);
+  while (source < prologueEnd) {
+    const uint8_t c = *source++;
+    if (c > space) {
+      *dest++ = c;
+    }
+  }
 
   while (sourceEnd - source >= blockCount * blockSize) {
     /*
@@ -154,7 +165,7 @@ size_t neon_unzipping_despace(char *bytes, size_t howmany) {
     source += blockCount * blockSize;
   }
   while (source < sourceEnd) {
-    const char c = *source++;
+    const uint8_t c = *source++;
     if (c > space) {
       *dest++ = c;
     }
@@ -162,4 +173,8 @@ size_t neon_unzipping_despace(char *bytes, size_t howmany) {
   return (char*)dest - bytes;
 }
 
+size_t neon_unzipping_despace(char *bytes, size_t howmany) {
+  return neon_unzipping_despace_aligning(bytes, howmany, 1);
+}
+
 #endif // __ARM_NEON
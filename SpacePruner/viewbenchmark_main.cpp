@@ -0,0 +1,304 @@
+// gcc -std=gnu11 -O3 -c best_despacer.c adaptive_despacer.c staged_despacer.c interleaved_despacer.c nontemporal_despacer.c parallel_despacer.c despace_counter.c bigtable.c benchmark_timing.c && g++ -std=c++20 -O3 -o viewbenchmark viewbenchmark_main.cpp *.o -lm -lpthread
+//
+//  viewbenchmark_main.cpp
+//  SpacePruner
+//
+//  Feeds a toy parser, which sums comma-separated numbers, through
+//  despaced_view and compares it with parsing a buffer despaced beforehand,
+//  with despacing a copy and then parsing it, and with a parser that skips
+//  whitespace itself. Also checks despaced_view and despace_string.hpp
+//  against each other, and that the view models the range concepts it is
+//  meant to.
+//
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <concepts>
+#include <iterator>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "despace_string.hpp"
+#include "despaced_view.hpp"
+
+extern "C" {
+#include "benchmark_timing.h"
+}
+
+using spacepruner::despaced_view;
+
+static_assert(std::ranges::input_range<despaced_view<>>);
+static_assert(std::ranges::view<despaced_view<>>);
+static_assert(std::ranges::borrowed_range<despaced_view<>>);
+static_assert(std::same_as<std::ranges::range_value_t<despaced_view<>>, char>);
+static_assert(std::input_iterator<despaced_view<64>::iterator>);
+static_assert(std::sentinel_for<std::default_sentinel_t, despaced_view<64>::iterator>);
+static_assert(std::same_as<decltype(std::string_view() | spacepruner::views::despaced), despaced_view<>>);
+static_assert(std::same_as<decltype(spacepruner::views::despaced(std::string())), despaced_view<>>);
+
+namespace {
+
+// Sums the numbers between commas, one byte at a time.
+struct NumberSum {
+  uint64_t sum = 0;
+  uint64_t value = 0;
+
+  void feed(char c) {
+    if (c == ',') {
+      sum += value;
+      value = 0;
+    } else {
+      value = value * 10 + static_cast<uint64_t>(c - '0');
+    }
+  }
+
+  void feed(std::span<const char> chunk) {
+    for (const char c : chunk) {
+      feed(c);
+    }
+  }
+
+  uint64_t finish() const {
+    return sum + value;
+  }
+};
+
+uint64_t parse_predespaced(std::string_view, std::string_view despaced) {
+  NumberSum parser;
+  parser.feed(std::span<const char>(despaced.data(), despaced.size()));
+  return parser.finish();
+}
+
+uint64_t parse_skipping(std::string_view text, std::string_view) {
+  NumberSum parser;
+  for (const char c : text) {
+    if (static_cast<unsigned char>(c) > 32) {
+      parser.feed(c);
+    }
+  }
+  return parser.finish();
+}
+
+uint64_t parse_despaced_copy(std::string_view text, std::string_view) {
+  const std::string copy = spacepruner::despaced(text);
+  NumberSum parser;
+  parser.feed(std::span<const char>(copy.data(), copy.size()));
+  return parser.finish();
+}
+
+uint64_t parse_view(std::string_view text, std::string_view) {
+  NumberSum parser;
+  for (const char c : text | spacepruner::views::despaced) {
+    parser.feed(c);
+  }
+  return parser.finish();
+}
+
+uint64_t parse_view64(std::string_view text, std::string_view) {
+  NumberSum parser;
+  for (const char c : despaced_view<64>(text)) {
+    parser.feed(c);
+  }
+  return parser.finish();
+}
+
+uint64_t parse_chunks(std::string_view text, std::string_view) {
+  NumberSum parser;
+  despaced_view<>(text).for_each_chunk([&parser](std::span<const char> chunk) { parser.feed(chunk); });
+  return parser.finish();
+}
+
+typedef uint64_t (*parse_function_ptr)(std::string_view text, std::string_view despaced);
+
+struct ParserAndName {
+  parse_function_ptr ptr;
+  const char *name;
+};
+
+// The first is what the others are compared with.
+const ParserAndName parsers[] = {
+  { parse_predespaced, "predespaced" },
+  { parse_skipping, "skipping" },
+  { parse_despaced_copy, "despaced_copy" },
+  { parse_view, "view" },
+  { parse_view64, "view<64>" },
+  { parse_chunks, "for_each_chunk" },
+};
+
+volatile uint64_t sink;
+
+// Numbers of up to six digits between commas, with whitespace on either
+// side of about one in four of them.
+std::string make_numbers(size_t size) {
+  static const char blanks[] = " \t\r\n";
+  std::string text;
+  text.reserve(size + 16);
+  while (text.size() < size) {
+    const int digits = 1 + rand() % 6;
+    for (int d = 0; d != digits; ++d) {
+      text.push_back(static_cast<char>('0' + rand() % 10));
+    }
+    text.push_back(',');
+    while (rand() % 4 == 0) {
+      text.push_back(blanks[rand() % 4]);
+    }
+  }
+  text.resize(size);
+  return text;
+}
+
+size_t parse_size(const char *text) {
+  char *end;
+  double value = strtod(text, &end);
+  switch (*end) {
+    case 'G': case 'g': value *= 1024;  // fall through
+    case 'M': case 'm': value *= 1024;  // fall through
+    case 'K': case 'k': value *= 1024;
+  }
+  return static_cast<size_t>(value);
+}
+
+bool check(bool ok, const char *what, size_t size) {
+  if (!ok) {
+    printf("%s: wrong result for %zu bytes\n", what, size);
+  }
+  return ok;
+}
+
+// The view, its chunks and the string functions against a byte-at-a-time
+// reference, on sizes around the block size and the stack threshold.
+bool check_all(const std::string &text) {
+  std::string expected;
+  for (const char c : text) {
+    if (static_cast<unsigned char>(c) > 32) {
+      expected.push_back(c);
+    }
+  }
+  const despaced_view<> view(text);
+  std::string iterated;
+  std::ranges::copy(view, std::back_inserter(iterated));
+  std::string chunked;
+  view.for_each_chunk([&chunked](std::span<const char> chunk) { chunked.append(chunk.data(), chunk.size()); });
+  std::string firstChunk;
+  const bool finished = view.for_each_chunk([&firstChunk](std::span<const char> chunk) {
+    firstChunk.assign(chunk.data(), chunk.size());
+    return false;
+  });
+  std::string inPlace = text;
+  spacepruner::despace(inPlace);
+  std::string spanned = text;
+  const std::span<char> left = spacepruner::despace(std::span<char>(spanned));
+  bool ok = check(iterated == expected, "despaced_view", text.size());
+  ok &= check(chunked == expected, "for_each_chunk", text.size());
+  ok &= check(finished == expected.empty() && expected.compare(0, firstChunk.size(), firstChunk) == 0,
+              "for_each_chunk stopping early", text.size());
+  ok &= check(spacepruner::despaced(text) == expected, "despaced", text.size());
+  ok &= check(inPlace == expected, "despace(std::string&)", text.size());
+  ok &= check(std::string_view(left.data(), left.size()) == expected, "despace(std::span)", text.size());
+  return ok;
+}
+
+// Returns the median time per source byte.
+double time_parser(const ParserAndName &parser, std::string_view text, std::string_view despaced,
+                   size_t repeat, uint64_t *samples, double *spread) {
+  for (size_t r = 0; r != repeat; ++r) {
+    __asm volatile("" ::: "memory");
+    const uint64_t start = time_in_ns();
+    sink = parser.ptr(text, despaced);
+    samples[r] = time_in_ns() - start;
+    __asm volatile("" ::: "memory");
+  }
+  BenchmarkStats stats;
+  compute_benchmark_stats(samples, repeat, &stats);
+  *spread = benchmark_stats_spread(&stats);
+  return static_cast<double>(stats.median) / static_cast<double>(text.size());
+}
+
+void usage(FILE *stream, const char *program) {
+  fprintf(stream,
+          "usage: %s [options]\n"
+          "  --repeat N         timed samples per parser (default 50)\n"
+          "  --sizes A,B,...    input sizes to time (default 64K,1M,16M)\n"
+          "Sizes accept K, M and G suffixes.\n",
+          program);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  static const struct option longOptions[] = {
+    { "repeat", required_argument, NULL, 'r' },
+    { "sizes", required_argument, NULL, 's' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+  size_t repeat = 50;
+  size_t sizes[16] = { 65536, 1 << 20, 16 << 20 };
+  size_t sizeCount = 3;
+  int option;
+  while ((option = getopt_long(argc, argv, "h", longOptions, NULL)) != -1) {
+    switch (option) {
+      case 'r': repeat = parse_size(optarg); break;
+      case 's':
+        sizeCount = 0;
+        for (char *item = strtok(optarg, ","); item && sizeCount != 16; item = strtok(NULL, ",")) {
+          sizes[sizeCount++] = parse_size(item);
+        }
+        break;
+      case 'h':
+        usage(stdout, argv[0]);
+        return 0;
+      default:
+        usage(stderr, argv[0]);
+        return 2;
+    }
+  }
+  if (repeat == 0) {
+    usage(stderr, argv[0]);
+    return 2;
+  }
+
+  srand(1234);
+  bool ok = true;
+  for (const size_t size : { 0, 1, 63, 64, 65, 255, 256, 257, 1000, 1024, 1025, 5000, 100000 }) {
+    ok &= check_all(make_numbers(size));
+  }
+  if (!ok) {
+    return 2;
+  }
+
+  pin_current_thread_to_cpu(-1);
+  wait_for_stable_frequency(500 * 1000 * 1000);
+  uint64_t *samples = static_cast<uint64_t *>(malloc(repeat * sizeof(uint64_t)));
+  ok = samples != NULL;
+  for (size_t s = 0; s != sizeCount && ok; ++s) {
+    const std::string text = make_numbers(sizes[s]);
+    const std::string despaced = spacepruner::despaced(text);
+    const uint64_t expected = parse_predespaced(text, despaced);
+    printf("\n%zu bytes, %zu after despacing\n", text.size(), despaced.size());
+    double baseline = 0;
+    for (size_t p = 0; p != sizeof(parsers) / sizeof(parsers[0]) && ok; ++p) {
+      if (parsers[p].ptr(text, despaced) != expected) {
+        printf("%s: wrong sum\n", parsers[p].name);
+        ok = false;
+        break;
+      }
+      double spread;
+      const double perByte = time_parser(parsers[p], text, despaced, repeat, samples, &spread);
+      if (p == 0) {
+        baseline = perByte;
+      }
+      printf("%-16s %8.3f ns/byte %8.2f GB/s %8.2fx  spread %5.1f%%\n", parsers[p].name, perByte,
+             1 / perByte, perByte / baseline, 100 * spread);
+    }
+  }
+  free(samples);
+  return ok ? 0 : 2;
+}
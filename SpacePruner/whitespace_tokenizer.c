@@ -0,0 +1,78 @@
+//
+//  whitespace_tokenizer.c
+//  SpacePruner
+//
+
+#include "whitespace_tokenizer.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "despace_vector.h"
+
+size_t tokenize_whitespace_scalar(const char *bytes, size_t howmany, uint32_t *offsets) {
+  size_t count = 0;
+  bool inToken = false;
+  for (size_t i = 0; i != howmany; ++i) {
+    const bool kept = (unsigned char)bytes[i] > ' ';
+    if (kept != inToken) {
+      offsets[count++] = (uint32_t)i;
+      inToken = kept;
+    }
+  }
+  if (inToken) {
+    offsets[count++] = (uint32_t)howmany;
+  }
+  return count / 2;
+}
+
+// Bit j is set if p[j] is kept by despacing.
+static inline uint64_t nonwhite_mask(const uint8_t *p) {
+  return ~white_block_mask(p);
+}
+
+/*
+ Writes base plus the position of every set bit, lowest first, and returns
+ how many there are. Four go out per round whether or not there are that
+ many left: with the top bit or'ed in, an empty mask gives 63, which the
+ next call or the caller overwrites.
+ */
+static inline size_t write_bit_positions(uint32_t *out, uint32_t base, uint64_t bits) {
+  const size_t count = (size_t)__builtin_popcountll(bits);
+  const uint64_t top = UINT64_C(1) << 63;
+  for (size_t k = 0; k < count; k += 4) {
+    out[k] = base + (uint32_t)__builtin_ctzll(bits | top);
+    bits &= bits - 1;
+    out[k + 1] = base + (uint32_t)__builtin_ctzll(bits | top);
+    bits &= bits - 1;
+    out[k + 2] = base + (uint32_t)__builtin_ctzll(bits | top);
+    bits &= bits - 1;
+    out[k + 3] = base + (uint32_t)__builtin_ctzll(bits | top);
+    bits &= bits - 1;
+  }
+  return count;
+}
+
+size_t tokenize_whitespace(const char *bytes, size_t howmany, uint32_t *offsets) {
+  const uint8_t *data = (const uint8_t *)bytes;
+  size_t count = 0;
+  uint64_t carry = 0;  // whether the byte before the block is in a token
+  size_t i = 0;
+  for (; i + 64 <= howmany; i += 64) {
+    const uint64_t kept = nonwhite_mask(data + i);
+    const uint64_t boundaries = kept ^ (kept << 1 | carry);
+    carry = kept >> 63;
+    count += write_bit_positions(offsets + count, (uint32_t)i, boundaries);
+  }
+  if (i < howmany) {
+    // Padded with spaces, which end a token still open at the end.
+    uint8_t last[64];
+    memcpy(last, data + i, howmany - i);
+    memset(last + (howmany - i), ' ', 64 - (howmany - i));
+    const uint64_t kept = nonwhite_mask(last);
+    count += write_bit_positions(offsets + count, (uint32_t)i, kept ^ (kept << 1 | carry));
+  } else if (carry) {
+    offsets[count++] = (uint32_t)howmany;
+  }
+  return count / 2;
+}
@@ -0,0 +1,33 @@
+//
+//  whitespace_tokenizer.h
+//  SpacePruner
+//
+
+#ifndef whitespace_tokenizer_h
+#define whitespace_tokenizer_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Entries offsets needs for howmany bytes: two per token, at most one token
+// every two bytes, and a few the kernel may write past the last token.
+static inline size_t whitespace_token_capacity(size_t howmany) {
+  return howmany + 8;
+}
+
+/*
+ Splits on whitespace without touching the bytes: writes the start and end
+ (one past the last byte) of every run of bytes above 32 to offsets, as
+ pairs, and returns how many runs there are. howmany must be below 2^32.
+
+ Run boundaries are where the non-whitespace mask of a 64-byte block
+ differs from itself shifted up a byte, the top bit carried from the block
+ before; starts and ends alternate, so the set bits are written out in
+ order, four at a time, with no branch per byte or per token.
+ */
+size_t tokenize_whitespace(const char *bytes, size_t howmany, uint32_t *offsets);
+
+// One byte at a time, for reference.
+size_t tokenize_whitespace_scalar(const char *bytes, size_t howmany, uint32_t *offsets);
+
+#endif /* whitespace_tokenizer_h */
@@ -0,0 +1,166 @@
+//
+//  whitespace_trimmer.c
+//  SpacePruner
+//
+
+#include "whitespace_trimmer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "despacer.h"
+
+#if !defined(__aarch64__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+struct TrimmedText trim_left_scalar(const char *bytes, size_t howmany) {
+  size_t start = 0;
+  while (start != howmany && (unsigned char)bytes[start] <= ' ') {
+    ++start;
+  }
+  return (struct TrimmedText){ bytes + start, howmany - start };
+}
+
+struct TrimmedText trim_right_scalar(const char *bytes, size_t howmany) {
+  size_t end = howmany;
+  while (end != 0 && (unsigned char)bytes[end - 1] <= ' ') {
+    --end;
+  }
+  return (struct TrimmedText){ bytes, end };
+}
+
+struct TrimmedText trim_scalar(const char *bytes, size_t howmany) {
+  const struct TrimmedText left = trim_left_scalar(bytes, howmany);
+  return trim_right_scalar(left.bytes, left.howmany);
+}
+
+#if defined(__aarch64__)
+
+// Four bits per byte, from narrowing the 16-bit lanes of the compare: bits
+// 4j to 4j + 3 are set if p[j] is kept by despacing.
+static inline uint64_t nonwhite_nibbles(const uint8_t *p) {
+  const uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(is_nonwhite(vld1q_u8(p))), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+
+// How many of the 16 bytes at p are whitespace before the first that isn't.
+static inline unsigned leading_white16(const uint8_t *p) {
+  const uint64_t nibbles = nonwhite_nibbles(p);
+  return nibbles == 0 ? 16 : (unsigned)__builtin_ctzll(nibbles) / 4;
+}
+
+// And after the last.
+static inline unsigned trailing_white16(const uint8_t *p) {
+  const uint64_t nibbles = nonwhite_nibbles(p);
+  return nibbles == 0 ? 16 : (unsigned)__builtin_clzll(nibbles) / 4;
+}
+
+static inline bool all_white64(const uint8_t *p) {
+  const uint8x16_t nonwhite = vorrq_u8(vorrq_u8(is_nonwhite(vld1q_u8(p)), is_nonwhite(vld1q_u8(p + 16))),
+                                       vorrq_u8(is_nonwhite(vld1q_u8(p + 32)), is_nonwhite(vld1q_u8(p + 48))));
+  return vmaxvq_u8(nonwhite) == 0;
+}
+
+#elif defined(__SSE2__)
+
+static inline __m128i nonwhite16(const uint8_t *p) {
+  const __m128i v = _mm_loadu_si128((const __m128i *)p);
+  return _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(' ' + 1)), v);
+}
+
+static inline unsigned leading_white16(const uint8_t *p) {
+  const unsigned mask = (unsigned)_mm_movemask_epi8(nonwhite16(p));
+  return mask == 0 ? 16 : (unsigned)__builtin_ctz(mask);
+}
+
+// The mask is in the low 16 bits of 32.
+static inline unsigned trailing_white16(const uint8_t *p) {
+  const unsigned mask = (unsigned)_mm_movemask_epi8(nonwhite16(p));
+  return mask == 0 ? 16 : (unsigned)__builtin_clz(mask) - 16;
+}
+
+static inline bool all_white64(const uint8_t *p) {
+  const __m128i nonwhite = _mm_or_si128(_mm_or_si128(nonwhite16(p), nonwhite16(p + 16)),
+                                        _mm_or_si128(nonwhite16(p + 32), nonwhite16(p + 48)));
+  return _mm_movemask_epi8(nonwhite) == 0;
+}
+
+#else
+
+static inline unsigned leading_white16(const uint8_t *p) {
+  unsigned j = 0;
+  while (j != 16 && p[j] <= ' ') {
+    ++j;
+  }
+  return j;
+}
+
+static inline unsigned trailing_white16(const uint8_t *p) {
+  unsigned j = 0;
+  while (j != 16 && p[15 - j] <= ' ') {
+    ++j;
+  }
+  return j;
+}
+
+static inline bool all_white64(const uint8_t *p) {
+  for (int k = 0; k != 4; ++k) {
+    if (leading_white16(p + 16 * k) != 16) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#endif
+
+struct TrimmedText trim_left(const char *bytes, size_t howmany) {
+  if (howmany < 16) {
+    return trim_left_scalar(bytes, howmany);
+  }
+  const uint8_t *data = (const uint8_t *)bytes;
+  size_t start = 0;
+  for (; start + 16 <= howmany; start += 16) {
+    const unsigned white = leading_white16(data + start);
+    if (white != 16) {
+      return (struct TrimmedText){ bytes + start + white, howmany - start - white };
+    }
+    // Past the first vector, whitespace tends to go on.
+    while (start + 16 + 64 <= howmany && all_white64(data + start + 16)) {
+      start += 64;
+    }
+  }
+  if (start != howmany) {
+    // The last 16, the first of which are known to be whitespace.
+    start = howmany - 16 + leading_white16(data + howmany - 16);
+  }
+  return (struct TrimmedText){ bytes + start, howmany - start };
+}
+
+struct TrimmedText trim_right(const char *bytes, size_t howmany) {
+  if (howmany < 16) {
+    return trim_right_scalar(bytes, howmany);
+  }
+  const uint8_t *data = (const uint8_t *)bytes;
+  size_t end = howmany;
+  for (; end >= 16; end -= 16) {
+    const unsigned white = trailing_white16(data + end - 16);
+    if (white != 16) {
+      return (struct TrimmedText){ bytes, end - white };
+    }
+    while (end >= 16 + 64 && all_white64(data + end - 16 - 64)) {
+      end -= 64;
+    }
+  }
+  if (end != 0) {
+    // The first 16, the last of which are known to be whitespace.
+    end = 16 - trailing_white16(data);
+  }
+  return (struct TrimmedText){ bytes, end };
+}
+
+struct TrimmedText trim(const char *bytes, size_t howmany) {
+  const struct TrimmedText left = trim_left(bytes, howmany);
+  return trim_right(left.bytes, left.howmany);
+}
@@ -0,0 +1,37 @@
+//
+//  whitespace_trimmer.h
+//  SpacePruner
+//
+
+#ifndef whitespace_trimmer_h
+#define whitespace_trimmer_h
+
+#include <stddef.h>
+
+// Part of a caller's bytes, which are left as they are.
+struct TrimmedText {
+  const char *bytes;
+  size_t howmany;
+};
+
+/*
+ Drop whitespace (every byte up to 32) from the start, the end or both, by
+ moving the ends of a view in; nothing is copied, so this costs in
+ proportion to the whitespace skipped, not to the length. All-whitespace
+ input gives an empty view.
+
+ Both ends are scanned 16 bytes at a time, a 64-byte block at a time
+ through long runs, and the end of the last vector is read again rather
+ than finished a byte at a time. From the right, the last non-whitespace
+ byte of a vector is found with a leading zero count of its mask.
+ */
+struct TrimmedText trim_left(const char *bytes, size_t howmany);
+struct TrimmedText trim_right(const char *bytes, size_t howmany);
+struct TrimmedText trim(const char *bytes, size_t howmany);
+
+// One byte at a time, for reference.
+struct TrimmedText trim_left_scalar(const char *bytes, size_t howmany);
+struct TrimmedText trim_right_scalar(const char *bytes, size_t howmany);
+struct TrimmedText trim_scalar(const char *bytes, size_t howmany);
+
+#endif /* whitespace_trimmer_h */